@@ -0,0 +1,40 @@
+#![feature(test)]
+
+extern crate test;
+
+use bin_dasm::{disassemble, DasmOptions, OutputFormat};
+use std::path::Path;
+use test::{black_box, Bencher};
+
+fn bench(b: &mut Bencher, follow_control_flow: bool, format: OutputFormat) {
+  let path = Path::new(env!("CARGO_MANIFEST_DIR"))
+    .join("../data/nc3000-gvb+.decrypted_bin");
+  let bytes = std::fs::read(path).unwrap();
+  b.bytes = bytes.len() as u64;
+  b.iter(|| {
+    let options = DasmOptions {
+      starting_address: None,
+      follow_control_flow,
+      vectors: vec![],
+      format,
+    };
+    let mut output = Vec::with_capacity(1 << 20);
+    disassemble(black_box(&bytes), &mut output, options).unwrap();
+    output
+  });
+}
+
+#[bench]
+fn disassemble_linear(b: &mut Bencher) {
+  bench(b, false, OutputFormat::Text);
+}
+
+#[bench]
+fn disassemble_control_flow(b: &mut Bencher) {
+  bench(b, true, OutputFormat::Text);
+}
+
+#[bench]
+fn disassemble_json(b: &mut Bencher) {
+  bench(b, false, OutputFormat::JsonLines);
+}
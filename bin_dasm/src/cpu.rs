@@ -0,0 +1,757 @@
+//! A cycle-counted interpreter of the 6502 CPU of NC3000, for running the
+//! machine code called by GVBASIC programs.
+//!
+//! Instructions are decoded with the same `INSTRUCTION_TABLE` as the
+//! disassembler.
+
+use super::{AddressMode, Mnemonic, INSTRUCTION_TABLE};
+use std::convert::TryInto;
+use std::rc::Rc;
+
+/// The memory seen by the CPU.
+pub trait Bus {
+  fn read(&mut self, addr: u16) -> u8;
+
+  fn write(&mut self, addr: u16, value: u8);
+}
+
+/// Selects the bank of NOR flash mapped at $4000-$BFFF.
+pub const NOR_BANK: u16 = 0x00;
+/// Bit 7 maps SRAM (1) or NOR flash (0) at $4000-$BFFF. The low 4 bits map
+/// RAM04 (1) or a page of the active BIOS (2 and above) at $C000-$DFFF.
+pub const BANK_CONTROL: u16 = 0x0a;
+/// Maps RAMB at $2000-$27FF when set to 4.
+pub const RAMB_BANK: u16 = 0x0d;
+
+/// A bank switching hook, called after one of the bank registers is written,
+/// with the whole address space, the register and the value written. It is
+/// expected to copy the contents of the newly selected banks into their
+/// windows.
+pub type BankSwitch = Box<dyn FnMut(&mut [u8; 0x10000], u16, u8)>;
+
+const PAGE_SIZE: usize = 0x100;
+const NUM_PAGES: usize = 0x10000 / PAGE_SIZE;
+
+/// The flat 64 KiB address space. Bank switching is left to a hook, since the
+/// images of the banks are not part of a .BIN program.
+pub struct Memory {
+  bytes: Box<[u8; 0x10000]>,
+  bank_switch: Option<BankSwitch>,
+  /// One bit for each page written since the last snapshot.
+  dirty: [u64; NUM_PAGES / 64],
+  last_snapshot: Option<MemorySnapshot>,
+}
+
+/// The contents of `Memory` at some point. Pages are shared between
+/// snapshots, so taking a snapshot only copies the pages written since the
+/// last one.
+#[derive(Clone)]
+pub struct MemorySnapshot {
+  pages: Rc<[Rc<[u8; PAGE_SIZE]>]>,
+}
+
+impl Memory {
+  pub fn new() -> Self {
+    Self {
+      bytes: vec![0; 0x10000].into_boxed_slice().try_into().unwrap(),
+      bank_switch: None,
+      dirty: [!0; NUM_PAGES / 64],
+      last_snapshot: None,
+    }
+  }
+
+  /// Copies `data` into memory at `addr`, wrapping around at the end of the
+  /// address space.
+  pub fn load(&mut self, addr: u16, data: &[u8]) {
+    for (i, &b) in data.iter().enumerate() {
+      self.write_byte(addr.wrapping_add(i as u16), b);
+    }
+  }
+
+  pub fn bytes(&self) -> &[u8; 0x10000] {
+    &self.bytes
+  }
+
+  pub fn bytes_mut(&mut self) -> &mut [u8; 0x10000] {
+    self.dirty = [!0; NUM_PAGES / 64];
+    &mut self.bytes
+  }
+
+  pub fn set_bank_switch(&mut self, hook: BankSwitch) {
+    self.bank_switch = Some(hook);
+  }
+
+  pub fn snapshot(&mut self) -> MemorySnapshot {
+    let pages = (0..NUM_PAGES)
+      .map(|i| match &self.last_snapshot {
+        Some(last) if self.dirty[i / 64] & (1 << (i % 64)) == 0 => {
+          last.pages[i].clone()
+        }
+        _ => Rc::new(self.page(i)),
+      })
+      .collect();
+    let snapshot = MemorySnapshot { pages };
+    self.dirty = [0; NUM_PAGES / 64];
+    self.last_snapshot = Some(snapshot.clone());
+    snapshot
+  }
+
+  /// Copies only the pages that differ from `snapshot`.
+  pub fn restore(&mut self, snapshot: &MemorySnapshot) {
+    for (i, page) in snapshot.pages.iter().enumerate() {
+      let unchanged = match &self.last_snapshot {
+        Some(last) => {
+          Rc::ptr_eq(&last.pages[i], page)
+            && self.dirty[i / 64] & (1 << (i % 64)) == 0
+        }
+        None => false,
+      };
+      if !unchanged {
+        self.bytes[i * PAGE_SIZE..(i + 1) * PAGE_SIZE].copy_from_slice(&**page);
+      }
+    }
+    self.dirty = [0; NUM_PAGES / 64];
+    self.last_snapshot = Some(snapshot.clone());
+  }
+
+  fn page(&self, i: usize) -> [u8; PAGE_SIZE] {
+    self.bytes[i * PAGE_SIZE..(i + 1) * PAGE_SIZE]
+      .try_into()
+      .unwrap()
+  }
+
+  fn write_byte(&mut self, addr: u16, value: u8) {
+    self.bytes[addr as usize] = value;
+    let page = addr as usize / PAGE_SIZE;
+    self.dirty[page / 64] |= 1 << (page % 64);
+  }
+}
+
+impl Default for Memory {
+  fn default() -> Self {
+    Self::new()
+  }
+}
+
+impl Bus for Memory {
+  fn read(&mut self, addr: u16) -> u8 {
+    self.bytes[addr as usize]
+  }
+
+  fn write(&mut self, addr: u16, value: u8) {
+    self.write_byte(addr, value);
+    if let NOR_BANK | BANK_CONTROL | RAMB_BANK = addr {
+      if let Some(hook) = &mut self.bank_switch {
+        hook(&mut self.bytes, addr, value);
+        // The hook may have copied any bank.
+        self.dirty = [!0; NUM_PAGES / 64];
+      }
+    }
+  }
+}
+
+/// Why `Cpu::run` returns.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Exit {
+  /// The routine started by `Cpu::call` returns.
+  Return,
+  /// The budget is used up. Calling `Cpu::run` again resumes execution.
+  Budget,
+  /// An INT instruction with the given operand, which calls into the system
+  /// of NC3000. `pc` is already after the instruction, so the caller can
+  /// emulate the system call and resume execution.
+  Int(u16),
+  /// An undefined opcode. `pc` is left at the opcode.
+  IllegalOpcode(u8),
+}
+
+const C: u8 = 0x01;
+const Z: u8 = 0x02;
+const I: u8 = 0x04;
+const D: u8 = 0x08;
+const B: u8 = 0x10;
+const U: u8 = 0x20;
+const V: u8 = 0x40;
+const N: u8 = 0x80;
+
+#[derive(Debug, Clone)]
+pub struct Cpu {
+  pub a: u8,
+  pub x: u8,
+  pub y: u8,
+  pub s: u8,
+  pub p: u8,
+  pub pc: u16,
+  /// Total number of cycles executed.
+  pub cycles: u64,
+  /// The stack pointer before the return address of `call` is pushed.
+  call_sp: Option<u8>,
+}
+
+#[derive(Debug, Clone, Copy)]
+enum Operand {
+  None,
+  Accum,
+  Imm(u8),
+  Addr(u16),
+}
+
+impl Default for Cpu {
+  fn default() -> Self {
+    Self::new()
+  }
+}
+
+impl Cpu {
+  pub fn new() -> Self {
+    Self {
+      a: 0,
+      x: 0,
+      y: 0,
+      s: 0xff,
+      p: U | I,
+      pc: 0,
+      cycles: 0,
+      call_sp: None,
+    }
+  }
+
+  /// Starts a subroutine at `addr`, as CALL does, and runs it for at most
+  /// `budget` cycles. `Exit::Return` is returned when the subroutine returns
+  /// with RTS.
+  pub fn call<M: Bus>(&mut self, mem: &mut M, addr: u16, budget: u64) -> Exit {
+    self.call_sp = Some(self.s);
+    // RTS adds 1 to the address popped.
+    self.push16(mem, addr.wrapping_sub(1));
+    self.pc = addr;
+    self.run(mem, budget)
+  }
+
+  /// Runs for at least `budget` cycles, unless the execution stops earlier.
+  pub fn run<M: Bus>(&mut self, mem: &mut M, budget: u64) -> Exit {
+    let end = self.cycles + budget;
+    while self.cycles < end {
+      if let Some(exit) = self.step(mem) {
+        return exit;
+      }
+    }
+    Exit::Budget
+  }
+
+  /// Executes one instruction.
+  pub fn step<M: Bus>(&mut self, mem: &mut M) -> Option<Exit> {
+    let pc = self.pc;
+    let opcode = mem.read(pc);
+    let inst = match &INSTRUCTION_TABLE[opcode as usize] {
+      Some(inst) => inst,
+      None => return Some(Exit::IllegalOpcode(opcode)),
+    };
+    self.pc = pc.wrapping_add(inst.addr_mode.instruction_size() as u16);
+    self.cycles += inst.cycles as u64;
+
+    use Mnemonic::*;
+
+    let page_penalty = matches!(
+      inst.mnemonic,
+      ADC | AND | CMP | EOR | LDA | LDX | LDY | ORA | SBC
+    );
+    let op = self.operand(mem, inst.addr_mode, pc, page_penalty);
+
+    match inst.mnemonic {
+      ADC => {
+        let v = self.load(mem, op);
+        self.adc(v);
+      }
+      AND => {
+        self.a &= self.load(mem, op);
+        self.set_nz(self.a);
+      }
+      ASL => {
+        let v = self.load(mem, op);
+        self.set_flag(C, v & 0x80 != 0);
+        self.store_nz(mem, op, v << 1);
+      }
+      BCC => self.branch(op, self.p & C == 0),
+      BCS => self.branch(op, self.p & C != 0),
+      BEQ => self.branch(op, self.p & Z != 0),
+      BMI => self.branch(op, self.p & N != 0),
+      BNE => self.branch(op, self.p & Z == 0),
+      BPL => self.branch(op, self.p & N == 0),
+      BVC => self.branch(op, self.p & V == 0),
+      BVS => self.branch(op, self.p & V != 0),
+      BIT => {
+        let v = self.load(mem, op);
+        self.set_flag(Z, self.a & v == 0);
+        self.p = (self.p & !(N | V)) | (v & (N | V));
+      }
+      CLC => self.p &= !C,
+      CLD => self.p &= !D,
+      CLI => self.p &= !I,
+      CLV => self.p &= !V,
+      SEC => self.p |= C,
+      SED => self.p |= D,
+      SEI => self.p |= I,
+      CMP => {
+        let v = self.load(mem, op);
+        self.compare(self.a, v);
+      }
+      CPX => {
+        let v = self.load(mem, op);
+        self.compare(self.x, v);
+      }
+      CPY => {
+        let v = self.load(mem, op);
+        self.compare(self.y, v);
+      }
+      DEC => {
+        let v = self.load(mem, op);
+        self.store_nz(mem, op, v.wrapping_sub(1));
+      }
+      INC => {
+        let v = self.load(mem, op);
+        self.store_nz(mem, op, v.wrapping_add(1));
+      }
+      DEX => {
+        self.x = self.x.wrapping_sub(1);
+        self.set_nz(self.x);
+      }
+      DEY => {
+        self.y = self.y.wrapping_sub(1);
+        self.set_nz(self.y);
+      }
+      INX => {
+        self.x = self.x.wrapping_add(1);
+        self.set_nz(self.x);
+      }
+      INY => {
+        self.y = self.y.wrapping_add(1);
+        self.set_nz(self.y);
+      }
+      EOR => {
+        self.a ^= self.load(mem, op);
+        self.set_nz(self.a);
+      }
+      ORA => {
+        self.a |= self.load(mem, op);
+        self.set_nz(self.a);
+      }
+      INT => {
+        if let Operand::Addr(addr) = op {
+          return Some(Exit::Int(addr));
+        }
+      }
+      JMP => {
+        if let Operand::Addr(addr) = op {
+          self.pc = addr;
+        }
+      }
+      JSR => {
+        if let Operand::Addr(addr) = op {
+          self.push16(mem, self.pc.wrapping_sub(1));
+          self.pc = addr;
+        }
+      }
+      RTS => {
+        self.pc = self.pop16(mem).wrapping_add(1);
+        if self.call_sp == Some(self.s) {
+          self.call_sp = None;
+          return Some(Exit::Return);
+        }
+      }
+      RTI => {
+        self.p = self.pop(mem) & !B | U;
+        self.pc = self.pop16(mem);
+      }
+      LDA => {
+        self.a = self.load(mem, op);
+        self.set_nz(self.a);
+      }
+      LDX => {
+        self.x = self.load(mem, op);
+        self.set_nz(self.x);
+      }
+      LDY => {
+        self.y = self.load(mem, op);
+        self.set_nz(self.y);
+      }
+      LSR => {
+        let v = self.load(mem, op);
+        self.set_flag(C, v & 1 != 0);
+        self.store_nz(mem, op, v >> 1);
+      }
+      ROL => {
+        let v = self.load(mem, op);
+        let r = (v << 1) | (self.p & C);
+        self.set_flag(C, v & 0x80 != 0);
+        self.store_nz(mem, op, r);
+      }
+      ROR => {
+        let v = self.load(mem, op);
+        let r = (v >> 1) | ((self.p & C) << 7);
+        self.set_flag(C, v & 1 != 0);
+        self.store_nz(mem, op, r);
+      }
+      NOP => {}
+      PHA => self.push(mem, self.a),
+      PHP => self.push(mem, self.p | B | U),
+      PLA => {
+        self.a = self.pop(mem);
+        self.set_nz(self.a);
+      }
+      PLP => self.p = self.pop(mem) & !B | U,
+      SBC => {
+        let v = self.load(mem, op);
+        self.sbc(v);
+      }
+      STA => self.store(mem, op, self.a),
+      STX => self.store(mem, op, self.x),
+      STY => self.store(mem, op, self.y),
+      TAX => {
+        self.x = self.a;
+        self.set_nz(self.x);
+      }
+      TAY => {
+        self.y = self.a;
+        self.set_nz(self.y);
+      }
+      TSX => {
+        self.x = self.s;
+        self.set_nz(self.x);
+      }
+      TXA => {
+        self.a = self.x;
+        self.set_nz(self.a);
+      }
+      TXS => self.s = self.x,
+      TYA => {
+        self.a = self.y;
+        self.set_nz(self.a);
+      }
+    }
+
+    None
+  }
+
+  /// Resolves the operand of the instruction at `pc`. `self.pc` must already
+  /// be the address of the next instruction.
+  fn operand<M: Bus>(
+    &mut self,
+    mem: &mut M,
+    addr_mode: AddressMode,
+    pc: u16,
+    page_penalty: bool,
+  ) -> Operand {
+    use AddressMode::*;
+
+    let byte = |mem: &mut M| mem.read(pc.wrapping_add(1));
+    let word = |mem: &mut M| {
+      let lo = mem.read(pc.wrapping_add(1));
+      let hi = mem.read(pc.wrapping_add(2));
+      u16::from_le_bytes([lo, hi])
+    };
+
+    let addr = match addr_mode {
+      Impl => return Operand::None,
+      Accum => return Operand::Accum,
+      Imm => return Operand::Imm(byte(mem)),
+      Abs => word(mem),
+      AbsX => self.index(word(mem), self.x, page_penalty),
+      AbsY => self.index(word(mem), self.y, page_penalty),
+      Ind => {
+        // The pointer doesn't cross pages, as on NMOS 6502.
+        let ptr = word(mem);
+        let lo = mem.read(ptr);
+        let hi = mem.read((ptr & 0xff00) | (ptr.wrapping_add(1) & 0xff));
+        u16::from_le_bytes([lo, hi])
+      }
+      XInd => {
+        let zp = byte(mem).wrapping_add(self.x);
+        self.zpg_word(mem, zp)
+      }
+      IndY => {
+        let zp = byte(mem);
+        let base = self.zpg_word(mem, zp);
+        self.index(base, self.y, page_penalty)
+      }
+      Rel => self.pc.wrapping_add(byte(mem) as i8 as u16),
+      Zpg => byte(mem) as u16,
+      ZpgX => byte(mem).wrapping_add(self.x) as u16,
+      ZpgY => byte(mem).wrapping_add(self.y) as u16,
+    };
+    Operand::Addr(addr)
+  }
+
+  fn index(&mut self, base: u16, index: u8, page_penalty: bool) -> u16 {
+    let addr = base.wrapping_add(index as u16);
+    if page_penalty && (base ^ addr) & 0xff00 != 0 {
+      self.cycles += 1;
+    }
+    addr
+  }
+
+  fn zpg_word<M: Bus>(&mut self, mem: &mut M, zp: u8) -> u16 {
+    let lo = mem.read(zp as u16);
+    let hi = mem.read(zp.wrapping_add(1) as u16);
+    u16::from_le_bytes([lo, hi])
+  }
+
+  fn load<M: Bus>(&mut self, mem: &mut M, op: Operand) -> u8 {
+    match op {
+      Operand::None => 0,
+      Operand::Accum => self.a,
+      Operand::Imm(v) => v,
+      Operand::Addr(addr) => mem.read(addr),
+    }
+  }
+
+  fn store<M: Bus>(&mut self, mem: &mut M, op: Operand, value: u8) {
+    match op {
+      Operand::None | Operand::Imm(_) => {}
+      Operand::Accum => self.a = value,
+      Operand::Addr(addr) => mem.write(addr, value),
+    }
+  }
+
+  fn store_nz<M: Bus>(&mut self, mem: &mut M, op: Operand, value: u8) {
+    self.store(mem, op, value);
+    self.set_nz(value);
+  }
+
+  fn branch(&mut self, op: Operand, cond: bool) {
+    if let (Operand::Addr(target), true) = (op, cond) {
+      self.cycles += 1;
+      if (self.pc ^ target) & 0xff00 != 0 {
+        self.cycles += 1;
+      }
+      self.pc = target;
+    }
+  }
+
+  fn adc(&mut self, v: u8) {
+    let a = self.a as u16;
+    let v16 = v as u16;
+    let c = (self.p & C) as u16;
+    let sum = a + v16 + c;
+    if self.p & D == 0 {
+      self.set_flag(C, sum > 0xff);
+      self.set_flag(V, !(a ^ v16) & (a ^ sum) & 0x80 != 0);
+      self.a = sum as u8;
+      self.set_nz(self.a);
+      return;
+    }
+
+    // Flags of decimal mode follow NMOS 6502: Z from the binary sum, N and V
+    // from the sum before adjusting the high digit.
+    let mut lo = (a & 0x0f) + (v16 & 0x0f) + c;
+    if lo > 9 {
+      lo += 6;
+    }
+    let mut hi = (a >> 4) + (v16 >> 4) + (lo > 0x0f) as u16;
+    self.set_flag(Z, sum & 0xff == 0);
+    self.set_flag(N, hi & 0x08 != 0);
+    self.set_flag(V, !(a ^ v16) & (a ^ (hi << 4)) & 0x80 != 0);
+    if hi > 9 {
+      hi += 6;
+    }
+    self.set_flag(C, hi > 0x0f);
+    self.a = ((hi << 4) | (lo & 0x0f)) as u8;
+  }
+
+  fn sbc(&mut self, v: u8) {
+    let a = self.a;
+    let borrow = (self.p & C == 0) as i16;
+    // Flags are those of the binary subtraction, also in decimal mode.
+    let diff = a as i16 - v as i16 - borrow;
+    let r = diff as u8;
+    self.set_flag(C, diff >= 0);
+    self.set_flag(V, (a ^ v) & (a ^ r) & 0x80 != 0);
+    self.set_nz(r);
+    if self.p & D == 0 {
+      self.a = r;
+      return;
+    }
+
+    let mut lo = (a & 0x0f) as i16 - (v & 0x0f) as i16 - borrow;
+    let mut hi = (a >> 4) as i16 - (v >> 4) as i16;
+    if lo < 0 {
+      lo -= 6;
+      hi -= 1;
+    }
+    if hi < 0 {
+      hi -= 6;
+    }
+    self.a = (((hi << 4) | (lo & 0x0f)) & 0xff) as u8;
+  }
+
+  fn compare(&mut self, reg: u8, v: u8) {
+    self.set_flag(C, reg >= v);
+    self.set_nz(reg.wrapping_sub(v));
+  }
+
+  fn set_flag(&mut self, flag: u8, on: bool) {
+    if on {
+      self.p |= flag;
+    } else {
+      self.p &= !flag;
+    }
+  }
+
+  fn set_nz(&mut self, v: u8) {
+    self.set_flag(Z, v == 0);
+    self.set_flag(N, v & 0x80 != 0);
+  }
+
+  fn push<M: Bus>(&mut self, mem: &mut M, v: u8) {
+    mem.write(0x100 | self.s as u16, v);
+    self.s = self.s.wrapping_sub(1);
+  }
+
+  fn pop<M: Bus>(&mut self, mem: &mut M) -> u8 {
+    self.s = self.s.wrapping_add(1);
+    mem.read(0x100 | self.s as u16)
+  }
+
+  fn push16<M: Bus>(&mut self, mem: &mut M, v: u16) {
+    self.push(mem, (v >> 8) as u8);
+    self.push(mem, v as u8);
+  }
+
+  fn pop16<M: Bus>(&mut self, mem: &mut M) -> u16 {
+    let lo = self.pop(mem);
+    let hi = self.pop(mem);
+    u16::from_le_bytes([lo, hi])
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use std::cell::RefCell;
+  use std::rc::Rc;
+
+  fn run(code: &[u8], budget: u64) -> (Cpu, Memory, Exit) {
+    let mut mem = Memory::new();
+    mem.load(0x4000, code);
+    let mut cpu = Cpu::new();
+    let exit = cpu.call(&mut mem, 0x4000, budget);
+    (cpu, mem, exit)
+  }
+
+  #[test]
+  fn call_and_return() {
+    // Sums 1..=10 into $80.
+    let code = [
+      0xa9, 0x00, // LDA #$00
+      0xa2, 0x0a, // LDX #$0A
+      0x86, 0x81, // L: STX $81
+      0x18, // CLC
+      0x65, 0x81, // ADC $81
+      0xca, // DEX
+      0xd0, 0xf8, // BNE L
+      0x85, 0x80, // STA $80
+      0x60, // RTS
+    ];
+    let (cpu, mem, exit) = run(&code, 10000);
+    assert_eq!(exit, Exit::Return);
+    assert_eq!(mem.bytes()[0x80], 55);
+    assert_eq!(cpu.s, 0xff);
+    // 2 + 2 + 10 * (3 + 2 + 3 + 2 + 3) - 1 + 3 + 6
+    assert_eq!(cpu.cycles, 142);
+  }
+
+  #[test]
+  fn budget_and_resume() {
+    let code = [
+      0xe6, 0x80, // L: INC $80
+      0x4c, 0x00, 0x40, // JMP L
+    ];
+    let (mut cpu, mut mem, exit) = run(&code, 80);
+    assert_eq!(exit, Exit::Budget);
+    assert_eq!(mem.bytes()[0x80], 10);
+    assert_eq!(cpu.run(&mut mem, 80), Exit::Budget);
+    assert_eq!(mem.bytes()[0x80], 20);
+  }
+
+  #[test]
+  fn int_and_illegal() {
+    let code = [
+      0x00, 0x34, 0x12, // INT $1234
+      0x02,
+    ];
+    let (mut cpu, mut mem, exit) = run(&code, 100);
+    assert_eq!(exit, Exit::Int(0x1234));
+    assert_eq!(cpu.pc, 0x4003);
+    assert_eq!(cpu.run(&mut mem, 100), Exit::IllegalOpcode(0x02));
+    assert_eq!(cpu.pc, 0x4003);
+  }
+
+  #[test]
+  fn decimal() {
+    let code = [
+      0xf8, // SED
+      0x18, // CLC
+      0xa9, 0x58, // LDA #$58
+      0x69, 0x46, // ADC #$46
+      0x85, 0x80, // STA $80
+      0x38, // SEC
+      0xe9, 0x05, // SBC #$05
+      0x85, 0x81, // STA $81
+      0x60, // RTS
+    ];
+    let (cpu, mem, _) = run(&code, 100);
+    assert_eq!(mem.bytes()[0x80], 0x04);
+    assert_eq!(mem.bytes()[0x81], 0x99);
+    assert_eq!(cpu.p & C, 0);
+  }
+
+  #[test]
+  fn bank_switch() {
+    let writes = Rc::new(RefCell::new(vec![]));
+    let mut mem = Memory::new();
+    mem.set_bank_switch(Box::new({
+      let writes = writes.clone();
+      move |bytes, reg, value| {
+        writes.borrow_mut().push((reg, value));
+        bytes[0xc000] = value;
+      }
+    }));
+    mem.load(
+      0x4000,
+      &[
+        0xa5, 0x0a, // LDA $0A
+        0x29, 0xf0, // AND #$F0
+        0x09, 0x01, // ORA #$01
+        0x85, 0x0a, // STA $0A
+        0x85, 0x0b, // STA $0B
+        0xad, 0x00, 0xc0, // LDA $C000
+        0x60, // RTS
+      ],
+    );
+    let mut cpu = Cpu::new();
+    assert_eq!(cpu.call(&mut mem, 0x4000, 100), Exit::Return);
+    assert_eq!(*writes.borrow(), vec![(BANK_CONTROL, 1)]);
+    assert_eq!(cpu.a, 1);
+  }
+
+  #[test]
+  fn snapshot() {
+    let mut mem = Memory::new();
+    mem.load(0x300, &[1, 2, 3]);
+    let first = mem.snapshot();
+    mem.write(0x0301, 9);
+    mem.write(0x8000, 7);
+    let second = mem.snapshot();
+    let shared = (0..NUM_PAGES)
+      .filter(|&i| Rc::ptr_eq(&first.pages[i], &second.pages[i]))
+      .count();
+    assert_eq!(shared, NUM_PAGES - 2);
+
+    mem.write(0x0302, 5);
+    mem.restore(&first);
+    assert_eq!(mem.bytes()[0x300..0x303], [1, 2, 3]);
+    assert_eq!(mem.bytes()[0x8000], 0);
+    mem.restore(&second);
+    assert_eq!(mem.bytes()[0x300..0x303], [1, 9, 3]);
+    assert_eq!(mem.bytes()[0x8000], 7);
+  }
+}
@@ -0,0 +1,290 @@
+use super::{AddressMode, Instruction};
+use std::io::{self, Write};
+
+/// Format of the disassembly.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum OutputFormat {
+  /// Assembly listing.
+  Text,
+  /// One JSON object per line, for consumption by other tools.
+  JsonLines,
+}
+
+/// Lines are collected into blocks of this size before being written.
+const BLOCK_SIZE: usize = 64 * 1024;
+
+static HEX_DIGITS: [[u8; 2]; 256] = hex_digits();
+
+const fn hex_digits() -> [[u8; 2]; 256] {
+  const DIGITS: &[u8; 16] = b"0123456789ABCDEF";
+  let mut table = [[0; 2]; 256];
+  let mut i = 0;
+  while i < 256 {
+    table[i] = [DIGITS[i >> 4], DIGITS[i & 15]];
+    i += 1;
+  }
+  table
+}
+
+/// The buffer for rendering a line. No line is longer than 128 bytes.
+struct Line {
+  buf: [u8; 128],
+  len: usize,
+}
+
+impl Line {
+  fn new() -> Self {
+    Self {
+      buf: [0; 128],
+      len: 0,
+    }
+  }
+
+  fn str(&mut self, s: &str) -> &mut Self {
+    self.buf[self.len..self.len + s.len()].copy_from_slice(s.as_bytes());
+    self.len += s.len();
+    self
+  }
+
+  fn hex8(&mut self, b: u8) -> &mut Self {
+    self.buf[self.len..self.len + 2].copy_from_slice(&HEX_DIGITS[b as usize]);
+    self.len += 2;
+    self
+  }
+
+  fn hex16(&mut self, n: u16) -> &mut Self {
+    self.hex8((n >> 8) as u8).hex8(n as u8)
+  }
+
+  fn as_bytes(&self) -> &[u8] {
+    &self.buf[..self.len]
+  }
+}
+
+/// Renders the items of the disassembly and writes them in large blocks.
+pub(super) struct Emitter<W> {
+  output: W,
+  format: OutputFormat,
+  line: Line,
+  block: Vec<u8>,
+}
+
+impl<W: Write> Emitter<W> {
+  pub fn new(output: W, format: OutputFormat) -> Self {
+    Self {
+      output,
+      format,
+      line: Line::new(),
+      block: Vec::with_capacity(BLOCK_SIZE),
+    }
+  }
+
+  pub fn entry(&mut self, addr: u16) -> io::Result<()> {
+    let line = &mut self.line;
+    match self.format {
+      OutputFormat::Text => line.str("; entry = $").hex16(addr),
+      OutputFormat::JsonLines => line
+        .str(r#"{"kind":"entry","addr":""#)
+        .hex16(addr)
+        .str(r#""}"#),
+    };
+    self.push()
+  }
+
+  pub fn label(&mut self, addr: u16) -> io::Result<()> {
+    let line = &mut self.line;
+    match self.format {
+      OutputFormat::Text => line.str("L").hex16(addr).str(":"),
+      OutputFormat::JsonLines => line
+        .str(r#"{"kind":"label","addr":""#)
+        .hex16(addr)
+        .str(r#""}"#),
+    };
+    self.push()
+  }
+
+  /// A label at `addr`, `offset` bytes into the instruction that follows.
+  pub fn inner_label(&mut self, addr: u16, offset: u16) -> io::Result<()> {
+    let line = &mut self.line;
+    match self.format {
+      OutputFormat::Text => line
+        .str("L")
+        .hex16(addr)
+        .str(" = * + ")
+        .str(&offset.to_string()),
+      OutputFormat::JsonLines => line
+        .str(r#"{"kind":"label","addr":""#)
+        .hex16(addr)
+        .str(r#""}"#),
+    };
+    self.push()
+  }
+
+  /// `bytes` contains the whole instruction.
+  pub fn instruction(
+    &mut self,
+    pc: u16,
+    inst: &Instruction,
+    bytes: &[u8],
+  ) -> io::Result<()> {
+    self.code(false, pc, inst, bytes)
+  }
+
+  /// An instruction that starts at `pc`, inside the previous one, written as
+  /// a comment in the text format.
+  pub fn overlap(
+    &mut self,
+    pc: u16,
+    inst: &Instruction,
+    bytes: &[u8],
+  ) -> io::Result<()> {
+    self.code(true, pc, inst, bytes)
+  }
+
+  fn code(
+    &mut self,
+    overlap: bool,
+    pc: u16,
+    inst: &Instruction,
+    bytes: &[u8],
+  ) -> io::Result<()> {
+    let next_pc = pc.wrapping_add(bytes.len() as u16);
+    let line = &mut self.line;
+    match self.format {
+      OutputFormat::Text => {
+        if overlap {
+          line.str("; ");
+        }
+        line.hex16(pc).str(": ");
+        for &b in bytes {
+          line.hex8(b).str(" ");
+        }
+        for _ in bytes.len()..3 {
+          line.str("   ");
+        }
+        line.str(inst.name);
+        if !matches!(inst.addr_mode, AddressMode::Accum | AddressMode::Impl) {
+          line.str(" ");
+        }
+        inst.addr_mode.write(next_pc, &bytes[1..], line);
+      }
+      OutputFormat::JsonLines => {
+        let kind = if overlap { "overlap" } else { "code" };
+        line
+          .str(r#"{"kind":""#)
+          .str(kind)
+          .str(r#"","addr":""#)
+          .hex16(pc);
+        line.str(r#"","bytes":""#);
+        for &b in bytes {
+          line.hex8(b);
+        }
+        line.str(r#"","mnemonic":""#).str(inst.name);
+        line.str(r#"","operand":""#);
+        inst.addr_mode.write(next_pc, &bytes[1..], line);
+        line.str(r#""}"#);
+      }
+    }
+    self.push()
+  }
+
+  /// A byte that is not a valid opcode, in the linear sweep.
+  pub fn unknown(&mut self, pc: u16, b: u8) -> io::Result<()> {
+    match self.format {
+      OutputFormat::Text => {
+        let line = &mut self.line;
+        line.hex16(pc).str(": ").hex8(b).str("       ??");
+        self.push()
+      }
+      OutputFormat::JsonLines => self.data(pc, &[b]),
+    }
+  }
+
+  /// `bytes` must not be longer than 16 bytes.
+  pub fn data(&mut self, pc: u16, bytes: &[u8]) -> io::Result<()> {
+    let line = &mut self.line;
+    match self.format {
+      OutputFormat::Text => {
+        line.hex16(pc).str(": .byte ");
+        for (i, &b) in bytes.iter().enumerate() {
+          if i != 0 {
+            line.str(",");
+          }
+          line.str("$").hex8(b);
+        }
+      }
+      OutputFormat::JsonLines => {
+        line.str(r#"{"kind":"data","addr":""#).hex16(pc);
+        line.str(r#"","bytes":""#);
+        for &b in bytes {
+          line.hex8(b);
+        }
+        line.str(r#""}"#);
+      }
+    }
+    self.push()
+  }
+
+  pub fn finish(mut self) -> io::Result<()> {
+    self.output.write_all(&self.block)?;
+    self.output.flush()
+  }
+
+  fn push(&mut self) -> io::Result<()> {
+    self.line.str("\n");
+    self.block.extend_from_slice(self.line.as_bytes());
+    self.line.len = 0;
+    if self.block.len() >= BLOCK_SIZE - self.line.buf.len() {
+      self.output.write_all(&self.block)?;
+      self.block.clear();
+    }
+    Ok(())
+  }
+}
+
+impl AddressMode {
+  /// Writes the operand of an instruction, where `pc` is the address of the
+  /// next instruction.
+  fn write(self, pc: u16, operand: &[u8], line: &mut Line) {
+    use AddressMode::*;
+
+    match self {
+      Accum | Impl => {}
+      Abs => {
+        line.str("$").hex8(operand[1]).hex8(operand[0]);
+      }
+      AbsX => {
+        line.str("$").hex8(operand[1]).hex8(operand[0]).str(",X");
+      }
+      AbsY => {
+        line.str("$").hex8(operand[1]).hex8(operand[0]).str(",Y");
+      }
+      Imm => {
+        line.str("#$").hex8(operand[0]);
+      }
+      Ind => {
+        line.str("($").hex8(operand[1]).hex8(operand[0]).str(")");
+      }
+      XInd => {
+        line.str("($").hex8(operand[0]).str(",X)");
+      }
+      IndY => {
+        line.str("($").hex8(operand[0]).str("),Y");
+      }
+      Rel => {
+        line
+          .str("$")
+          .hex16(pc.wrapping_add(operand[0] as i8 as u16));
+      }
+      Zpg => {
+        line.str("$").hex8(operand[0]);
+      }
+      ZpgX => {
+        line.str("$").hex8(operand[0]).str(",X");
+      }
+      ZpgY => {
+        line.str("$").hex8(operand[0]).str(",Y");
+      }
+    }
+  }
+}
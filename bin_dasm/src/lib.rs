@@ -1,16 +1,28 @@
 use std::io;
 use std::io::prelude::*;
-use std::num::Wrapping;
+
+pub mod cpu;
+mod format;
+
+use self::format::Emitter;
+pub use self::format::OutputFormat;
 
 const DEFAULT_ORIGIN: u16 = 0x4000;
 
 pub struct DasmOptions {
   pub starting_address: Option<u16>,
+  /// Disassemble only the code reachable from the entry and `vectors`,
+  /// instead of sweeping linearly through the whole image.
+  pub follow_control_flow: bool,
+  /// Extra entry points of code, e.g. interrupt handlers, for
+  /// `follow_control_flow`.
+  pub vectors: Vec<u16>,
+  pub format: OutputFormat,
 }
 
 pub fn disassemble<W>(
   mut bytes: &[u8],
-  mut output: W,
+  output: W,
   options: DasmOptions,
 ) -> io::Result<()>
 where
@@ -26,28 +38,41 @@ where
   }
 
   let entry = header[8] as u16 + ((header[9] as u16) << 8);
-  writeln!(&mut output, "; entry = ${:04X}", entry)?;
+  let mut output = Emitter::new(output, options.format);
+  output.entry(entry)?;
+
+  let pc = options.starting_address.unwrap_or(DEFAULT_ORIGIN) + 16;
 
-  let mut pc = options.starting_address.unwrap_or(DEFAULT_ORIGIN) + 16;
+  if options.follow_control_flow {
+    let mut roots = options.vectors;
+    roots.insert(0, entry);
+    disassemble_reachable(bytes, pc, &roots, &mut output)?;
+  } else {
+    disassemble_linear(bytes, pc, &mut output)?;
+  }
+  output.finish()
+}
 
+fn disassemble_linear<W>(
+  mut bytes: &[u8],
+  mut pc: u16,
+  output: &mut Emitter<W>,
+) -> io::Result<()>
+where
+  W: Write,
+{
   while !bytes.is_empty() {
-    write!(&mut output, "{:04X}: ", pc)?;
-    if let Some(inst) = &INSTRUCTION_TABLE[bytes[0] as usize] {
+    let inst = INSTRUCTION_TABLE[bytes[0] as usize]
+      .as_ref()
+      .filter(|inst| inst.addr_mode.instruction_size() <= bytes.len());
+    if let Some(inst) = inst {
       let size = inst.addr_mode.instruction_size();
-      pc += size as u16;
-      for i in 0..size {
-        write!(&mut output, "{:02X} ", bytes[i])?;
-      }
-      for _ in size..3 {
-        write!(&mut output, "   ")?;
-      }
-      write!(&mut output, "{}", inst.name)?;
-      inst.addr_mode.write(pc, &bytes[1..], &mut output)?;
-      writeln!(&mut output)?;
+      output.instruction(pc, inst, &bytes[..size])?;
+      pc = pc.wrapping_add(size as u16);
       bytes = &bytes[size..];
     } else {
-      pc += 1;
-      writeln!(&mut output, "{:02X}       ??", bytes[0])?;
+      output.unknown(pc, bytes[0])?;
+      pc = pc.wrapping_add(1);
       bytes = &bytes[1..];
     }
   }
@@ -55,9 +80,218 @@ where
   Ok(())
 }
 
+/// Maximum number of bytes in a `.byte` line.
+const BYTES_PER_LINE: usize = 8;
+
+/// Traces the code reachable from `roots` through jumps, calls and branches,
+/// and writes the traced instructions, with labels at the jump targets, and
+/// the remaining bytes as `.byte` data.
+///
+/// Every address is decoded at most once, so this takes a single pass over
+/// the image however the code branches. Indirect jumps are not followed.
+fn disassemble_reachable<W>(
+  bytes: &[u8],
+  base: u16,
+  roots: &[u16],
+  output: &mut Emitter<W>,
+) -> io::Result<()>
+where
+  W: Write,
+{
+  let bytes = &bytes[..bytes.len().min(0x10000 - base as usize)];
+  let offset = |addr: u16| {
+    let i = addr.wrapping_sub(base) as usize;
+    if i < bytes.len() {
+      Some(i)
+    } else {
+      None
+    }
+  };
+
+  let mut code = Bitmap::new();
+  let mut labels = Bitmap::new();
+  let mut worklist = roots.to_vec();
+  for &root in roots {
+    labels.set(root);
+  }
+
+  while let Some(mut pc) = worklist.pop() {
+    while let Some(i) = offset(pc) {
+      if code.get(pc) {
+        break;
+      }
+      let inst = match &INSTRUCTION_TABLE[bytes[i] as usize] {
+        Some(inst) => inst,
+        None => break,
+      };
+      let size = inst.addr_mode.instruction_size();
+      if i + size > bytes.len() {
+        break;
+      }
+      code.set(pc);
+      let next = pc.wrapping_add(size as u16);
+
+      let target = match inst.addr_mode {
+        AddressMode::Abs if is_jump(bytes[i]) => {
+          Some(bytes[i + 1] as u16 + ((bytes[i + 2] as u16) << 8))
+        }
+        AddressMode::Rel => Some(next.wrapping_add(bytes[i + 1] as i8 as u16)),
+        _ => None,
+      };
+      if let Some(target) = target {
+        labels.set(target);
+        if offset(target).is_some() && !code.get(target) {
+          worklist.push(target);
+        }
+      }
+
+      if ends_flow(bytes[i]) {
+        break;
+      }
+      pc = next;
+    }
+  }
+
+  let mut i = 0;
+  while i < bytes.len() {
+    let pc = base.wrapping_add(i as u16);
+    if labels.get(pc) {
+      output.label(pc)?;
+    }
+
+    if code.get(pc) {
+      let inst = INSTRUCTION_TABLE[bytes[i] as usize].as_ref().unwrap();
+      let size = inst.addr_mode.instruction_size();
+      for j in 1..size as u16 {
+        if labels.get(pc.wrapping_add(j)) {
+          output.inner_label(pc.wrapping_add(j), j)?;
+        }
+      }
+      output.instruction(pc, inst, &bytes[i..i + size])?;
+      for j in 1..size {
+        let inner_pc = pc.wrapping_add(j as u16);
+        if code.get(inner_pc) {
+          let inner =
+            INSTRUCTION_TABLE[bytes[i + j] as usize].as_ref().unwrap();
+          let inner_size = inner.addr_mode.instruction_size();
+          output.overlap(inner_pc, inner, &bytes[i + j..i + j + inner_size])?;
+        }
+      }
+      i += size;
+    } else {
+      let mut end = i + 1;
+      while end < bytes.len() && end - i < BYTES_PER_LINE {
+        let pc = base.wrapping_add(end as u16);
+        if code.get(pc) || labels.get(pc) {
+          break;
+        }
+        end += 1;
+      }
+      output.data(pc, &bytes[i..end])?;
+      i = end;
+    }
+  }
+
+  Ok(())
+}
+
+/// JSR and JMP absolute.
+fn is_jump(opcode: u8) -> bool {
+  matches!(opcode, 0x20 | 0x4c)
+}
+
+/// Whether the next instruction is not executed after `opcode`: JMP, RTS and
+/// RTI.
+fn ends_flow(opcode: u8) -> bool {
+  matches!(opcode, 0x4c | 0x6c | 0x60 | 0x40)
+}
+
+/// A set of addresses in the 64 KiB address space.
+struct Bitmap(Box<[u64; 1024]>);
+
+impl Bitmap {
+  fn new() -> Self {
+    Self(Box::new([0; 1024]))
+  }
+
+  fn get(&self, addr: u16) -> bool {
+    self.0[addr as usize >> 6] & (1 << (addr & 63)) != 0
+  }
+
+  fn set(&mut self, addr: u16) {
+    self.0[addr as usize >> 6] |= 1 << (addr & 63);
+  }
+}
+
 struct Instruction {
+  mnemonic: Mnemonic,
   name: &'static str,
   addr_mode: AddressMode,
+  /// Cycles taken, not counting the extra cycles of page crossing and taken
+  /// branches.
+  cycles: u8,
+}
+
+#[derive(Eq, PartialEq, Debug, Clone, Copy)]
+#[allow(clippy::upper_case_acronyms)]
+enum Mnemonic {
+  ADC,
+  AND,
+  ASL,
+  BCC,
+  BCS,
+  BEQ,
+  BIT,
+  BMI,
+  BNE,
+  BPL,
+  BVC,
+  BVS,
+  CLC,
+  CLD,
+  CLI,
+  CLV,
+  CMP,
+  CPX,
+  CPY,
+  DEC,
+  DEX,
+  DEY,
+  EOR,
+  INC,
+  /// System call of NC3000, in place of BRK. Followed by a 2-byte operand.
+  INT,
+  INX,
+  INY,
+  JMP,
+  JSR,
+  LDA,
+  LDX,
+  LDY,
+  LSR,
+  NOP,
+  ORA,
+  PHA,
+  PHP,
+  PLA,
+  PLP,
+  ROL,
+  ROR,
+  RTI,
+  RTS,
+  SBC,
+  SEC,
+  SED,
+  SEI,
+  STA,
+  STX,
+  STY,
+  TAX,
+  TAY,
+  TSX,
+  TXA,
+  TXS,
+  TYA,
 }
 
 #[derive(Eq, PartialEq, Debug, Clone, Copy)]
@@ -92,284 +326,284 @@ enum AddressMode {
 }
 
 macro_rules! inst {
-  ($name:literal $mode:ident) => {
-    Instruction::new($name, AddressMode::$mode)
+  ($name:ident $mode:ident) => {
+    Instruction::new(Mnemonic::$name, stringify!($name), AddressMode::$mode)
   };
 }
 
 /// Data from <https://www.masswerk.at/6502/6502_instruction_set.html>.
 static INSTRUCTION_TABLE: [Option<Instruction>; 256] = [
   // 00-0f
-  inst!("INT" Abs),
-  inst!("ORA" XInd),
+  inst!(INT Abs),
+  inst!(ORA XInd),
   None,
   None,
   None,
-  inst!("ORA" Zpg),
-  inst!("ASL" Zpg),
+  inst!(ORA Zpg),
+  inst!(ASL Zpg),
   None,
-  inst!("PHP" Impl),
-  inst!("ORA" Imm),
-  inst!("ASL" Accum),
+  inst!(PHP Impl),
+  inst!(ORA Imm),
+  inst!(ASL Accum),
   None,
   None,
-  inst!("ORA" Abs),
-  inst!("ASL" Abs),
+  inst!(ORA Abs),
+  inst!(ASL Abs),
   None,
   // 10-1f
-  inst!("BPL" Rel),
-  inst!("ORA" IndY),
+  inst!(BPL Rel),
+  inst!(ORA IndY),
   None,
   None,
   None,
-  inst!("ORA" ZpgX),
-  inst!("ASL" ZpgX),
+  inst!(ORA ZpgX),
+  inst!(ASL ZpgX),
   None,
-  inst!("CLC" Impl),
-  inst!("ORA" AbsY),
+  inst!(CLC Impl),
+  inst!(ORA AbsY),
   None,
   None,
   None,
-  inst!("ORA" AbsX),
-  inst!("ASL" AbsX),
+  inst!(ORA AbsX),
+  inst!(ASL AbsX),
   None,
   // 20-2f
-  inst!("JSR" Abs),
-  inst!("AND" XInd),
+  inst!(JSR Abs),
+  inst!(AND XInd),
   None,
   None,
-  inst!("BIT" Zpg),
-  inst!("AND" Zpg),
-  inst!("ROL" Zpg),
+  inst!(BIT Zpg),
+  inst!(AND Zpg),
+  inst!(ROL Zpg),
   None,
-  inst!("PLP" Impl),
-  inst!("AND" Imm),
-  inst!("ROL" Accum),
+  inst!(PLP Impl),
+  inst!(AND Imm),
+  inst!(ROL Accum),
   None,
-  inst!("BIT" Abs),
-  inst!("AND" Abs),
-  inst!("ROL" Abs),
+  inst!(BIT Abs),
+  inst!(AND Abs),
+  inst!(ROL Abs),
   None,
   // 30-3f
-  inst!("BMI" Rel),
-  inst!("AND" IndY),
+  inst!(BMI Rel),
+  inst!(AND IndY),
   None,
   None,
   None,
-  inst!("AND" ZpgX),
-  inst!("ROL" ZpgX),
+  inst!(AND ZpgX),
+  inst!(ROL ZpgX),
   None,
-  inst!("SEC" Impl),
-  inst!("AND" AbsY),
+  inst!(SEC Impl),
+  inst!(AND AbsY),
   None,
   None,
   None,
-  inst!("AND" AbsX),
-  inst!("ROL" AbsX),
+  inst!(AND AbsX),
+  inst!(ROL AbsX),
   None,
   // 40-4f
-  inst!("RTI" Impl),
-  inst!("EOR" XInd),
+  inst!(RTI Impl),
+  inst!(EOR XInd),
   None,
   None,
   None,
-  inst!("EOR" Zpg),
-  inst!("LSR" Zpg),
+  inst!(EOR Zpg),
+  inst!(LSR Zpg),
   None,
-  inst!("PHA" Impl),
-  inst!("EOR" Imm),
-  inst!("LSR" Accum),
+  inst!(PHA Impl),
+  inst!(EOR Imm),
+  inst!(LSR Accum),
   None,
-  inst!("JMP" Abs),
-  inst!("EOR" Abs),
-  inst!("LSR" Abs),
+  inst!(JMP Abs),
+  inst!(EOR Abs),
+  inst!(LSR Abs),
   None,
   // 50-5f
-  inst!("BVC" Rel),
-  inst!("EOR" IndY),
+  inst!(BVC Rel),
+  inst!(EOR IndY),
   None,
   None,
   None,
-  inst!("EOR" ZpgX),
-  inst!("LSR" ZpgX),
+  inst!(EOR ZpgX),
+  inst!(LSR ZpgX),
   None,
-  inst!("CLI" Impl),
-  inst!("EOR" AbsY),
+  inst!(CLI Impl),
+  inst!(EOR AbsY),
   None,
   None,
   None,
-  inst!("EOR" AbsX),
-  inst!("LSR" AbsX),
+  inst!(EOR AbsX),
+  inst!(LSR AbsX),
   None,
   // 60-6f
-  inst!("RTS" Impl),
-  inst!("ADC" XInd),
+  inst!(RTS Impl),
+  inst!(ADC XInd),
   None,
   None,
   None,
-  inst!("ADC" Zpg),
-  inst!("ROR" Zpg),
+  inst!(ADC Zpg),
+  inst!(ROR Zpg),
   None,
-  inst!("PLA" Impl),
-  inst!("ADC" Imm),
-  inst!("ROR" Accum),
+  inst!(PLA Impl),
+  inst!(ADC Imm),
+  inst!(ROR Accum),
   None,
-  inst!("JMP" Ind),
-  inst!("ADC" Abs),
-  inst!("ROR" Abs),
+  inst!(JMP Ind),
+  inst!(ADC Abs),
+  inst!(ROR Abs),
   None,
   // 70-7f
-  inst!("BVS" Rel),
-  inst!("ADC" IndY),
+  inst!(BVS Rel),
+  inst!(ADC IndY),
   None,
   None,
   None,
-  inst!("ADC" ZpgX),
-  inst!("ROR" ZpgX),
+  inst!(ADC ZpgX),
+  inst!(ROR ZpgX),
   None,
-  inst!("SEI" Impl),
-  inst!("ADC" AbsY),
+  inst!(SEI Impl),
+  inst!(ADC AbsY),
   None,
   None,
   None,
-  inst!("ADC" AbsX),
-  inst!("ROR" AbsX),
+  inst!(ADC AbsX),
+  inst!(ROR AbsX),
   None,
   // 80-8f
   None,
-  inst!("STA" XInd),
+  inst!(STA XInd),
   None,
   None,
-  inst!("STY" Zpg),
-  inst!("STA" Zpg),
-  inst!("STX" Zpg),
+  inst!(STY Zpg),
+  inst!(STA Zpg),
+  inst!(STX Zpg),
   None,
-  inst!("DEY" Impl),
+  inst!(DEY Impl),
   None,
-  inst!("TXA" Impl),
+  inst!(TXA Impl),
   None,
-  inst!("STY" Abs),
-  inst!("STA" Abs),
-  inst!("STX" Abs),
+  inst!(STY Abs),
+  inst!(STA Abs),
+  inst!(STX Abs),
   None,
   // 90-9f
-  inst!("BCC" Rel),
-  inst!("STA" IndY),
+  inst!(BCC Rel),
+  inst!(STA IndY),
   None,
   None,
-  inst!("STY" ZpgX),
-  inst!("STA" ZpgX),
-  inst!("STX" ZpgY),
+  inst!(STY ZpgX),
+  inst!(STA ZpgX),
+  inst!(STX ZpgY),
   None,
-  inst!("TYA" Impl),
-  inst!("STA" AbsY),
-  inst!("TXS" Impl),
+  inst!(TYA Impl),
+  inst!(STA AbsY),
+  inst!(TXS Impl),
   None,
   None,
-  inst!("STA" AbsX),
+  inst!(STA AbsX),
   None,
   None,
   // a0-af
-  inst!("LDY" Imm),
-  inst!("LDA" XInd),
-  inst!("LDX" Imm),
+  inst!(LDY Imm),
+  inst!(LDA XInd),
+  inst!(LDX Imm),
   None,
-  inst!("LDY" Zpg),
-  inst!("LDA" Zpg),
-  inst!("LDX" Zpg),
+  inst!(LDY Zpg),
+  inst!(LDA Zpg),
+  inst!(LDX Zpg),
   None,
-  inst!("TAY" Impl),
-  inst!("LDA" Imm),
-  inst!("TAX" Impl),
+  inst!(TAY Impl),
+  inst!(LDA Imm),
+  inst!(TAX Impl),
   None,
-  inst!("LDY" Abs),
-  inst!("LDA" Abs),
-  inst!("LDX" Abs),
+  inst!(LDY Abs),
+  inst!(LDA Abs),
+  inst!(LDX Abs),
   None,
   // b0-bf
-  inst!("BCS" Rel),
-  inst!("LDA" IndY),
+  inst!(BCS Rel),
+  inst!(LDA IndY),
   None,
   None,
-  inst!("LDY" ZpgX),
-  inst!("LDA" ZpgX),
-  inst!("LDX" ZpgY),
+  inst!(LDY ZpgX),
+  inst!(LDA ZpgX),
+  inst!(LDX ZpgY),
   None,
-  inst!("CLV" Impl),
-  inst!("LDA" AbsY),
-  inst!("TSX" Impl),
+  inst!(CLV Impl),
+  inst!(LDA AbsY),
+  inst!(TSX Impl),
   None,
-  inst!("LDY" AbsX),
-  inst!("LDA" AbsX),
-  inst!("LDX" AbsY),
+  inst!(LDY AbsX),
+  inst!(LDA AbsX),
+  inst!(LDX AbsY),
   None,
   // c0-cf
-  inst!("CPY" Imm),
-  inst!("CMP" XInd),
+  inst!(CPY Imm),
+  inst!(CMP XInd),
   None,
   None,
-  inst!("CPY" Zpg),
-  inst!("CMP" Zpg),
-  inst!("DEC" Zpg),
+  inst!(CPY Zpg),
+  inst!(CMP Zpg),
+  inst!(DEC Zpg),
   None,
-  inst!("INY" Impl),
-  inst!("CMP" Imm),
-  inst!("DEX" Impl),
+  inst!(INY Impl),
+  inst!(CMP Imm),
+  inst!(DEX Impl),
   None,
-  inst!("CPY" Abs),
-  inst!("CMP" Abs),
-  inst!("DEC" Abs),
+  inst!(CPY Abs),
+  inst!(CMP Abs),
+  inst!(DEC Abs),
   None,
   // d0-df
-  inst!("BNE" Rel),
-  inst!("CMP" IndY),
+  inst!(BNE Rel),
+  inst!(CMP IndY),
   None,
   None,
   None,
-  inst!("CMP" ZpgX),
-  inst!("DEC" ZpgX),
+  inst!(CMP ZpgX),
+  inst!(DEC ZpgX),
   None,
-  inst!("CLD" Impl),
-  inst!("CMP" AbsY),
+  inst!(CLD Impl),
+  inst!(CMP AbsY),
   None,
   None,
   None,
-  inst!("CMP" AbsX),
-  inst!("DEC" AbsX),
+  inst!(CMP AbsX),
+  inst!(DEC AbsX),
   None,
   // e0-ef
-  inst!("CPX" Imm),
-  inst!("SBC" XInd),
+  inst!(CPX Imm),
+  inst!(SBC XInd),
   None,
   None,
-  inst!("CPX" Zpg),
-  inst!("SBC" Zpg),
-  inst!("INC" Zpg),
+  inst!(CPX Zpg),
+  inst!(SBC Zpg),
+  inst!(INC Zpg),
   None,
-  inst!("INX" Impl),
-  inst!("SBC" Imm),
-  inst!("NOP" Impl),
+  inst!(INX Impl),
+  inst!(SBC Imm),
+  inst!(NOP Impl),
   None,
-  inst!("CPX" Abs),
-  inst!("SBC" Abs),
-  inst!("INC" Abs),
+  inst!(CPX Abs),
+  inst!(SBC Abs),
+  inst!(INC Abs),
   None,
   // f0-ff
-  inst!("BEQ" Rel),
-  inst!("SBC" IndY),
+  inst!(BEQ Rel),
+  inst!(SBC IndY),
   None,
   None,
   None,
-  inst!("SBC" ZpgX),
-  inst!("INC" ZpgX),
+  inst!(SBC ZpgX),
+  inst!(INC ZpgX),
   None,
-  inst!("SED" Impl),
-  inst!("SBC" AbsY),
+  inst!(SED Impl),
+  inst!(SBC AbsY),
   None,
   None,
   None,
-  inst!("SBC" AbsX),
-  inst!("INC" AbsX),
+  inst!(SBC AbsX),
+  inst!(INC AbsX),
   None,
 ];
 
@@ -393,39 +627,168 @@ impl AddressMode {
       ZpgY => 2,
     }
   }
+}
 
-  fn write<W: Write>(
-    self,
-    pc: u16,
-    operand: &[u8],
-    w: &mut W,
-  ) -> io::Result<()> {
-    use AddressMode::*;
+impl Instruction {
+  const fn new(
+    mnemonic: Mnemonic,
+    name: &'static str,
+    addr_mode: AddressMode,
+  ) -> Option<Self> {
+    Some(Self {
+      mnemonic,
+      name,
+      addr_mode,
+      cycles: base_cycles(mnemonic, addr_mode),
+    })
+  }
+}
 
-    match self {
-      Accum => Ok(()),
-      Abs => write!(w, " ${:02X}{:02X}", operand[1], operand[0]),
-      AbsX => write!(w, " ${:02X}{:02X},X", operand[1], operand[0]),
-      AbsY => write!(w, " ${:02X}{:02X},Y", operand[1], operand[0]),
-      Imm => write!(w, " #${:02X}", operand[0]),
-      Impl => Ok(()),
-      Ind => write!(w, " (${:02X}{:02X})", operand[1], operand[0]),
-      XInd => write!(w, " (${:02X},X)", operand[0]),
-      IndY => write!(w, " (${:02X}),Y", operand[0]),
-      Rel => write!(
-        w,
-        " ${:04X}",
-        (Wrapping(pc) + Wrapping(operand[0] as i8 as u16)).0
-      ),
-      Zpg => write!(w, " ${:02X}", operand[0]),
-      ZpgX => write!(w, " ${:02X},X", operand[0]),
-      ZpgY => write!(w, " ${:02X},Y", operand[0]),
-    }
+/// Timing of NMOS 6502.
+const fn base_cycles(mnemonic: Mnemonic, addr_mode: AddressMode) -> u8 {
+  use AddressMode::*;
+  use Mnemonic::*;
+
+  match mnemonic {
+    STA | STX | STY => match addr_mode {
+      Zpg => 3,
+      ZpgX | ZpgY | Abs => 4,
+      AbsX | AbsY => 5,
+      _ => 6,
+    },
+    ASL | LSR | ROL | ROR | INC | DEC => match addr_mode {
+      Accum => 2,
+      Zpg => 5,
+      ZpgX | Abs => 6,
+      _ => 7,
+    },
+    JMP => match addr_mode {
+      Abs => 3,
+      _ => 5,
+    },
+    JSR | RTS | RTI => 6,
+    INT => 7,
+    PHA | PHP => 3,
+    PLA | PLP => 4,
+    _ => match addr_mode {
+      Accum | Imm | Impl | Rel => 2,
+      Zpg => 3,
+      ZpgX | ZpgY | Abs | AbsX | AbsY => 4,
+      Ind | IndY => 5,
+      XInd => 6,
+    },
   }
 }
 
-impl Instruction {
-  const fn new(name: &'static str, addr_mode: AddressMode) -> Option<Self> {
-    Some(Self { name, addr_mode })
+#[cfg(test)]
+mod tests {
+  use super::*;
+
+  fn dasm_with(body: &[u8], options: DasmOptions) -> String {
+    let mut bytes = vec![0; 16];
+    bytes[8] = 0x10;
+    bytes[9] = 0x40;
+    bytes.extend_from_slice(body);
+    let mut output = vec![];
+    disassemble(&bytes, &mut output, options).unwrap();
+    String::from_utf8(output).unwrap()
+  }
+
+  fn dasm(body: &[u8], vectors: Vec<u16>) -> String {
+    let options = DasmOptions {
+      starting_address: None,
+      follow_control_flow: true,
+      vectors,
+      format: OutputFormat::Text,
+    };
+    dasm_with(body, options)
+  }
+
+  #[test]
+  fn control_flow() {
+    let body = [
+      0x20, 0x1b, 0x40, // JSR $401B
+      0xd0, 0x03, // BNE $4018
+      0x4c, 0x10, 0x40, // JMP $4010
+      0x60, // RTS
+      0x12, 0x34, // data
+      0x60, // RTS
+      0xea, // NOP
+      0x60, // RTS
+      0xff, // data
+    ];
+    assert_eq!(
+      dasm(&body, vec![0x401c]),
+      "\
+; entry = $4010
+L4010:
+4010: 20 1B 40 JSR $401B
+4013: D0 03    BNE $4018
+4015: 4C 10 40 JMP $4010
+L4018:
+4018: 60       RTS
+4019: .byte $12,$34
+L401B:
+401B: 60       RTS
+L401C:
+401C: EA       NOP
+401D: 60       RTS
+401E: .byte $FF
+"
+    );
+  }
+
+  #[test]
+  fn overlapped_code() {
+    let body = [
+      0xd0, 0x01, // BNE $4013
+      0x2c, 0xa9, 0x05, // BIT $05A9, hiding LDA #$05
+      0x60, // RTS
+    ];
+    assert_eq!(
+      dasm(&body, vec![]),
+      "\
+; entry = $4010
+L4010:
+4010: D0 01    BNE $4013
+L4013 = * + 1
+4012: 2C A9 05 BIT $05A9
+; 4013: A9 05    LDA #$05
+4015: 60       RTS
+"
+    );
+  }
+
+  #[test]
+  fn formats() {
+    let body = [0xb1, 0x80, 0x0a, 0xf0, 0xfb, 0x02, 0x6c, 0x34, 0x12];
+    let options = |format| DasmOptions {
+      starting_address: None,
+      follow_control_flow: false,
+      vectors: vec![],
+      format,
+    };
+    assert_eq!(
+      dasm_with(&body, options(OutputFormat::Text)),
+      "\
+; entry = $4010
+4010: B1 80    LDA ($80),Y
+4012: 0A       ASL
+4013: F0 FB    BEQ $4010
+4015: 02       ??
+4016: 6C 34 12 JMP ($1234)
+"
+    );
+    assert_eq!(
+      dasm_with(&body[..8], options(OutputFormat::JsonLines)),
+      r#"{"kind":"entry","addr":"4010"}
+{"kind":"code","addr":"4010","bytes":"B180","mnemonic":"LDA","operand":"($80),Y"}
+{"kind":"code","addr":"4012","bytes":"0A","mnemonic":"ASL","operand":""}
+{"kind":"code","addr":"4013","bytes":"F0FB","mnemonic":"BEQ","operand":"$4010"}
+{"kind":"data","addr":"4015","bytes":"02"}
+{"kind":"data","addr":"4016","bytes":"6C"}
+{"kind":"data","addr":"4017","bytes":"34"}
+"#
+    );
   }
 }
@@ -1,8 +1,8 @@
-use bin_dasm::DasmOptions;
+use bin_dasm::{DasmOptions, OutputFormat};
 use clap::{crate_version, App, Arg};
 use std::error::Error;
 use std::fs::File;
-use std::io::{BufReader, BufWriter, Read};
+use std::io::{BufReader, Read};
 use std::num::IntErrorKind;
 use std::path::{Path, PathBuf};
 
@@ -18,7 +18,36 @@ fn main() -> Result<(), Box<dyn Error>> {
           "the starting address of the .BIN program, in hexadecimal notation",
         )
         .takes_value(true)
-        .validator(validate_hex),
+        .validator(|s| validate_hex("origin", s)),
+    )
+    .arg(
+      Arg::with_name("control-flow")
+        .short("c")
+        .long("control-flow")
+        .help(
+          "disassemble only the code reachable from the entry and vectors, \
+           dumping the rest as data",
+        ),
+    )
+    .arg(
+      Arg::with_name("vector")
+        .short("v")
+        .long("vector")
+        .value_name("ADDR")
+        .help("extra entry point for --control-flow, in hexadecimal notation")
+        .takes_value(true)
+        .multiple(true)
+        .number_of_values(1)
+        .validator(|s| validate_hex("vector", s)),
+    )
+    .arg(
+      Arg::with_name("format")
+        .short("f")
+        .long("format")
+        .help("output format: assembly listing, or one JSON object per line")
+        .takes_value(true)
+        .possible_values(&["text", "json"])
+        .default_value("text"),
     )
     .arg(
       Arg::with_name("output")
@@ -36,7 +65,18 @@ fn main() -> Result<(), Box<dyn Error>> {
     .get_matches();
 
   let file = matches.value_of("FILE").unwrap();
-  let origin = matches.value_of("origin").map(|o| o.parse().unwrap());
+  let origin = matches
+    .value_of("origin")
+    .map(|o| u16::from_str_radix(o, 16).unwrap());
+  let vectors = matches.values_of("vector").map_or(vec![], |vectors| {
+    vectors
+      .map(|v| u16::from_str_radix(v, 16).unwrap())
+      .collect()
+  });
+  let format = match matches.value_of("format") {
+    Some("json") => OutputFormat::JsonLines,
+    _ => OutputFormat::Text,
+  };
   let output = matches.value_of("output").map_or_else(
     || {
       let mut path = Path::new(file).file_stem().unwrap().to_owned();
@@ -48,28 +88,31 @@ fn main() -> Result<(), Box<dyn Error>> {
 
   let mut bytes = vec![];
   BufReader::new(File::open(file)?).read_to_end(&mut bytes)?;
-  let output = BufWriter::new(File::create(output)?);
+  let output = File::create(output)?;
 
   ::bin_dasm::disassemble(
     &bytes,
     output,
     DasmOptions {
       starting_address: origin,
+      follow_control_flow: matches.is_present("control-flow"),
+      vectors,
+      format,
     },
   )?;
 
   Ok(())
 }
 
-fn validate_hex(s: String) -> Result<(), String> {
+fn validate_hex(name: &str, s: String) -> Result<(), String> {
   match u16::from_str_radix(&s, 16) {
     Ok(_) => Ok(()),
     Err(err) => match err.kind() {
       IntErrorKind::InvalidDigit => {
-        Err("origin must be a hexadecimal number".to_owned())
+        Err(format!("{} must be a hexadecimal number", name))
       }
       IntErrorKind::NegOverflow | IntErrorKind::PosOverflow => {
-        Err("origin must be in the range of [0, 0xffff]".to_owned())
+        Err(format!("{} must be in the range of [0, 0xffff]", name))
       }
       _ => Err(err.to_string()),
     },
@@ -0,0 +1,31 @@
+#![feature(test)]
+
+extern crate test;
+
+use gvb_interp::document::{load_bas, load_txt};
+use std::path::Path;
+use test::{black_box, Bencher};
+
+fn read_data(name: &str) -> Vec<u8> {
+  let path = Path::new(env!("CARGO_MANIFEST_DIR"))
+    .join("data")
+    .join(name);
+  std::fs::read(&path)
+    .unwrap_or_else(|err| panic!("{}: {}", path.display(), err))
+}
+
+#[bench]
+fn document_load_bas(b: &mut Bencher) {
+  let bas = read_data("鹿逐中原.bas");
+  load_bas(&bas).unwrap();
+  b.bytes = bas.len() as u64;
+  b.iter(|| load_bas(black_box(&bas)).unwrap());
+}
+
+#[bench]
+fn document_load_txt(b: &mut Bencher) {
+  let txt = read_data("鹿逐中原.txt");
+  load_txt(&txt).unwrap();
+  b.bytes = txt.len() as u64;
+  b.iter(|| load_txt(black_box(&txt)).unwrap());
+}
@@ -0,0 +1,33 @@
+#![feature(test)]
+
+extern crate test;
+
+use gvb_interp::parser::parse;
+use test::{black_box, Bencher};
+
+/// Lines dominated by keywords, system functions and identifiers in mixed
+/// case, which is where the lexer spends most of its time.
+const LINES: &[&str] = &[
+  r#"LoCaTe 3,2:PrInT "啊A":lOcAtE 3,18-LeN(STr$(Et)):PriNT ET:DRaW 100,38"#,
+  "GRAPH:CLS:FOR I=1 TO 100 STEP 2:BOX I,I,I+10,I+10:NEXT I",
+  "IF INKEY$=CHR$(13) THEN GOSUB 1000 ELSE IF A AND B OR C THEN 30",
+  "LET score=score+INT(RND(1)*10):x1=SIN(a)*COS(b)+SQR(ABS(c))",
+  "OPEN \"DAT\" FOR RANDOM AS 1 LEN=20:FIELD 1,10 AS n$,10 AS p$",
+  "LSET n$=MKI$(nn):RSET p$=MKS$(pp):PUT 1,rec:CLOSE 1",
+  "WHILE hp>0:hp=hp-VAL(MID$(s$,2,1)):WEND:REM game over",
+];
+
+fn make_program(n: usize) -> String {
+  let mut text = String::new();
+  for i in 0..n {
+    text += &format!("{} {}\n", (i + 1) * 10 % 10000, LINES[i % LINES.len()]);
+  }
+  text
+}
+
+#[bench]
+fn lexer_parse(b: &mut Bencher) {
+  let text = make_program(2000);
+  b.bytes = text.len() as u64;
+  b.iter(|| parse(black_box(&text)));
+}
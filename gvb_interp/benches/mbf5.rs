@@ -0,0 +1,112 @@
+#![feature(test)]
+
+extern crate test;
+
+use gvb_interp::util::mbf5::{Mbf5, Mbf5Accum};
+use std::convert::TryFrom;
+use test::{black_box, Bencher};
+
+/// Number of values converted in each iteration.
+const N: usize = 10000;
+
+/// Results of typical calculations, e.g. loop counters and scaled sums.
+fn make_values(n: usize) -> Vec<Mbf5Accum> {
+  (0..n)
+    .map(|i| {
+      let x = (i as f64 + 0.5) * 1.37 / 3.0 - 100.0;
+      Mbf5Accum::try_from(x).unwrap()
+    })
+    .collect()
+}
+
+/// Half of them are integers, like scores and counters.
+fn make_packed_values() -> Vec<Mbf5> {
+  make_values(N / 2)
+    .into_iter()
+    .chain((0..N / 2).map(|i| Mbf5Accum::try_from(i as f64 * 7.0).unwrap()))
+    .map(|x| Mbf5::try_from(x).unwrap())
+    .collect()
+}
+
+#[bench]
+fn mbf5_pack_and_unpack(b: &mut Bencher) {
+  let values = make_values(N);
+  // Both ways must produce the same values.
+  let bits = |x: Mbf5Accum| Into::<f64>::into(x).to_bits();
+  for &x in &values {
+    let packed = Mbf5Accum::from(&Mbf5::try_from(x).unwrap());
+    assert_eq!(bits(packed), bits(x.round().unwrap()));
+  }
+  b.iter(|| {
+    for &x in black_box(&values) {
+      black_box(Mbf5Accum::from(&Mbf5::try_from(x).unwrap()));
+    }
+  });
+}
+
+#[bench]
+fn mbf5_round(b: &mut Bencher) {
+  let values = make_values(N);
+  b.iter(|| {
+    for &x in black_box(&values) {
+      black_box(x.round().unwrap());
+    }
+  });
+}
+
+#[bench]
+fn mbf5_to_string(b: &mut Bencher) {
+  let values = make_packed_values();
+  b.iter(|| {
+    for x in black_box(&values) {
+      black_box(x.to_string());
+    }
+  });
+}
+
+#[bench]
+fn mbf5_format_into(b: &mut Bencher) {
+  let values = make_packed_values();
+  b.iter(|| {
+    let mut buf = [0; Mbf5::MAX_DISPLAY_LEN];
+    for x in black_box(&values) {
+      black_box(x.format_into(&mut buf));
+    }
+  });
+}
+
+#[bench]
+fn mbf5_from_f64(b: &mut Bencher) {
+  let floats = make_values(N)
+    .into_iter()
+    .map(|x| x.into())
+    .collect::<Vec<f64>>();
+  b.iter(|| {
+    for &x in black_box(&floats) {
+      black_box(Mbf5::try_from(Mbf5Accum::try_from(x).unwrap()).unwrap());
+    }
+  });
+}
+
+#[bench]
+fn mbf5_to_f64(b: &mut Bencher) {
+  let packed = make_packed_values();
+  b.iter(|| {
+    for x in black_box(&packed) {
+      black_box(Into::<f64>::into(Mbf5Accum::from(x)));
+    }
+  });
+}
+
+#[bench]
+fn mbf5_from_str(b: &mut Bencher) {
+  let texts = make_packed_values()
+    .iter()
+    .map(|x| x.to_string())
+    .collect::<Vec<_>>();
+  b.iter(|| {
+    for s in black_box(&texts) {
+      black_box(s.parse::<Mbf5>().unwrap());
+    }
+  });
+}
@@ -0,0 +1,51 @@
+#![feature(test)]
+
+extern crate test;
+
+use gvb_interp::document::load_txt;
+use gvb_interp::parser::{parse, parse_parallel};
+use std::path::Path;
+use test::{black_box, Bencher};
+
+/// A mix of statements and expressions of a typical game.
+const LINES: &[&str] = &[
+  "DIM A(20,5),N$(20):DEF FN F(X)=INT(X*RND(1))+1:RESTORE 9000",
+  r#"CLS:LOCATE 1,5:PRINT "第";L;"关":LOCATE 3,1:INPUT "NAME";N$"#,
+  "FOR I=1 TO 20:FOR J=0 TO 5:READ A(I,J):NEXT J,I",
+  "IF HP<=0 OR T>999 THEN 9990 ELSE ON K GOSUB 100,200,300,400",
+  "X=X+SGN(DX)*(ABS(DX)>1):Y=Y-(Y>0)*2^L:IF X<0 THEN X=0",
+  r#"A$=LEFT$(N$,2)+CHR$(ASC(MID$(S$,I,1))+1)+RIGHT$(STR$(S),3)"#,
+  "GRAPH:DRAW X,Y,1:LINE 0,0,X,Y:CIRCLE 80,40,R,1:BOX 1,1,X,Y,0,2",
+  "WHILE INKEY$<>\" \":K=PEEK(199):POKE 199,0:WEND:GOTO 30",
+  "DATA 1,2,\"三\",-4.5E-3,,甲乙:REM 数据",
+];
+
+fn make_program(n: usize) -> String {
+  let mut text = String::new();
+  for i in 0..n {
+    text += &format!("{} {}\n", i + 1, LINES[i % LINES.len()]);
+  }
+  text
+}
+
+#[bench]
+fn parser_parse_game(b: &mut Bencher) {
+  let path = Path::new(env!("CARGO_MANIFEST_DIR")).join("data/鹿逐中原.txt");
+  let game = load_txt(std::fs::read(path).unwrap()).unwrap().text;
+  b.bytes = game.len() as u64;
+  b.iter(|| parse(black_box(&game)));
+}
+
+#[bench]
+fn parser_parse_10k_lines(b: &mut Bencher) {
+  let text = make_program(10000);
+  b.bytes = text.len() as u64;
+  b.iter(|| parse(black_box(&text)));
+}
+
+#[bench]
+fn parser_parse_parallel_10k_lines(b: &mut Bencher) {
+  let text = make_program(10000);
+  b.bytes = text.len() as u64;
+  b.iter(|| parse_parallel(black_box(&text), 4));
+}
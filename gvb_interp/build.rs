@@ -8,13 +8,14 @@ use std::path::Path;
 fn main() -> Result<(), Box<dyn Error>> {
   build_gb2312_mapping()?;
   build_gvb_keyword_mapping()?;
+  build_ident_token_mapping()?;
 
   Ok(())
 }
 
 fn build_gb2312_mapping() -> Result<(), Box<dyn Error>> {
   println!("cargo:rerun-if-changed=data/GB2312.TXT");
-  
+
   let file = fs::read_to_string("data/GB2312.TXT")?;
   let mut mapping = vec![];
 
@@ -35,18 +36,33 @@ fn build_gb2312_mapping() -> Result<(), Box<dyn Error>> {
   let mut file = OpenOptions::new()
     .create(true)
     .write(true)
+    .truncate(true)
     .open(Path::new(&out_dir).join("gb2312.rs"))?;
 
+  // Both bytes of a GB2312 code are in 0xA1~0xFE, so the characters form a
+  // dense 94x94 table indexed by (row, cell), with '\0' for unused codes.
+  let mut table = vec!['\0'; 94 * 94];
+  for &(gbcode, unicode) in &mapping {
+    let row = (gbcode >> 8) as usize - 0xa1;
+    let cell = (gbcode & 0xff) as usize - 0xa1;
+    table[row * 94 + cell] = char::from_u32(unicode as u32)
+      .ok_or_else(|| format!("invalid unicode {:04X}", unicode))?;
+  }
+
   writeln!(&mut file, "use phf::phf_map;")?;
   writeln!(&mut file)?;
   writeln!(
     &mut file,
-    "pub(crate) static GB2312_TO_UNICODE: ::phf::Map<u16, u16> = phf_map! {{"
+    "pub(crate) static GB2312_TO_UNICODE: [char; 94 * 94] = ["
   )?;
-  for (gbcode, unicode) in &mapping {
-    writeln!(&mut file, "  {}u16 => {}u16,", gbcode, unicode)?;
+  for row in table.chunks(94) {
+    write!(&mut file, " ")?;
+    for c in row {
+      write!(&mut file, " {:?},", c)?;
+    }
+    writeln!(&mut file)?;
   }
-  writeln!(&mut file, "}};")?;
+  writeln!(&mut file, "];")?;
   writeln!(
     &mut file,
     "pub(crate) static UNICODE_TO_GB2312: ::phf::Map<u16, u16> = phf_map! {{"
@@ -113,4 +129,85 @@ fn build_gvb_keyword_mapping() -> Result<(), Box<dyn Error>> {
   writeln!(&mut file, "}};")?;
 
   Ok(())
-}
\ No newline at end of file
+}
+
+/// Builds the `FromStr` impls of keywords and system functions, and a single
+/// table from their names for the lexer, from `data/ident.txt`.
+fn build_ident_token_mapping() -> Result<(), Box<dyn Error>> {
+  println!("cargo:rerun-if-changed=data/ident.txt");
+
+  let file = fs::read_to_string("data/ident.txt")?;
+
+  // (name, type, variant)
+  let mut mapping: Vec<(&str, &str, &str)> = vec![];
+
+  for (i, line) in file.lines().enumerate() {
+    match *line.split_whitespace().collect::<Vec<_>>() {
+      [name, ty @ ("Keyword" | "SysFuncKind"), variant] => {
+        if mapping.iter().any(|&(n, _, _)| n == name) {
+          return Err(
+            format!("data/ident.txt:{}: duplicate {}", i + 1, name).into(),
+          );
+        }
+        mapping.push((name, ty, variant));
+      }
+      _ => {
+        return Err(format!("data/ident.txt:{}: malformed line", i + 1).into())
+      }
+    }
+  }
+
+  let out_dir = env::var("OUT_DIR")?;
+
+  let mut file = OpenOptions::new()
+    .create(true)
+    .write(true)
+    .truncate(true)
+    .open(Path::new(&out_dir).join("ident_token.rs"))?;
+
+  writeln!(&mut file, "use phf::phf_map;")?;
+  writeln!(&mut file)?;
+  writeln!(
+    &mut file,
+    "pub(crate) const MAX_NAME_LEN: usize = {};",
+    mapping
+      .iter()
+      .map(|(name, _, _)| name.len())
+      .max()
+      .unwrap_or(0)
+  )?;
+  writeln!(
+    &mut file,
+    "pub(crate) static NAME_TO_TOKEN: ::phf::Map<&'static str, TokenKind> = phf_map! {{"
+  )?;
+  for (name, ty, variant) in &mapping {
+    let ctor = if *ty == "Keyword" {
+      "Keyword"
+    } else {
+      "SysFunc"
+    };
+    writeln!(
+      &mut file,
+      "  \"{}\" => TokenKind::{}({}::{}),",
+      name, ctor, ty, variant
+    )?;
+  }
+  writeln!(&mut file, "}};")?;
+
+  for ty in &["Keyword", "SysFuncKind"] {
+    writeln!(&mut file)?;
+    writeln!(&mut file, "impl ::std::str::FromStr for {} {{", ty)?;
+    writeln!(&mut file, "  type Err = ();")?;
+    writeln!(&mut file, "  fn from_str(s: &str) -> Result<Self, ()> {{")?;
+    writeln!(&mut file, "    match s {{")?;
+    for (name, _, variant) in mapping.iter().filter(|(_, t, _)| t == ty) {
+      writeln!(&mut file, "      \"{}\" => Ok(Self::{}),", name, variant)?;
+    }
+    writeln!(&mut file, "      _ => Err(()),")?;
+    writeln!(&mut file, "    }}")?;
+    writeln!(&mut file, "  }}")?;
+    writeln!(&mut file, "}}")?;
+  }
+
+  Ok(())
+}
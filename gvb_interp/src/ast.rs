@@ -16,9 +16,11 @@ pub use self::node::*;
 pub use self::stmt::*;
 pub use self::token::*;
 
-#[derive(Clone)]
+#[derive(Clone, Default)]
 pub struct Program {
   pub lines: Vec<ProgramLine>,
+  pub nodes: NodeStore,
+  pub labels: LabelIndex,
 }
 
 pub struct NonEmptyVec<T: Array>(pub SmallVec<T>);
@@ -54,12 +56,51 @@ impl Program {
     let mut buf = String::new();
     let mut offset = 0;
     for line in &self.lines {
-      buf += &line.to_string(&text[offset..offset + line.source_len]);
+      buf +=
+        &line.to_string(&self.nodes, &text[offset..offset + line.source_len]);
       buf += "==================================\n";
       offset += line.source_len;
     }
     buf
   }
+
+  /// Replaces the lines in `range` with `lines`, whose nodes are all stored
+  /// in `nodes`.
+  pub(crate) fn splice_lines(
+    &mut self,
+    range: std::ops::Range<usize>,
+    mut lines: Vec<ProgramLine>,
+    nodes: NodeStore,
+  ) {
+    let mut old = NodeSpan::default();
+    if let Some(line) = self.lines[..range.start].last() {
+      old.stmt_start = line.nodes.stmt_end();
+      old.expr_start = line.nodes.expr_end();
+      old.diag_start = line.nodes.diag_end();
+    }
+    if let Some(line) = self.lines[range.clone()].last() {
+      old.stmt_len = line.nodes.stmt_end() - old.stmt_start;
+      old.expr_len = line.nodes.expr_end() - old.expr_start;
+      old.diag_len = line.nodes.diag_end() - old.diag_start;
+    }
+    let new = self.nodes.splice(old, nodes);
+
+    for line in &mut lines {
+      line.nodes.stmt_start += new.stmt_start;
+      line.nodes.expr_start += new.expr_start;
+      line.nodes.diag_start += new.diag_start;
+    }
+    for line in &mut self.lines[range.end..] {
+      line.nodes.stmt_start =
+        line.nodes.stmt_start + new.stmt_len - old.stmt_len;
+      line.nodes.expr_start =
+        line.nodes.expr_start + new.expr_len - old.expr_len;
+      line.nodes.diag_start =
+        line.nodes.diag_start + new.diag_len - old.diag_len;
+    }
+    self.labels.splice(range.clone(), &lines);
+    self.lines.splice(range, lines);
+  }
 }
 
 impl<T: Array> NonEmptyVec<T> {
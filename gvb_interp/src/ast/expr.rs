@@ -1,9 +1,6 @@
-use id_arena::Arena;
-
 use super::{ExprId, NonEmptyVec, Range};
 use num_derive::FromPrimitive;
 use std::fmt::{self, Debug, Formatter, Write};
-use std::str::FromStr;
 
 #[derive(Debug, Clone)]
 pub struct Expr {
@@ -103,42 +100,6 @@ impl Expr {
   }
 }
 
-impl FromStr for SysFuncKind {
-  type Err = ();
-  fn from_str(s: &str) -> Result<Self, ()> {
-    match s {
-      "abs" => Ok(Self::Abs),
-      "asc" => Ok(Self::Asc),
-      "atn" => Ok(Self::Atn),
-      "chr$" => Ok(Self::Chr),
-      "cos" => Ok(Self::Cos),
-      "cvi$" => Ok(Self::Cvi),
-      "cvs$" => Ok(Self::Cvs),
-      "eof" => Ok(Self::Eof),
-      "exp" => Ok(Self::Exp),
-      "int" => Ok(Self::Int),
-      "left$" => Ok(Self::Left),
-      "len" => Ok(Self::Len),
-      "lof" => Ok(Self::Lof),
-      "log" => Ok(Self::Log),
-      "mid$" => Ok(Self::Mid),
-      "mki$" => Ok(Self::Mki),
-      "mks$" => Ok(Self::Mks),
-      "peek" => Ok(Self::Peek),
-      "pos" => Ok(Self::Pos),
-      "right$" => Ok(Self::Right),
-      "rnd" => Ok(Self::Rnd),
-      "sgn" => Ok(Self::Sgn),
-      "sin" => Ok(Self::Sin),
-      "sqr" => Ok(Self::Sqr),
-      "str$" => Ok(Self::Str),
-      "tan" => Ok(Self::Tan),
-      "val" => Ok(Self::Val),
-      _ => Err(()),
-    }
-  }
-}
-
 impl Debug for BinaryOpKind {
   fn fmt(&self, f: &mut Formatter) -> fmt::Result {
     let kind = match self {
@@ -209,7 +170,7 @@ impl Debug for UnaryOpKind {
 impl Expr {
   pub fn print(
     &self,
-    expr_arena: &Arena<Expr>,
+    expr_arena: &[Expr],
     text: &str,
     f: &mut impl Write,
   ) -> fmt::Result {
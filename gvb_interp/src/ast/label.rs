@@ -1,8 +1,16 @@
+use super::ProgramLine;
 use std::{num::IntErrorKind, str::FromStr};
 
-#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
 pub struct Label(pub u16);
 
+/// Lines of all labels of a program, for jumps to labels.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct LabelIndex {
+  /// Sorted by label and then by line index.
+  entries: Vec<(Label, usize)>,
+}
+
 #[derive(Debug, Clone, PartialEq, Eq)]
 pub enum ParseLabelError {
   OutOfBound,
@@ -28,3 +36,79 @@ impl FromStr for Label {
     }
   }
 }
+
+impl LabelIndex {
+  pub fn new(lines: &[ProgramLine]) -> Self {
+    let mut index = Self::default();
+    index.splice(0..0, lines);
+    index
+  }
+
+  /// Returns the index of the first line with the label.
+  pub fn find(&self, label: Label) -> Option<usize> {
+    let i = self.entries.partition_point(|&(l, _)| l < label);
+    match self.entries.get(i) {
+      Some(&(l, line)) if l == label => Some(line),
+      _ => None,
+    }
+  }
+
+  /// Updates the index after the lines in `range` are replaced with `lines`.
+  pub(crate) fn splice(
+    &mut self,
+    range: std::ops::Range<usize>,
+    lines: &[ProgramLine],
+  ) {
+    let removed = range.len();
+    self
+      .entries
+      .retain(|&(_, line)| line < range.start || line >= range.end);
+    for (_, line) in &mut self.entries {
+      if *line >= range.end {
+        *line = *line + lines.len() - removed;
+      }
+    }
+    let len = self.entries.len();
+    self.entries.extend(
+      lines
+        .iter()
+        .enumerate()
+        .filter_map(|(i, line)| line.label.map(|l| (l, range.start + i))),
+    );
+    if self.entries.len() > len {
+      // The old and the new entries are two sorted runs, which are merged by
+      // `sort` in linear time.
+      self.entries[len..].sort_unstable();
+      self.entries.sort();
+    }
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use crate::parser::parse;
+  use pretty_assertions::assert_eq;
+
+  #[test]
+  fn find_first_line() {
+    let prog = parse("20 a\n10 b\n20 c\n\n30 d\n");
+    assert_eq!(prog.labels.find(Label(10)), Some(1));
+    assert_eq!(prog.labels.find(Label(20)), Some(0));
+    assert_eq!(prog.labels.find(Label(30)), Some(4));
+    assert_eq!(prog.labels.find(Label(0)), None);
+    assert_eq!(prog.labels.find(Label(25)), None);
+  }
+
+  #[test]
+  fn splice() {
+    let mut prog = parse("10 a\n20 b\n30 c\n");
+    let new = parse("5 x\n30 y\n");
+    prog.splice_lines(1..2, new.lines, new.nodes);
+    assert_eq!(prog.labels.find(Label(20)), None);
+    assert_eq!(prog.labels.find(Label(5)), Some(1));
+    assert_eq!(prog.labels.find(Label(30)), Some(2));
+    assert_eq!(prog.labels.find(Label(10)), Some(0));
+    assert_eq!(prog.labels, LabelIndex::new(&prog.lines));
+  }
+}
@@ -1,19 +1,20 @@
-use super::{Expr, Label, Stmt, StmtId};
-use crate::diagnostic::Diagnostic;
-use id_arena::Arena;
+use super::{Label, NodeSpan, NodeStore, StmtId};
+use crate::parser::semantic::{semantic_tokens, SemanticToken};
 use smallvec::SmallVec;
 use std::fmt::{Debug, Write};
+use std::sync::OnceLock;
 
 #[derive(Debug, Clone)]
 pub struct ProgramLine {
   /// Includes newline.
   pub source_len: usize,
   pub label: Option<Label>,
-  pub stmt_arena: Arena<Stmt>,
-  pub expr_arena: Arena<Expr>,
+  /// Nodes of this line in the `NodeStore` of the program.
+  pub nodes: NodeSpan,
   pub stmts: SmallVec<[StmtId; 1]>,
   pub eol: Eol,
-  pub diagnostics: Vec<Diagnostic>,
+  /// Lexed on first use by `semantic_tokens`.
+  pub(crate) tokens: OnceLock<Box<[SemanticToken]>>,
 }
 
 #[derive(Debug, Clone)]
@@ -25,19 +26,36 @@ pub enum Eol {
 }
 
 impl ProgramLine {
-  pub fn to_string(&self, text: &str) -> String {
+  /// Returns the tokens of the line for highlighting. `text` is the source of
+  /// the line, which may contain newline.
+  ///
+  /// The tokens are cached in the line, which is replaced when it's reparsed.
+  pub fn semantic_tokens(&self, text: &str) -> &[SemanticToken] {
+    self.tokens.get_or_init(|| {
+      let line = match self.eol {
+        Eol::None => text,
+        Eol::Lf => &text[..text.len() - 1],
+        Eol::CrLf => &text[..text.len() - 2],
+      };
+      semantic_tokens(line).into_boxed_slice()
+    })
+  }
+
+  pub fn to_string(&self, nodes: &NodeStore, text: &str) -> String {
     let mut f = String::new();
     writeln!(&mut f, "label: {:?}", self.label).unwrap();
     writeln!(&mut f, "len: {}", self.source_len).unwrap();
     writeln!(&mut f, "eol: {:?}", self.eol).unwrap();
     writeln!(&mut f, "diagnostics: ").unwrap();
-    for diag in &self.diagnostics {
+    for diag in nodes.diagnostics(&self.nodes) {
       writeln!(&mut f, "  {:?}", diag).unwrap();
     }
     writeln!(&mut f, "-----------------").unwrap();
+    let stmt_arena = nodes.stmts(&self.nodes);
+    let expr_arena = nodes.exprs(&self.nodes);
     for &stmt in self.stmts.iter() {
-      self.stmt_arena[stmt]
-        .print(&self.stmt_arena, &self.expr_arena, text, &mut f)
+      stmt_arena[stmt]
+        .print(stmt_arena, expr_arena, text, &mut f)
         .unwrap();
     }
     f
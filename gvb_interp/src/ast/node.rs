@@ -1,12 +1,173 @@
 use super::{Expr, Stmt};
-use id_arena::Id;
+use crate::diagnostic::Diagnostic;
+use std::fmt::{self, Debug, Formatter};
+use std::hash::{Hash, Hasher};
+use std::marker::PhantomData;
+use std::ops::{Index, IndexMut};
 
-pub type ExprId = Id<Expr>;
-pub type StmtId = Id<Stmt>;
+/// Index of a node, relative to the first node of the same kind in its line.
+pub struct NodeId<T> {
+  index: u32,
+  _marker: PhantomData<fn() -> T>,
+}
+
+pub type ExprId = NodeId<Expr>;
+pub type StmtId = NodeId<Stmt>;
+
+/// Nodes and diagnostics of all lines of a program. Those of every line are
+/// stored contiguously, in the order of lines.
+#[derive(Debug, Clone, Default)]
+pub struct NodeStore {
+  pub(crate) stmts: Vec<Stmt>,
+  pub(crate) exprs: Vec<Expr>,
+  pub(crate) diagnostics: Vec<Diagnostic>,
+}
+
+/// The position of the nodes of a line in a `NodeStore`.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct NodeSpan {
+  pub stmt_start: usize,
+  pub stmt_len: usize,
+  pub expr_start: usize,
+  pub expr_len: usize,
+  pub diag_start: usize,
+  pub diag_len: usize,
+}
 
 pub(crate) trait NodeBuilder {
   fn new_stmt(&mut self, stmt: Stmt) -> StmtId;
   fn new_expr(&mut self, expr: Expr) -> ExprId;
   fn stmt_node(&self, stmt: StmtId) -> &Stmt;
   fn expr_node(&self, expr: ExprId) -> &Expr;
+  fn new_diagnostic(&mut self, diag: Diagnostic);
+}
+
+impl<T> NodeId<T> {
+  pub(crate) fn new(index: usize) -> Self {
+    Self {
+      index: index as u32,
+      _marker: PhantomData,
+    }
+  }
+
+  pub fn index(self) -> usize {
+    self.index as usize
+  }
+}
+
+impl<T> Clone for NodeId<T> {
+  fn clone(&self) -> Self {
+    *self
+  }
+}
+
+impl<T> Copy for NodeId<T> {}
+
+impl<T> PartialEq for NodeId<T> {
+  fn eq(&self, other: &Self) -> bool {
+    self.index == other.index
+  }
+}
+
+impl<T> Eq for NodeId<T> {}
+
+impl<T> Hash for NodeId<T> {
+  fn hash<H: Hasher>(&self, state: &mut H) {
+    self.index.hash(state)
+  }
+}
+
+impl<T> Debug for NodeId<T> {
+  fn fmt(&self, f: &mut Formatter) -> fmt::Result {
+    write!(f, "#{}", self.index)
+  }
+}
+
+impl Index<StmtId> for [Stmt] {
+  type Output = Stmt;
+  fn index(&self, id: StmtId) -> &Stmt {
+    &self[id.index()]
+  }
+}
+
+impl IndexMut<StmtId> for [Stmt] {
+  fn index_mut(&mut self, id: StmtId) -> &mut Stmt {
+    &mut self[id.index()]
+  }
+}
+
+impl Index<ExprId> for [Expr] {
+  type Output = Expr;
+  fn index(&self, id: ExprId) -> &Expr {
+    &self[id.index()]
+  }
+}
+
+impl IndexMut<ExprId> for [Expr] {
+  fn index_mut(&mut self, id: ExprId) -> &mut Expr {
+    &mut self[id.index()]
+  }
+}
+
+impl NodeStore {
+  pub fn new() -> Self {
+    Self::default()
+  }
+
+  /// Returns the statements of a line, to be indexed by `StmtId`.
+  pub fn stmts(&self, span: &NodeSpan) -> &[Stmt] {
+    &self.stmts[span.stmt_start..span.stmt_end()]
+  }
+
+  /// Returns the expressions of a line, to be indexed by `ExprId`.
+  pub fn exprs(&self, span: &NodeSpan) -> &[Expr] {
+    &self.exprs[span.expr_start..span.expr_end()]
+  }
+
+  /// Returns the diagnostics of a line.
+  pub fn diagnostics(&self, span: &NodeSpan) -> &[Diagnostic] {
+    &self.diagnostics[span.diag_start..span.diag_end()]
+  }
+
+  /// Returns the diagnostics of all lines, in the order of lines.
+  pub fn all_diagnostics(&self) -> &[Diagnostic] {
+    &self.diagnostics
+  }
+
+  /// Replaces the nodes in `old`, a span of consecutive lines, with all nodes
+  /// of `nodes`. Returns the span of the inserted nodes.
+  pub(crate) fn splice(&mut self, old: NodeSpan, nodes: NodeStore) -> NodeSpan {
+    let new = NodeSpan {
+      stmt_start: old.stmt_start,
+      stmt_len: nodes.stmts.len(),
+      expr_start: old.expr_start,
+      expr_len: nodes.exprs.len(),
+      diag_start: old.diag_start,
+      diag_len: nodes.diagnostics.len(),
+    };
+    self
+      .stmts
+      .splice(old.stmt_start..old.stmt_end(), nodes.stmts);
+    self
+      .exprs
+      .splice(old.expr_start..old.expr_end(), nodes.exprs);
+    self
+      .diagnostics
+      .splice(old.diag_start..old.diag_end(), nodes.diagnostics);
+    new
+  }
+}
+
+impl NodeSpan {
+  pub fn stmt_end(&self) -> usize {
+    self.stmt_start + self.stmt_len
+  }
+
+  pub fn expr_end(&self) -> usize {
+    self.expr_start + self.expr_len
+  }
+
+  pub fn diag_end(&self) -> usize {
+    self.diag_start + self.diag_len
+  }
 }
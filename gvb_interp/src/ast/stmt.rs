@@ -1,7 +1,6 @@
 use std::fmt::{self, Debug, Formatter, Write};
 
 use super::{Expr, ExprId, Label, NonEmptyVec, Range, StmtId};
-use id_arena::Arena;
 use smallvec::SmallVec;
 
 #[derive(Debug, Clone)]
@@ -225,8 +224,8 @@ impl Debug for FileMode {
 impl Stmt {
   pub fn print(
     &self,
-    stmt_arena: &Arena<Stmt>,
-    expr_arena: &Arena<Expr>,
+    stmt_arena: &[Stmt],
+    expr_arena: &[Expr],
     text: &str,
     f: &mut impl Write,
   ) -> fmt::Result {
@@ -237,8 +236,8 @@ impl Stmt {
 fn print_stmt(
   stmt: &Stmt,
   indent: usize,
-  stmt_arena: &Arena<Stmt>,
-  expr_arena: &Arena<Expr>,
+  stmt_arena: &[Stmt],
+  expr_arena: &[Expr],
   text: &str,
   f: &mut impl Write,
 ) -> fmt::Result {
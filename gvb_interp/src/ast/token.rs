@@ -1,12 +1,16 @@
 use num_derive::FromPrimitive;
 use num_traits::FromPrimitive;
-use std::{
-  fmt::{self, Debug, Formatter},
-  str::FromStr,
-};
+use std::fmt::{self, Debug, Formatter};
 
 use super::SysFuncKind;
 
+/// The `FromStr` impls of `Keyword` and `SysFuncKind`, and the table of
+/// their names for the lexer, all built from `data/ident.txt`.
+mod ident_token {
+  use super::{Keyword, SysFuncKind, TokenKind};
+  include!(concat!(env!("OUT_DIR"), "/ident_token.rs"));
+}
+
 #[derive(Clone, Copy, PartialEq, Eq)]
 pub enum TokenKind {
   Ident,
@@ -122,95 +126,6 @@ pub enum Punc {
   Hash,
 }
 
-impl FromStr for Keyword {
-  type Err = ();
-  fn from_str(s: &str) -> Result<Self, ()> {
-    match s {
-      "auto" => Ok(Self::Auto),
-      "beep" => Ok(Self::Beep),
-      "box" => Ok(Self::Box),
-      "call" => Ok(Self::Call),
-      "circle" => Ok(Self::Circle),
-      "clear" => Ok(Self::Clear),
-      "close" => Ok(Self::Close),
-      "cls" => Ok(Self::Cls),
-      "cont" => Ok(Self::Cont),
-      "copy" => Ok(Self::Copy),
-      "data" => Ok(Self::Data),
-      "def" => Ok(Self::Def),
-      "del" => Ok(Self::Del),
-      "dim" => Ok(Self::Dim),
-      "draw" => Ok(Self::Draw),
-      "edit" => Ok(Self::Edit),
-      "ellipse" => Ok(Self::Ellipse),
-      "end" => Ok(Self::End),
-      "field" => Ok(Self::Field),
-      "files" => Ok(Self::Files),
-      "flash" => Ok(Self::Flash),
-      "for" => Ok(Self::For),
-      "get" => Ok(Self::Get),
-      "gosub" => Ok(Self::Gosub),
-      "goto" => Ok(Self::Goto),
-      "graph" => Ok(Self::Graph),
-      "if" => Ok(Self::If),
-      "inkey$" => Ok(Self::Inkey),
-      "input" => Ok(Self::Input),
-      "inverse" => Ok(Self::Inverse),
-      "kill" => Ok(Self::Kill),
-      "let" => Ok(Self::Let),
-      "line" => Ok(Self::Line),
-      "list" => Ok(Self::List),
-      "load" => Ok(Self::Load),
-      "locate" => Ok(Self::Locate),
-      "lset" => Ok(Self::Lset),
-      "new" => Ok(Self::New),
-      "next" => Ok(Self::Next),
-      "normal" => Ok(Self::Normal),
-      "notrace" => Ok(Self::Notrace),
-      "on" => Ok(Self::On),
-      "open" => Ok(Self::Open),
-      "play" => Ok(Self::Play),
-      "poke" => Ok(Self::Poke),
-      "pop" => Ok(Self::Pop),
-      "print" => Ok(Self::Print),
-      "put" => Ok(Self::Put),
-      "read" => Ok(Self::Read),
-      "rem" => Ok(Self::Rem),
-      "rename" => Ok(Self::Rename),
-      "restore" => Ok(Self::Restore),
-      "return" => Ok(Self::Return),
-      "rset" => Ok(Self::Rset),
-      "run" => Ok(Self::Run),
-      "save" => Ok(Self::Save),
-      "stop" => Ok(Self::Stop),
-      "swap" => Ok(Self::Swap),
-      "system" => Ok(Self::System),
-      "text" => Ok(Self::Text),
-      "trace" => Ok(Self::Trace),
-      "wend" => Ok(Self::Wend),
-      "while" => Ok(Self::While),
-      "write" => Ok(Self::Write),
-
-      "then" => Ok(Self::Then),
-      "else" => Ok(Self::Else),
-      "to" => Ok(Self::To),
-      "step" => Ok(Self::Step),
-      "fn" => Ok(Self::Fn),
-      "and" => Ok(Self::And),
-      "or" => Ok(Self::Or),
-      "not" => Ok(Self::Not),
-
-      "sleep" => Ok(Self::Sleep),
-      "paint" => Ok(Self::Paint),
-      "fputc" => Ok(Self::Fputc),
-      "fread" => Ok(Self::Fread),
-      "fwrite" => Ok(Self::Fwrite),
-      "fseek" => Ok(Self::Fseek),
-      _ => Err(()),
-    }
-  }
-}
-
 impl From<u8> for Punc {
   fn from(c: u8) -> Self {
     match c {
@@ -361,6 +276,18 @@ impl Debug for TokenKind {
 }
 
 impl TokenKind {
+  /// Returns the keyword or system function whose name is `name`, ignoring
+  /// case.
+  pub(crate) fn from_name(name: &[u8]) -> Option<Self> {
+    let mut buf = [0u8; ident_token::MAX_NAME_LEN];
+    let buf = buf.get_mut(..name.len())?;
+    for (b, c) in buf.iter_mut().zip(name) {
+      *b = c.to_ascii_lowercase();
+    }
+    let name = std::str::from_utf8(buf).ok()?;
+    ident_token::NAME_TO_TOKEN.get(name).copied()
+  }
+
   pub const fn to_usize(&self) -> usize {
     match self {
       TokenKind::Ident => 0,
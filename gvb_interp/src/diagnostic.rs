@@ -1,11 +1,14 @@
-use std::fmt::{self, Debug, Formatter};
+use std::fmt::{self, Debug, Display, Formatter};
 
-use crate::ast::Range;
+use crate::ast::{Keyword, Range, TokenKind};
+use crate::parser::symbol::{Nonterminal, Symbol, SymbolSet};
 
+/// A diagnostic is a kind plus a range, and the message is only rendered when
+/// it's displayed, so that parsing a program allocates no strings for them.
 #[derive(Clone, PartialEq, Eq)]
 pub struct Diagnostic {
   pub severity: Severity,
-  pub message: String,
+  pub kind: DiagnosticKind,
   pub range: Range,
 }
 
@@ -15,26 +18,183 @@ pub enum Severity {
   Error,
 }
 
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum DiagnosticKind {
+  // Parser.
+  MissingLabel,
+  LabelOutOfBound,
+  IllegalChar(char),
+  /// A token not in the expected symbols.
+  UnexpectedToken(SymbolSet),
+  MissingAs,
+  MissingStmt,
+  MissingStmtAfter(Keyword),
+  StmtNotEnded,
+  ExtraColonInIfBranch,
+  ElseOutsideIf,
+  MissingComma,
+  MissingFnAfterDef,
+  MissingDefFnName,
+  MissingDefEq,
+  MissingLParenAfterFnName,
+  MissingFnParam,
+  MissingRParenAfterFnParam,
+  MissingForVar,
+  MissingEqAfterIdent,
+  MissingTo,
+  MissingThen,
+  MissingCommaAfterFileNum,
+  MissingSemicolonAfterPrompt,
+  MissingAssignEq,
+  MissingEqAfterVar,
+  MissingEqAfterArray,
+  MissingCommaAfterVar,
+  MissingCommaAfterArray,
+  MissingIdentAfterComma,
+  MissingFileMode,
+  MissingEqAfterLen,
+  MissingCommaAfterAddr,
+  MissingFnNameAfterFn,
+  MissingSysFuncLParen,
+  MissingRParen,
+  UnmatchedLParen,
+
+  // Compiler.
+  NumberTooLarge,
+  UnencodableChar(char),
+  ExpectedNum,
+  ExpectedStr,
+  ExpectedRealVar,
+  ExpectedStrVar,
+  ExpectedRealFn,
+  OperandTypeMismatch,
+  StrOperator,
+  ArgCountMismatch,
+  SwapTypeMismatch,
+}
+
 impl Diagnostic {
-  pub fn new_error(range: Range, message: impl ToString) -> Self {
+  pub fn new_error(range: Range, kind: DiagnosticKind) -> Self {
     Self {
       severity: Severity::Error,
       range,
-      message: message.to_string(),
+      kind,
     }
   }
 
-  pub fn new_warning(range: Range, message: impl ToString) -> Self {
+  pub fn new_warning(range: Range, kind: DiagnosticKind) -> Self {
     Self {
       severity: Severity::Warning,
       range,
-      message: message.to_string(),
+      kind,
     }
   }
+
+  pub fn message(&self) -> String {
+    self.kind.to_string()
+  }
 }
 
 impl Debug for Diagnostic {
   fn fmt(&self, f: &mut Formatter) -> fmt::Result {
-    write!(f, "{:?}<{:?}>: {}", self.severity, self.range, self.message)
+    write!(f, "{:?}<{:?}>: {}", self.severity, self.range, self.kind)
+  }
+}
+
+impl Display for DiagnosticKind {
+  fn fmt(&self, f: &mut Formatter) -> fmt::Result {
+    use DiagnosticKind::*;
+    let msg = match self {
+      MissingLabel => "缺少行号",
+      LabelOutOfBound => "行号必须在0~9999之间",
+      &IllegalChar(c) => {
+        return if (c as u32) < 0x10000 {
+          write!(f, "非法字符：U+{:04X}", c as u32)
+        } else {
+          write!(f, "非法字符：U+{:06X}", c as u32)
+        };
+      }
+      UnexpectedToken(symbols) => return fmt_expected_symbols(symbols, f),
+      MissingAs => "语法错误。期望是AS",
+      MissingStmt => "缺少语句",
+      MissingStmtAfter(kw) => return write!(f, "{:?} 之后缺少语句", kw),
+      StmtNotEnded => "语句结尾必须是行尾或跟上冒号",
+      ExtraColonInIfBranch => "IF 语句的分支中不能出现多余的冒号",
+      ElseOutsideIf => "ELSE 不能出现在 IF 语句之外",
+      MissingComma => "缺少逗号",
+      MissingFnAfterDef => "DEF 之后缺少 FN 关键字",
+      MissingDefFnName => "DEF 语句缺少函数名称",
+      MissingDefEq => "DEF 语句缺少等号",
+      MissingLParenAfterFnName => "函数名称之后缺少左括号",
+      MissingFnParam => "缺少函数参数变量",
+      MissingRParenAfterFnParam => "函数参数之后缺少右括号",
+      MissingForVar => "FOR 之后缺少标识符",
+      MissingEqAfterIdent => "标识符之后缺少等号",
+      MissingTo => "初始化表达式之后缺少 TO",
+      MissingThen => "条件表达式之后缺少 THEN 或 GOTO",
+      MissingCommaAfterFileNum => "文件号表达式之后缺少逗号",
+      MissingSemicolonAfterPrompt => "INPUT 字符串之后缺少分号",
+      MissingAssignEq => "赋值语句缺少等号",
+      MissingEqAfterVar => "变量之后缺少等号",
+      MissingEqAfterArray => "数组之后缺少等号",
+      MissingCommaAfterVar => "变量之后缺少逗号",
+      MissingCommaAfterArray => "数组之后缺少逗号",
+      MissingIdentAfterComma => "逗号之后缺少标识符",
+      MissingFileMode => {
+        "OPEN 语句缺少文件模式：INPUT，OUTPUT，APPEND 或 RANDOM"
+      }
+      MissingEqAfterLen => "LEN 之后缺少等号",
+      MissingCommaAfterAddr => "地址表达式之后缺少逗号",
+      MissingFnNameAfterFn => "FN 之后缺少函数名称",
+      MissingSysFuncLParen => "系统函数调用缺少左括号",
+      MissingRParen => "缺少右括号",
+      UnmatchedLParen => "缺少匹配的右括号",
+
+      NumberTooLarge => "数值过大",
+      &UnencodableChar(c) => return write!(f, "无法编码的字符：{}", c),
+      ExpectedNum => "表达式类型错误，期望是数值类型",
+      ExpectedStr => "表达式类型错误，期望是字符串类型",
+      ExpectedRealVar => "变量必须是实数类型",
+      ExpectedStrVar => "变量必须是字符串类型",
+      ExpectedRealFn => "函数名必须是实数类型",
+      OperandTypeMismatch => "运算符两边的表达式类型不一致",
+      StrOperator => "字符串不能进行此运算",
+      ArgCountMismatch => "函数参数个数错误",
+      SwapTypeMismatch => "SWAP 的两个变量的类型必须相同",
+    };
+    f.write_str(msg)
+  }
+}
+
+fn fmt_expected_symbols(symbols: &SymbolSet, f: &mut Formatter) -> fmt::Result {
+  f.write_str("语法错误。期望是 ")?;
+  let symbols = symbols.iter().collect::<Vec<_>>();
+  let len = symbols.len();
+  for (i, sym) in symbols.into_iter().enumerate() {
+    if i != 0 {
+      if i == len - 1 {
+        f.write_str(" 或 ")?;
+      } else {
+        f.write_str("，")?;
+      }
+    }
+    match sym {
+      Symbol::Term(token) => match token {
+        TokenKind::Ident => f.write_str("标识符")?,
+        TokenKind::Label => f.write_str("行号")?,
+        TokenKind::Float => f.write_str("实数")?,
+        TokenKind::String => f.write_str("字符串")?,
+        TokenKind::Punc(p) => write!(f, "\"{:?}\"", p)?,
+        TokenKind::Keyword(p) => write!(f, "{:?}", p)?,
+        TokenKind::SysFunc(p) => write!(f, "{:?}", p)?,
+        TokenKind::Eof => f.write_str("行尾")?,
+      },
+      Symbol::Nonterm(n) => match n {
+        Nonterminal::Expr => f.write_str("表达式")?,
+        Nonterminal::Stmt => f.write_str("语句")?,
+        Nonterminal::Array => f.write_str("数组")?,
+      },
+    }
   }
+  Ok(())
 }
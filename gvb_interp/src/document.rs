@@ -1,20 +1,216 @@
-use std::path::Path;
-use std::io;
+use crate::ast::Program;
+use crate::parser::parse;
+use std::collections::HashMap;
 use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex, OnceLock, Weak};
+use std::time::SystemTime;
 
 mod binary;
 mod emoji;
-mod gb2312 {
+
+pub use self::binary::{
+  bas_size, load_bas, load_txt, save_bas, BasDecoder, BasTextDocument,
+  LoadBasError, LoadTxtError, SaveBasError,
+};
+pub use self::emoji::EmojiStyle;
+
+pub(crate) mod gb2312 {
   include!(concat!(env!("OUT_DIR"), "/gb2312.rs"));
+
+  /// Decodes a two-byte GB2312 code, with the first byte in the high bits.
+  #[inline]
+  pub(crate) fn decode(code: u16) -> Option<char> {
+    index(code).and_then(|i| Some(GB2312_TO_UNICODE[i]).filter(|&c| c != '\0'))
+  }
+
+  /// The index of a two-byte code in the 94x94 table of rows and cells, also
+  /// used for looking up glyphs.
+  #[inline]
+  pub(crate) fn index(code: u16) -> Option<usize> {
+    let row = ((code >> 8) as usize).wrapping_sub(0xa1);
+    let cell = ((code & 0xff) as usize).wrapping_sub(0xa1);
+    if row < 94 && cell < 94 {
+      Some(row * 94 + cell)
+    } else {
+      None
+    }
+  }
 }
 
+/// A loaded `.BAS` or `.txt` file. Cloning is cheap.
+#[derive(Clone)]
 pub struct Document {
   base_addr: u16,
+  content: Arc<Content>,
+}
+
+struct Content {
+  kind: DocumentKind,
+  guessed_emoji_style: EmojiStyle,
+  text: String,
+  /// The parsed text. Its diagnostics are in `Program.nodes`.
+  program: Program,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DocumentKind {
+  Bas,
+  Txt,
+}
+
+/// Loaded files, keyed by canonical path and checked by modification time and
+/// size, so reopening an unchanged file is instant.
+///
+/// Only weak references are kept, so a document is freed once the host drops
+/// it. The entries of freed documents are removed whenever a file is read, so
+/// the cache grows only with the documents in use.
+static CACHE: OnceLock<Mutex<HashMap<PathBuf, CacheEntry>>> = OnceLock::new();
+
+struct CacheEntry {
+  modified: SystemTime,
+  len: u64,
+  base_addr: u16,
+  content: Weak<Content>,
 }
 
 impl Document {
-  /// Load a `.BAS` or `.txt` file.
-  pub fn load<P>(path: impl AsRef<Path>) -> io::Result<Self> {
-    todo!()
+  /// Load a `.BAS` or `.txt` file. The format is told from the content, since
+  /// a `.BAS` file starts with 0x00 which never occurs in text.
+  pub fn load(path: impl AsRef<Path>) -> io::Result<Self> {
+    let path = fs::canonicalize(path)?;
+    let metadata = fs::metadata(&path)?;
+    let modified = metadata.modified()?;
+    let len = metadata.len();
+
+    let cache = CACHE.get_or_init(Default::default);
+    if let Some(entry) = cache.lock().unwrap().get(&path) {
+      if entry.modified == modified && entry.len == len {
+        if let Some(content) = entry.content.upgrade() {
+          return Ok(Self {
+            base_addr: entry.base_addr,
+            content,
+          });
+        }
+      }
+    }
+
+    let document = Self::from_bytes(&fs::read(&path)?)?;
+    let mut cache = cache.lock().unwrap();
+    cache.retain(|_, entry| entry.content.strong_count() != 0);
+    cache.insert(
+      path,
+      CacheEntry {
+        modified,
+        len,
+        base_addr: document.base_addr,
+        content: Arc::downgrade(&document.content),
+      },
+    );
+    Ok(document)
+  }
+
+  /// Loads a document from the content of a file, without caching.
+  pub fn from_bytes(content: &[u8]) -> io::Result<Self> {
+    let (kind, doc) = if content.first() == Some(&0) {
+      let doc = load_bas(content).map_err(|err| {
+        invalid_data(format!("{}: {}", err.offset, err.message))
+      })?;
+      (DocumentKind::Bas, doc)
+    } else {
+      let doc = load_txt(content).map_err(|err| {
+        invalid_data(format!(
+          "{}:{}: {}",
+          err.line + 1,
+          err.column + 1,
+          err.message
+        ))
+      })?;
+      (DocumentKind::Txt, doc)
+    };
+
+    let program = parse(&doc.text);
+    Ok(Self {
+      base_addr: doc.base_addr as u16,
+      content: Arc::new(Content {
+        kind,
+        guessed_emoji_style: doc.guessed_emoji_style,
+        text: doc.text,
+        program,
+      }),
+    })
+  }
+
+  pub fn base_addr(&self) -> u16 {
+    self.base_addr
+  }
+
+  pub fn kind(&self) -> DocumentKind {
+    self.content.kind
+  }
+
+  pub fn guessed_emoji_style(&self) -> EmojiStyle {
+    self.content.guessed_emoji_style
+  }
+
+  pub fn text(&self) -> &str {
+    &self.content.text
+  }
+
+  pub fn program(&self) -> &Program {
+    &self.content.program
+  }
+}
+
+fn invalid_data(message: String) -> io::Error {
+  io::Error::new(io::ErrorKind::InvalidData, message)
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+
+  #[test]
+  fn load_cached() {
+    let dir = std::env::temp_dir()
+      .join(format!("gvb_interp_document_{}", std::process::id()));
+    fs::create_dir_all(&dir).unwrap();
+    let path = dir.join("a.txt");
+    fs::write(&path, "10 PRINT 1\n20 PRINT (\n").unwrap();
+
+    let doc = Document::load(&path).unwrap();
+    assert_eq!(doc.kind(), DocumentKind::Txt);
+    assert_eq!(doc.program().lines.len(), 2);
+    let program = doc.program();
+    assert!(!program
+      .nodes
+      .diagnostics(&program.lines[1].nodes)
+      .is_empty());
+    let again = Document::load(dir.join("./a.txt")).unwrap();
+    assert!(Arc::ptr_eq(&doc.content, &again.content));
+
+    fs::write(&path, "10 PRINT 12\n").unwrap();
+    let changed = Document::load(&path).unwrap();
+    assert_eq!(changed.text(), "10 PRINT 12\n");
+
+    // Dropped documents are not kept alive by the cache.
+    let weak = Arc::downgrade(&changed.content);
+    drop((doc, again, changed));
+    assert_eq!(weak.strong_count(), 0);
+    let reloaded = Document::load(&path).unwrap();
+    assert_eq!(reloaded.text(), "10 PRINT 12\n");
+
+    fs::remove_dir_all(&dir).unwrap();
   }
-}
\ No newline at end of file
+
+  #[test]
+  fn sniff_bas() {
+    let bas = save_bas("10 PRINT 1", 0x2000).unwrap();
+    let doc = Document::from_bytes(&bas).unwrap();
+    assert_eq!(doc.kind(), DocumentKind::Bas);
+    assert_eq!(doc.text(), "10 PRINT 1");
+    let err = Document::from_bytes(&bas[..5]).err().unwrap();
+    assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+  }
+}
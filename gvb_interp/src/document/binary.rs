@@ -1,5 +1,9 @@
 use super::emoji::EmojiStyle;
+use crate::ast::{Keyword, Label, ParseLabelError, TokenKind};
+use crate::parser::{data_end, Lexer};
+use std::convert::TryInto;
 use std::fmt::Write;
+use std::io::BufRead;
 
 mod keyword {
   include!(concat!(env!("OUT_DIR"), "/keyword.rs"));
@@ -20,147 +24,531 @@ pub struct LoadBasError {
 pub fn load_bas(
   content: impl AsRef<[u8]>,
 ) -> Result<BasTextDocument, LoadBasError> {
-  let mut content = content.as_ref();
-  let mut base_addr = 0usize;
-  let mut lines: Vec<&[u8]> = vec![];
-  let mut offset = 0;
-  let mut guessed_emoji_styles = vec![EmojiStyle::New, EmojiStyle::Old];
+  let content = content.as_ref();
+  let mut decoder = BasDecoder::new(content);
+  // Keywords take up one byte but several characters.
+  let mut text = String::with_capacity(content.len() * 2);
+  while decoder.next_line(&mut text)? {
+    text.push('\n');
+  }
+  text.pop();
 
-  loop {
-    if content.len() < 3 {
-      return Err(LoadBasError {
-        offset: offset + content.len(),
-        message: format!("unexpected EOF"),
-      });
+  Ok(BasTextDocument {
+    base_addr: decoder.base_addr(),
+    guessed_emoji_style: decoder.emoji_style(),
+    text,
+  })
+}
+
+/// Decodes the lines of a `.BAS` file one at a time, in constant memory.
+///
+/// `R` is usually a `&[u8]`, such as a memory-mapped file, or a `BufReader`.
+/// A line is decoded directly from the buffer of the reader when the whole
+/// line is in it, and is copied into a scratch buffer otherwise.
+pub struct BasDecoder<R> {
+  reader: R,
+  /// Offset of the next byte to read.
+  offset: usize,
+  base_addr: usize,
+  emoji: EmojiGuess,
+  scratch: Vec<u8>,
+  finished: bool,
+}
+
+/// Candidates of the emoji style, in the order of preference.
+struct EmojiGuess {
+  styles: Vec<EmojiStyle>,
+  /// Whether some character has been decoded with `styles[0]`.
+  used: bool,
+}
+
+impl<R: BufRead> BasDecoder<R> {
+  pub fn new(reader: R) -> Self {
+    Self {
+      reader,
+      offset: 0,
+      base_addr: 0,
+      emoji: EmojiGuess {
+        styles: vec![EmojiStyle::New, EmojiStyle::Old],
+        used: false,
+      },
+      scratch: vec![],
+      finished: false,
+    }
+  }
+
+  /// The address of the first line, or 0 if no line has been read.
+  pub fn base_addr(&self) -> usize {
+    self.base_addr
+  }
+
+  /// The emoji style guessed from the lines read so far.
+  pub fn emoji_style(&self) -> EmojiStyle {
+    self.emoji.styles[0]
+  }
+
+  /// Decodes the next line and appends it to `out`, without the trailing
+  /// newline. Returns `false` at the end of the program.
+  ///
+  /// Since the emoji style is guessed as the lines are read, a character that
+  /// rules out the style used by previous lines is an error.
+  pub fn next_line(&mut self, out: &mut String) -> Result<bool, LoadBasError> {
+    if self.finished {
+      return Ok(false);
     }
 
-    if content[0] != 0 {
+    let mut header = [0u8; 5];
+    self.read_exact(&mut header[..3])?;
+    if header[0] != 0 {
       return Err(LoadBasError {
-        offset,
-        message: format!("expected 0x00, found 0x{:02X}", content[0]),
+        offset: self.offset - 3,
+        message: format!("expected 0x00, found 0x{:02X}", header[0]),
       });
     }
 
-    let addr = content[1] as usize + ((content[2] as usize) << 8);
+    let addr = header[1] as usize + ((header[2] as usize) << 8);
     if addr == 0 {
-      break;
+      self.finished = true;
+      return Ok(false);
     }
-
-    if base_addr == 0 {
-      base_addr = addr;
+    if self.base_addr == 0 {
+      self.base_addr = addr;
     }
 
-    let mut i = 5;
+    self.read_exact(&mut header[3..])?;
+    let label = header[3] as u16 + ((header[4] as u16) << 8);
+    write!(out, "{} ", label).unwrap();
+
+    // The line ends before the 0x00 starting the next line.
+    let buf = fill_buf(&mut self.reader, self.offset)?;
+    if let Some(len) = buf.iter().position(|&b| b == 0) {
+      decode_line(&buf[..len], self.offset, &mut self.emoji, out)?;
+      self.reader.consume(len);
+      self.offset += len;
+      return Ok(true);
+    }
 
-    while content.len() > i {
-      if content[i] == 0 {
-        lines.push(&content[..i]);
-        offset += i;
-        content = &content[i..];
+    let start = self.offset;
+    self.scratch.clear();
+    loop {
+      let buf = fill_buf(&mut self.reader, self.offset)?;
+      if buf.is_empty() {
+        return Err(self.eof_error());
+      }
+      let len = buf.iter().position(|&b| b == 0);
+      let consumed = len.unwrap_or(buf.len());
+      self.scratch.extend_from_slice(&buf[..consumed]);
+      self.reader.consume(consumed);
+      self.offset += consumed;
+      if len.is_some() {
         break;
       }
+    }
+    decode_line(&self.scratch, start, &mut self.emoji, out)?;
+    Ok(true)
+  }
 
-      if content[i] == 0x1f {
-        if content.len() <= i + 2 {
-          return Err(LoadBasError {
-            offset: offset + i,
-            message: format!("invalid full-width character"),
-          });
-        }
+  fn read_exact(&mut self, mut bytes: &mut [u8]) -> Result<(), LoadBasError> {
+    while !bytes.is_empty() {
+      let buf = fill_buf(&mut self.reader, self.offset)?;
+      if buf.is_empty() {
+        return Err(self.eof_error());
+      }
+      let len = buf.len().min(bytes.len());
+      bytes[..len].copy_from_slice(&buf[..len]);
+      self.reader.consume(len);
+      self.offset += len;
+      bytes = &mut bytes[len..];
+    }
+    Ok(())
+  }
 
-        let gbcode = ((content[i + 1] as u16) << 8) + content[i + 2] as u16;
-        if !super::gb2312::GB2312_TO_UNICODE.contains_key(&gbcode) {
-          guessed_emoji_styles.retain(|s| s.code_to_char(gbcode).is_some());
-          if guessed_emoji_styles.is_empty() {
-            return Err(LoadBasError {
-              offset: offset + i + 1,
-              message: format!("unable to guess emoji style"),
-            });
-          }
-        }
-        i += 3;
+  fn eof_error(&self) -> LoadBasError {
+    LoadBasError {
+      offset: self.offset,
+      message: "unexpected EOF".to_owned(),
+    }
+  }
+}
+
+/// Fills the buffer of `reader`, which is at `offset` of the file.
+fn fill_buf(
+  reader: &mut impl BufRead,
+  offset: usize,
+) -> Result<&[u8], LoadBasError> {
+  reader.fill_buf().map_err(|err| LoadBasError {
+    offset,
+    message: err.to_string(),
+  })
+}
+
+/// Decodes the tokens of a line, which start at `offset` of the file, after
+/// the label already in `out`.
+fn decode_line(
+  line: &[u8],
+  offset: usize,
+  emoji: &mut EmojiGuess,
+  out: &mut String,
+) -> Result<(), LoadBasError> {
+  let mut last_is_keyword = false;
+  let mut i = 0;
+  while i < line.len() {
+    let b = line[i];
+    if b == 0x1f {
+      if line.len() <= i + 2 {
+        return Err(LoadBasError {
+          offset: offset + i,
+          message: "invalid full-width character".to_owned(),
+        });
+      }
+      let gbcode = ((line[i + 1] as u16) << 8) + line[i + 2] as u16;
+      if let Some(c) = super::gb2312::decode(gbcode) {
+        out.push(c);
+      } else if let Some(c) = emoji.decode(gbcode) {
+        out.push(c);
       } else {
-        if !keyword::BYTE_TO_KEYWORD.contains_key(&content[i]) {
+        return Err(LoadBasError {
+          offset: offset + i + 1,
+          message: "unable to guess emoji style".to_owned(),
+        });
+      }
+      last_is_keyword = false;
+      i += 3;
+    } else if b >= 0x80 {
+      let kw = match keyword::BYTE_TO_KEYWORD.get(&b) {
+        Some(kw) => *kw,
+        None => {
           return Err(LoadBasError {
             offset: offset + i,
-            message: format!("unrecognized bytecode 0x{:02x}", content[i]),
-          });
+            message: format!("unrecognized bytecode 0x{:02x}", b),
+          })
+        }
+      };
+      let last = *out.as_bytes().last().unwrap();
+      let first = kw.as_bytes().first().unwrap();
+      if first.is_ascii_alphabetic()
+        && (last == b'$' || last.is_ascii_alphanumeric())
+      {
+        out.push(' ');
+      } else if let "THEN" | "ELSE" | "TO" = kw {
+        if last != b' ' {
+          out.push(' ');
+        }
+      }
+      out.push_str(kw);
+      if keyword::KEYWORD_REQUIRES_SPACE.contains(&b) {
+        out.push(' ');
+      }
+      last_is_keyword = true;
+      i += 1;
+    } else {
+      if last_is_keyword && b.is_ascii_alphanumeric() {
+        let last = *out.as_bytes().last().unwrap();
+        if last == b'$' || last.is_ascii_alphanumeric() {
+          out.push(' ');
         }
-        i += 1;
       }
+      out.push(b as char);
+      last_is_keyword = false;
+      i += 1;
     }
   }
+  Ok(())
+}
 
-  let guessed_emoji_style = guessed_emoji_styles[0];
-  let mut text = String::new();
-  let mut newline = false;
-  let mut offset = 0;
+impl EmojiGuess {
+  fn decode(&mut self, code: u16) -> Option<char> {
+    let valid = |s: &EmojiStyle| s.code_to_char(code).is_some();
+    if !self.styles.iter().any(valid) || self.used && !valid(&self.styles[0]) {
+      return None;
+    }
+    self.styles.retain(valid);
+    self.used = true;
+    self.styles[0].code_to_char(code)
+  }
+}
 
-  for line in lines {
-    if newline {
-      text.push('\n');
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct SaveBasError {
+  /// zero-based
+  pub line: usize,
+  /// zero-based, in bytes
+  pub column: usize,
+  pub message: String,
+}
+
+/// Encodes a program into a `.BAS` file, which is loaded at `load_addr` of
+/// the memory.
+///
+/// Spaces that `load_bas` inserts around keywords are omitted, so that
+/// loading the file gives back the same text.
+pub fn save_bas(text: &str, load_addr: u16) -> Result<Vec<u8>, SaveBasError> {
+  let mut bytes = Vec::with_capacity(text.len());
+  encode_bas(text, load_addr as usize, &mut bytes)?;
+  Ok(bytes)
+}
+
+/// Returns the size of the `.BAS` file of a program, without encoding it.
+pub fn bas_size(text: &str) -> Result<usize, SaveBasError> {
+  let mut size = ByteCount(0);
+  encode_bas(text, 0, &mut size)?;
+  Ok(size.0)
+}
+
+trait BasSink {
+  fn len(&self) -> usize;
+  fn push(&mut self, bytes: &[u8]);
+  /// Overwrites the bytes at `offset`.
+  fn patch(&mut self, offset: usize, bytes: [u8; 2]);
+}
+
+impl BasSink for Vec<u8> {
+  fn len(&self) -> usize {
+    self.len()
+  }
+
+  fn push(&mut self, bytes: &[u8]) {
+    self.extend_from_slice(bytes);
+  }
+
+  fn patch(&mut self, offset: usize, bytes: [u8; 2]) {
+    self[offset..offset + 2].copy_from_slice(&bytes);
+  }
+}
+
+struct ByteCount(usize);
+
+impl BasSink for ByteCount {
+  fn len(&self) -> usize {
+    self.0
+  }
+
+  fn push(&mut self, bytes: &[u8]) {
+    self.0 += bytes.len();
+  }
+
+  fn patch(&mut self, _offset: usize, _bytes: [u8; 2]) {}
+}
+
+fn encode_bas(
+  text: &str,
+  load_addr: usize,
+  out: &mut impl BasSink,
+) -> Result<(), SaveBasError> {
+  out.push(&[0]);
+  for (index, line) in text.lines().enumerate() {
+    if line.bytes().all(|b| b == b' ') {
+      continue;
     }
-    newline = true;
-
-    let label = line[3] as u16 + ((line[4] as u16) << 8);
-    write!(&mut text, "{} ", label).unwrap();
-
-    let mut last_is_keyword = false;
-    let mut i = 5;
-    while i < line.len() {
-      let b = line[i];
-      if b == 0x1f {
-        let gbcode = ((line[i + 1] as u16) << 8) + line[i + 2] as u16;
-        if let Some(&u) = super::gb2312::GB2312_TO_UNICODE.get(&gbcode) {
-          text.push(char::from_u32(u as u32).unwrap());
-        } else {
-          let u = guessed_emoji_style.code_to_char(gbcode).unwrap();
-          text.push(char::from_u32(u as u32).unwrap());
-        }
-        last_is_keyword = false;
-        i += 3;
-      } else if b >= 0x80 {
-        let kw = keyword::BYTE_TO_KEYWORD[&b];
-        let last = *text.as_bytes().last().unwrap();
-        let first = kw.as_bytes().first().unwrap();
-        if first.is_ascii_alphabetic()
-          && (last == b'$' || last.is_ascii_alphanumeric())
-        {
-          text.push(' ');
-        } else if let "THEN" | "ELSE" | "TO" = kw {
-          if last != b' ' {
-            text.push(' ');
+
+    let start = out.len();
+    out.push(&[0; 4]);
+    let mut encoder = LineEncoder {
+      line,
+      index,
+      out,
+      pending_spaces: 0,
+      drop_space: true,
+      last: b' ',
+      last_is_keyword: false,
+    };
+    let label = encoder.encode()?;
+    out.push(&[0]);
+
+    // Each line starts with the address of the next line.
+    let next_addr = load_addr + out.len();
+    if next_addr > 0xffff {
+      return Err(SaveBasError {
+        line: index,
+        column: 0,
+        message: "program too large".to_owned(),
+      });
+    }
+    out.patch(start, (next_addr as u16).to_le_bytes());
+    out.patch(start + 2, label.to_le_bytes());
+  }
+  out.push(&[0, 0]);
+  Ok(())
+}
+
+/// Encodes the tokens of a line, keeping track of what `load_bas` would have
+/// decoded so far to tell which spaces it would insert.
+struct LineEncoder<'a, S> {
+  line: &'a str,
+  index: usize,
+  out: &'a mut S,
+  /// Spaces before the next byte, not written yet.
+  pending_spaces: usize,
+  /// Whether the decoder always inserts a space before the next byte, after
+  /// the label or keywords like `PRINT`.
+  drop_space: bool,
+  /// The last byte decoded, or 0x80 for full-width characters.
+  last: u8,
+  last_is_keyword: bool,
+}
+
+impl<'a, S: BasSink> LineEncoder<'a, S> {
+  /// Encodes the line after the link, and returns the label.
+  fn encode(&mut self) -> Result<u16, SaveBasError> {
+    let line = self.line;
+    let digits = line.bytes().take_while(u8::is_ascii_digit).count();
+    let label = match line[..digits].parse() {
+      Ok(Label(label)) => label,
+      Err(ParseLabelError::NotALabel) => {
+        return Err(self.error(0, "missing line number"))
+      }
+      Err(ParseLabelError::OutOfBound) => {
+        return Err(self.error(0, "invalid line number"))
+      }
+    };
+    // Not read by the lexer, which may take a following `E` as an exponent.
+    let mut lexer = Lexer::new(line);
+    lexer.seek(digits);
+    let mut last_end = digits;
+
+    loop {
+      let (range, kind) = lexer.next_token(false);
+      self.skip_spaces(last_end, range.start)?;
+      last_end = range.end;
+      let text = &line[range.start..range.end];
+      match kind {
+        TokenKind::Eof => break,
+        TokenKind::Keyword(_) | TokenKind::SysFunc(_) | TokenKind::Punc(_) => {
+          let mut buf = [0u8; 8];
+          let name = buf
+            .get_mut(..text.len())
+            .map(|name| {
+              name.copy_from_slice(text.as_bytes());
+              name.make_ascii_uppercase();
+              &name[..]
+            })
+            .and_then(|name| std::str::from_utf8(name).ok())
+            .and_then(|name| keyword::KEYWORD_TO_BYTE.get(name));
+          match name {
+            Some(&byte) => self.keyword(byte),
+            None if matches!(kind, TokenKind::Punc(_)) => {
+              self.chars(range.start, text)?
+            }
+            None => {
+              return Err(self.error(range.start, "keyword not supported"))
+            }
           }
-        }
-        text.push_str(kw);
-        if keyword::KEYWORD_REQUIRES_SPACE.contains(&b) {
-          text.push(' ');
-        }
-        last_is_keyword = true;
-        i += 1;
-      } else {
-        if last_is_keyword && b.is_ascii_alphanumeric() {
-          let last = *text.as_bytes().last().unwrap();
-          if last == b'$'
-            || last.is_ascii_alphanumeric() && (b as u8).is_ascii_alphanumeric()
-          {
-            text.push(' ');
+
+          match kind {
+            TokenKind::Keyword(Keyword::Rem) => {
+              self.chars(range.end, &line[range.end..])?;
+              break;
+            }
+            TokenKind::Keyword(Keyword::Data) => {
+              let end = data_end(line.as_bytes(), range.end);
+              self.chars(range.end, &line[range.end..end])?;
+              lexer.seek(end);
+              last_end = end;
+            }
+            _ => {}
           }
         }
-        text.push(b as char);
-        last_is_keyword = false;
-        i += 1;
+        _ => self.chars(range.start, text)?,
       }
     }
+    self.flush_spaces(false);
 
-    offset += line.len();
+    Ok(label)
   }
 
-  Ok(BasTextDocument {
-    base_addr,
-    guessed_emoji_style,
-    text,
-  })
+  fn error(&self, column: usize, message: &str) -> SaveBasError {
+    SaveBasError {
+      line: self.index,
+      column,
+      message: message.to_owned(),
+    }
+  }
+
+  /// Counts the spaces between tokens.
+  fn skip_spaces(
+    &mut self,
+    start: usize,
+    end: usize,
+  ) -> Result<(), SaveBasError> {
+    match self.line.as_bytes()[start..end]
+      .iter()
+      .position(|&b| b != b' ')
+    {
+      Some(i) => Err(self.error(start + i, "invalid character")),
+      None => {
+        self.pending_spaces += end - start;
+        Ok(())
+      }
+    }
+  }
+
+  /// Writes the pending spaces, except for one the decoder inserts itself.
+  fn flush_spaces(&mut self, inserted: bool) {
+    if self.drop_space {
+      self.drop_space = false;
+      self.pending_spaces = self.pending_spaces.saturating_sub(1);
+    } else if inserted && self.pending_spaces == 1 {
+      self.pending_spaces = 0;
+    }
+    for _ in 0..self.pending_spaces {
+      self.out.push(b" ");
+    }
+    if self.pending_spaces > 0 {
+      self.last = b' ';
+      self.last_is_keyword = false;
+      self.pending_spaces = 0;
+    }
+  }
+
+  fn keyword(&mut self, byte: u8) {
+    let kw = keyword::BYTE_TO_KEYWORD[&byte];
+    let first = kw.as_bytes()[0];
+    let inserted = first.is_ascii_alphabetic()
+      && (self.last == b'$' || self.last.is_ascii_alphanumeric())
+      || matches!(kw, "THEN" | "ELSE" | "TO") && self.last != b' ';
+    self.flush_spaces(inserted);
+    self.out.push(&[byte]);
+    self.last_is_keyword = true;
+    if keyword::KEYWORD_REQUIRES_SPACE.contains(&byte) {
+      self.last = b' ';
+      self.drop_space = true;
+    } else {
+      self.last = *kw.as_bytes().last().unwrap();
+    }
+  }
+
+  /// Encodes the characters of `text` at `column` as they are.
+  fn chars(&mut self, column: usize, text: &str) -> Result<(), SaveBasError> {
+    for (i, c) in text.char_indices() {
+      if c == ' ' {
+        self.pending_spaces += 1;
+      } else if c.is_ascii() && c != '\0' && c != '\x1f' {
+        let b = c as u8;
+        let inserted = self.last_is_keyword
+          && b.is_ascii_alphanumeric()
+          && (self.last == b'$' || self.last.is_ascii_alphanumeric());
+        self.flush_spaces(inserted);
+        self.out.push(&[b]);
+        self.last = b;
+        self.last_is_keyword = false;
+      } else {
+        let gbcode = (c as u32)
+          .try_into()
+          .ok()
+          .and_then(|u: u16| super::gb2312::UNICODE_TO_GB2312.get(&u));
+        match gbcode {
+          Some(&gbcode) => {
+            self.flush_spaces(false);
+            self.out.push(&[0x1f, (gbcode >> 8) as u8, gbcode as u8]);
+            self.last = 0x80;
+            self.last_is_keyword = false;
+          }
+          None => return Err(self.error(column + i, "invalid character")),
+        }
+      }
+    }
+    Ok(())
+  }
 }
 
 #[derive(Debug, Clone)]
@@ -177,48 +565,42 @@ pub fn load_txt(
 ) -> Result<BasTextDocument, LoadTxtError> {
   let base_addr = 0x100;
   let mut guessed_emoji_styles = vec![EmojiStyle::New, EmojiStyle::Old];
-  let mut text = String::new();
-  let mut i = 0;
-  let mut line = 0;
-  let mut line_offset = 0;
   let content = content.as_ref();
+  // ASCII bytes are copied as they are. Any other character is two bytes,
+  // at least one of which is not ASCII, and decodes to one char, which takes
+  // up at most four bytes in UTF-8 (emoji may be outside the BMP). So each of
+  // them grows the text by at most two bytes.
+  let non_ascii = content.iter().filter(|&&b| b >= 0x80).count();
+  let mut text = String::with_capacity(content.len() + non_ascii * 2);
+  let mut i = 0;
   while i < content.len() {
-    if content[i] == 0xa {
-      line += 1;
-      line_offset = i + 1;
-      text.push('\n');
-      i += 1;
-    } else if content[i] >= 0x80 {
-      if content.len() <= i + 1 {
-        return Err(LoadTxtError {
-          line,
-          column: i - line_offset,
-          message: format!("invalid character"),
-        });
-      }
+    let ascii_len = ascii_prefix_len(&content[i..]);
+    if ascii_len > 0 {
+      // SAFETY: ASCII is valid UTF-8.
+      text.push_str(unsafe {
+        std::str::from_utf8_unchecked(&content[i..i + ascii_len])
+      });
+      i += ascii_len;
+      continue;
+    }
 
-      let gbcode = ((content[i] as u16) << 8) + content[i + 1] as u16;
-      if let Some(&u) = super::gb2312::GB2312_TO_UNICODE.get(&gbcode) {
-        text.push(char::from_u32(u as u32).unwrap());
-      } else {
-        guessed_emoji_styles.retain(|s| s.code_to_char(gbcode).is_some());
-        if guessed_emoji_styles.is_empty() {
-          return Err(LoadTxtError {
-            line,
-            column: i - line_offset,
-            message: format!("unable to guess emoji style"),
-          });
-        } else {
-          let u = guessed_emoji_styles[0].code_to_char(gbcode).unwrap();
-          text.push(char::from_u32(u as u32).unwrap());
-        }
-      }
+    if content.len() <= i + 1 {
+      return Err(txt_error(content, i, "invalid character"));
+    }
 
-      i += 2;
+    let gbcode = ((content[i] as u16) << 8) + content[i + 1] as u16;
+    if let Some(c) = super::gb2312::decode(gbcode) {
+      text.push(c);
     } else {
-      text.push(content[i] as char);
-      i += 1;
+      guessed_emoji_styles.retain(|s| s.code_to_char(gbcode).is_some());
+      if guessed_emoji_styles.is_empty() {
+        return Err(txt_error(content, i, "unable to guess emoji style"));
+      } else {
+        text.push(guessed_emoji_styles[0].code_to_char(gbcode).unwrap());
+      }
     }
+
+    i += 2;
   }
 
   Ok(BasTextDocument {
@@ -228,6 +610,40 @@ pub fn load_txt(
   })
 }
 
+/// Returns the length of the longest prefix of ASCII bytes, scanning eight
+/// bytes at a time.
+fn ascii_prefix_len(bytes: &[u8]) -> usize {
+  const HIGH_BITS: u64 = 0x8080_8080_8080_8080;
+  let mut len = 0;
+  for chunk in bytes.chunks_exact(8) {
+    let word = u64::from_le_bytes(chunk.try_into().unwrap());
+    let high = word & HIGH_BITS;
+    if high != 0 {
+      return len + (high.trailing_zeros() / 8) as usize;
+    }
+    len += 8;
+  }
+  len
+    + bytes[len..]
+      .iter()
+      .position(|&b| b >= 0x80)
+      .unwrap_or(bytes.len() - len)
+}
+
+/// Locates the error at `offset` only when it happens, so that lines need not
+/// be counted while decoding.
+fn txt_error(content: &[u8], offset: usize, message: &str) -> LoadTxtError {
+  let line_offset = content[..offset]
+    .iter()
+    .rposition(|&b| b == 0xa)
+    .map_or(0, |i| i + 1);
+  LoadTxtError {
+    line: content[..offset].iter().filter(|&&b| b == 0xa).count(),
+    column: offset - line_offset,
+    message: message.to_owned(),
+  }
+}
+
 #[cfg(test)]
 mod tests {
   use super::*;
@@ -264,4 +680,113 @@ mod tests {
 
     assert_debug_snapshot!(doc);
   }
+
+  #[test]
+  fn test_ascii_prefix_len() {
+    let mut bytes = vec![b'a'; 40];
+    for i in 0..40 {
+      bytes[i] = 0xb0;
+      assert_eq!(ascii_prefix_len(&bytes[..]), i);
+      assert_eq!(ascii_prefix_len(&bytes[..i]), i);
+      bytes[i] = b'a';
+    }
+    assert_eq!(ascii_prefix_len(&bytes), 40);
+  }
+
+  #[test]
+  fn test_load_txt_mixed() {
+    let doc = load_txt(b"10 PRINT \"\xb0\xa1\"\n20 END\xb0\xa1").unwrap();
+    assert_eq!(doc.text, "10 PRINT \"啊\"\n20 END啊");
+  }
+
+  #[test]
+  fn test_load_txt_error() {
+    let err = load_txt(b"10 PRINT\n20 ?\xb0\xa1\xb0").err().unwrap();
+    assert_eq!((err.line, err.column), (1, 6));
+    assert_eq!(err.message, "invalid character");
+  }
+
+  #[test]
+  fn test_decode_bas_stream() {
+    let bytes =
+      std::fs::read(std::env::current_dir().unwrap().join("data/鹿逐中原.bas"))
+        .unwrap();
+    let expected = load_bas(&bytes).unwrap().text;
+
+    let reader = std::io::BufReader::with_capacity(7, &bytes[..]);
+    let mut decoder = BasDecoder::new(reader);
+    let mut line = String::new();
+    let mut text = String::new();
+    while decoder.next_line(&mut line).unwrap() {
+      text += &line;
+      text.push('\n');
+      line.clear();
+    }
+    assert_eq!(text.trim_end(), expected);
+    assert!(!decoder.next_line(&mut line).unwrap());
+    assert_eq!(line, "");
+  }
+
+  #[test]
+  fn test_load_bas_error() {
+    let err = load_bas(b"\x00\x01\x10\x0a\x00\x80\x40").err().unwrap();
+    assert_eq!((err.offset, &err.message[..]), (7, "unexpected EOF"));
+    let err = load_bas(b"\x00\x01\x10\x0a\x00\x49\x01").err().unwrap();
+    assert_eq!(err.offset, 7);
+    let err = load_bas(b"\x00\x01\x10\x0a\x00\x49\x00\x01").err().unwrap();
+    assert_eq!((err.offset, &err.message[..]), (8, "unexpected EOF"));
+    let err = load_bas(b"\x00\x01\x10\x0a\x00\x7f\xff\x00\x00\x00")
+      .err()
+      .unwrap();
+    assert_eq!(
+      (err.offset, &err.message[..]),
+      (6, "unrecognized bytecode 0xff")
+    );
+  }
+
+  #[test]
+  fn test_save_bas() {
+    let bytes =
+      std::fs::read(std::env::current_dir().unwrap().join("data/鹿逐中原.bas"))
+        .unwrap();
+    let text = load_bas(&bytes).unwrap().text;
+
+    // Spaces before keywords are not kept if `load_bas` inserts them anyway.
+    let saved = save_bas(&text, 0x2000).unwrap();
+    assert_eq!(load_bas(&saved).unwrap().text, text);
+    assert!(saved.len() < bytes.len());
+    assert_eq!(&saved[..3], &bytes[..3]);
+    assert_eq!(save_bas(&load_bas(&saved).unwrap().text, 0x2000), Ok(saved));
+    assert_eq!(bas_size(&text), Ok(6320));
+  }
+
+  #[test]
+  fn test_save_bas_spaces() {
+    let text = "10 PRINT  A :IF A THEN 10\n\n20 rem PRINT  \"啊\"\n\
+                30 DATA A,\"B:C\",D:GOTO 10";
+    let saved = save_bas(text, 0x2000).unwrap();
+    assert_eq!(
+      saved,
+      b"\x00\x10\x20\x0a\x00\x98 A :\x8fA\xc410\x00\
+        \x22\x20\x14\x00\x93PRINT  \"\x1f\xb0\xa1\"\x00\
+        \x35\x20\x1e\x00\x83A,\"B:C\",D:\x8d10\x00\x00\x00"
+    );
+    assert_eq!(
+      load_bas(&saved).unwrap().text,
+      "10 PRINT  A :IF A THEN 10\n20 REM PRINT  \"啊\"\n\
+       30 DATA A,\"B:C\",D:GOTO 10"
+    );
+    assert_eq!(bas_size(text), Ok(saved.len()));
+  }
+
+  #[test]
+  fn test_save_bas_error() {
+    let err = save_bas("10 PRINT 1\n PRINT 2", 0x2000).err().unwrap();
+    assert_eq!((err.line, err.column), (1, 0));
+    assert_eq!(err.message, "missing line number");
+    let err = save_bas("10 PRINT \"😀\"", 0x2000).err().unwrap();
+    assert_eq!((err.line, err.column), (0, 10));
+    let err = save_bas("10 A=1", 0xfff8).err().unwrap();
+    assert_eq!(err.message, "program too large");
+  }
 }
@@ -12,3 +12,4 @@ pub mod diagnostic;
 pub mod parser;
 pub mod util;
 pub mod document;
+pub mod vm;
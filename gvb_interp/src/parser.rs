@@ -1,32 +1,232 @@
-use self::symbol::{Nonterminal, Symbol, SymbolSet};
+use self::symbol::{Nonterminal, Symbol, SymbolSet, SymbolSetBackup};
 use crate::ast::{
   BinaryOpKind, Datum, Eol, Expr, ExprId, ExprKind, FieldSpec, FileMode,
-  InputSource, Keyword, Label, NodeBuilder, NonEmptyVec, ParseLabelError,
-  PrintElement, Program, ProgramLine, Punc, Range, Stmt, StmtId, StmtKind,
-  SysFuncKind, TokenKind, UnaryOpKind, WriteElement,
+  InputSource, Keyword, Label, LabelIndex, NodeBuilder, NodeSpan, NodeStore,
+  NonEmptyVec, ParseLabelError, PrintElement, Program, ProgramLine, Punc,
+  Range, Stmt, StmtId, StmtKind, SysFuncKind, TokenKind, UnaryOpKind,
+  WriteElement,
 };
-use crate::diagnostic::Diagnostic;
-use id_arena::Arena;
+use crate::diagnostic::{Diagnostic, DiagnosticKind};
 use smallvec::{smallvec, Array, SmallVec};
-use std::fmt::Write;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::OnceLock;
+use std::thread;
 
+pub mod semantic;
 pub mod symbol;
 
 pub fn parse(input: &str) -> Program {
-  let mut line_start = 0;
   let mut lines = vec![];
+  let mut nodes = NodeStore::new();
+  parse_lines(input, &mut nodes, &mut lines);
+  let labels = LabelIndex::new(&lines);
+  Program {
+    lines,
+    nodes,
+    labels,
+  }
+}
+
+fn parse_lines(
+  input: &str,
+  nodes: &mut NodeStore,
+  lines: &mut Vec<ProgramLine>,
+) {
+  let mut line_start = 0;
   while let Some(eol) = input[line_start..].find('\n') {
-    lines.push(parse_line(&input[line_start..line_start + eol + 1]).0);
+    lines.push(parse_line_fast(
+      &input[line_start..line_start + eol + 1],
+      nodes,
+    ));
     line_start += eol + 1;
   }
   if line_start < input.len() {
-    lines.push(parse_line(&input[line_start..]).0);
+    lines.push(parse_line_fast(&input[line_start..], nodes));
+  }
+}
+
+/// Parses `input` like `parse`, but the lines are split into chunks parsed on
+/// up to `threads` threads. The result is identical to that of `parse`.
+pub fn parse_parallel(input: &str, threads: usize) -> Program {
+  parse_batch(&[input], threads).pop().unwrap()
+}
+
+/// Parses each of `inputs` like `parse`. The chunks of all inputs share up to
+/// `threads` threads. The programs are returned in the order of `inputs`.
+pub fn parse_batch(inputs: &[&str], threads: usize) -> Vec<Program> {
+  parse_chunked(inputs, threads, PARALLEL_CHUNK_SIZE)
+}
+
+/// Approximate number of bytes of source parsed by a single job.
+const PARALLEL_CHUNK_SIZE: usize = 32 * 1024;
+
+fn parse_chunked(
+  inputs: &[&str],
+  threads: usize,
+  chunk_size: usize,
+) -> Vec<Program> {
+  let mut jobs = vec![];
+  for (i, input) in inputs.iter().enumerate() {
+    let bytes = input.as_bytes();
+    let mut start = 0;
+    while start < bytes.len() {
+      let end = (start + chunk_size).min(bytes.len()) - 1;
+      let end = bytes[end..]
+        .iter()
+        .position(|&b| b == b'\n')
+        .map_or(bytes.len(), |eol| end + eol + 1);
+      jobs.push((i, &input[start..end]));
+      start = end;
+    }
+  }
+
+  let next_job = AtomicUsize::new(0);
+  let mut results = Vec::with_capacity(jobs.len());
+  results.resize_with(jobs.len(), || None);
+  thread::scope(|scope| {
+    let workers = (0..threads.max(1).min(jobs.len()))
+      .map(|_| {
+        scope.spawn(|| {
+          let mut parsed = vec![];
+          loop {
+            let job = next_job.fetch_add(1, Ordering::Relaxed);
+            if job >= jobs.len() {
+              break parsed;
+            }
+            let mut lines = vec![];
+            let mut nodes = NodeStore::new();
+            parse_lines(jobs[job].1, &mut nodes, &mut lines);
+            parsed.push((job, lines, nodes));
+          }
+        })
+      })
+      .collect::<Vec<_>>();
+    for worker in workers {
+      for (job, lines, nodes) in worker.join().unwrap() {
+        results[job] = Some((lines, nodes));
+      }
+    }
+  });
+
+  let mut programs = inputs
+    .iter()
+    .map(|_| Program::default())
+    .collect::<Vec<_>>();
+  for ((i, _), result) in jobs.iter().zip(results) {
+    let (lines, nodes) = result.unwrap();
+    let program = &mut programs[*i];
+    let len = program.lines.len();
+    program.splice_lines(len..len, lines, nodes);
+  }
+  programs
+}
+
+/// A replacement of a range of the source text.
+#[derive(Debug, Clone)]
+pub struct Edit<'a> {
+  /// The replaced range, in the text before the edit.
+  pub range: Range,
+  /// The replacement text.
+  pub text: &'a str,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Reparsed {
+  /// Indices of the reparsed lines in the updated program, in ascending order.
+  pub changed_lines: Vec<usize>,
+  /// Number of lines of the old program replaced by `changed_lines`.
+  pub removed_lines: usize,
+}
+
+/// Updates `program` after `edit` is applied to its source text, reparsing
+/// only the lines touched by the edit. `new_text` is the whole text after the
+/// edit.
+///
+/// Lines after the edited ones are reused as is, since `ProgramLine` only
+/// stores the length of its source, not the offset, and node ids are relative
+/// to the line.
+pub fn reparse(program: &mut Program, new_text: &str, edit: &Edit) -> Reparsed {
+  let old_text_len = new_text.len() + edit.range.len() - edit.text.len();
+  let first = find_line(program, edit.range.start);
+  let last = find_line(program, edit.range.end);
+
+  let region_start = first.map_or(old_text_len, |(_, start)| start);
+  let old_region_end = last.map_or(old_text_len, |(i, start)| {
+    start + program.lines[i].source_len
+  });
+  let new_region_end = old_region_end + edit.text.len() - edit.range.len();
+
+  let first = first.map_or(program.lines.len(), |(i, _)| i);
+  let last = last.map_or(program.lines.len(), |(i, _)| i + 1);
+
+  let mut lines = vec![];
+  let mut nodes = NodeStore::new();
+  parse_lines(
+    &new_text[region_start..new_region_end],
+    &mut nodes,
+    &mut lines,
+  );
+  let changed_lines = (first..first + lines.len()).collect();
+  program.splice_lines(first..last, lines, nodes);
+
+  Reparsed {
+    changed_lines,
+    removed_lines: last - first,
+  }
+}
+
+/// Returns the index and starting offset of the line containing `offset`.
+/// The end of the last line is considered part of it if it has no newline.
+fn find_line(program: &Program, offset: usize) -> Option<(usize, usize)> {
+  let mut start = 0;
+  for (i, line) in program.lines.iter().enumerate() {
+    let end = start + line.source_len;
+    if offset < end || offset == end && matches!(line.eol, Eol::None) {
+      return Some((i, start));
+    }
+    start = end;
   }
-  Program { lines }
+  None
+}
+
+/// `line_with_eol` may contain newline. The nodes of the line are appended to
+/// `nodes`.
+pub fn parse_line(
+  line_with_eol: &str,
+  nodes: &mut NodeStore,
+) -> (ProgramLine, Option<SymbolSet>) {
+  let (line, expected_symbols_at_eof, _) =
+    parse_line_with(line_with_eol, nodes, true);
+  (line, expected_symbols_at_eof)
+}
+
+/// Parses a line like `parse_line`, but skips the bookkeeping of expected
+/// symbols unless there is a syntax error whose message lists them, in which
+/// case the line is parsed again with it.
+fn parse_line_fast(line_with_eol: &str, nodes: &mut NodeStore) -> ProgramLine {
+  let num_stmts = nodes.stmts.len();
+  let num_exprs = nodes.exprs.len();
+  let num_diags = nodes.diagnostics.len();
+  let (line, _, needs_symbols) = parse_line_with(line_with_eol, nodes, false);
+  if !needs_symbols {
+    return line;
+  }
+  nodes.stmts.truncate(num_stmts);
+  nodes.exprs.truncate(num_exprs);
+  nodes.diagnostics.truncate(num_diags);
+  parse_line(line_with_eol, nodes).0
+}
+
+/// Returns the symbols expected at the end of a line, for completion.
+pub fn expected_symbols_at_eof(line_with_eol: &str) -> Option<SymbolSet> {
+  parse_line(line_with_eol, &mut NodeStore::new()).1
 }
 
-/// `line_with_eol` may contain newline.
-pub fn parse_line(line_with_eol: &str) -> (ProgramLine, Option<SymbolSet>) {
+fn parse_line_with(
+  line_with_eol: &str,
+  nodes: &mut NodeStore,
+  track_symbols: bool,
+) -> (ProgramLine, Option<SymbolSet>, bool) {
   let bytes = line_with_eol.as_bytes();
   let line;
   let eol;
@@ -43,11 +243,13 @@ pub fn parse_line(line_with_eol: &str) -> (ProgramLine, Option<SymbolSet>) {
     line = line_with_eol;
   }
 
-  let node_builder = ArenaNodeBuilder {
-    stmt_arena: Arena::new(),
-    expr_arena: Arena::new(),
+  let node_builder = StoreNodeBuilder {
+    stmt_start: nodes.stmts.len(),
+    expr_start: nodes.exprs.len(),
+    diag_start: nodes.diagnostics.len(),
+    nodes,
   };
-  let mut parser = LineParser::new(line, node_builder);
+  let mut parser = LineParser::new(line, node_builder, track_symbols);
 
   let mut label = None;
   if !matches!(line.as_bytes().first(), Some(b' ')) {
@@ -73,34 +275,90 @@ pub fn parse_line(line_with_eol: &str) -> (ProgramLine, Option<SymbolSet>) {
 
   let stmts = parser.parse_stmts(false);
   if stmts.is_empty() {
-    parser.add_error(Range::new(0, line_with_eol.len()), "缺少语句");
+    parser.add_error(
+      Range::new(0, line_with_eol.len()),
+      DiagnosticKind::MissingStmt,
+    );
   }
 
   let expected_symbols_at_eof = parser.expected_symbols_at_eof.take();
+  let needs_symbols = parser.needs_symbols;
   let line = parser.into_line(line_with_eol, eol, label, stmts);
-  (line, expected_symbols_at_eof)
+  (line, expected_symbols_at_eof, needs_symbols)
 }
 
-struct ArenaNodeBuilder {
-  stmt_arena: Arena<Stmt>,
-  expr_arena: Arena<Expr>,
+/// Appends the nodes of a line to a `NodeStore`.
+struct StoreNodeBuilder<'a> {
+  nodes: &'a mut NodeStore,
+  stmt_start: usize,
+  expr_start: usize,
+  diag_start: usize,
 }
 
-impl NodeBuilder for ArenaNodeBuilder {
+impl<'a> NodeBuilder for StoreNodeBuilder<'a> {
   fn new_stmt(&mut self, stmt: Stmt) -> StmtId {
-    self.stmt_arena.alloc(stmt)
+    let id = StmtId::new(self.nodes.stmts.len() - self.stmt_start);
+    self.nodes.stmts.push(stmt);
+    id
   }
 
   fn new_expr(&mut self, expr: Expr) -> ExprId {
-    self.expr_arena.alloc(expr)
+    let id = ExprId::new(self.nodes.exprs.len() - self.expr_start);
+    self.nodes.exprs.push(expr);
+    id
   }
 
   fn stmt_node(&self, stmt: StmtId) -> &Stmt {
-    &self.stmt_arena[stmt]
+    &self.nodes.stmts[self.stmt_start..][stmt]
   }
 
   fn expr_node(&self, expr: ExprId) -> &Expr {
-    &self.expr_arena[expr]
+    &self.nodes.exprs[self.expr_start..][expr]
+  }
+
+  fn new_diagnostic(&mut self, diag: Diagnostic) {
+    self.nodes.diagnostics.push(diag);
+  }
+}
+
+/// Returns the end of the data of a DATA statement starting at `start`.
+pub(crate) fn data_end(line: &[u8], start: usize) -> usize {
+  let mut quoted = false;
+  for (i, &b) in line[start..].iter().enumerate() {
+    match b {
+      b'"' => quoted = !quoted,
+      b':' if !quoted => return start + i,
+      _ => {}
+    }
+  }
+  line.len()
+}
+
+/// Reads the tokens of a line one at a time, without parsing it.
+pub(crate) struct Lexer<'a> {
+  line: &'a str,
+  parser: LineParser<'a, DummyNodeBuilder>,
+}
+
+impl<'a> Lexer<'a> {
+  pub(crate) fn new(line: &'a str) -> Self {
+    Self {
+      line,
+      parser: LineParser::new(line, DummyNodeBuilder, false),
+    }
+  }
+
+  /// Reads the next token. Numbers are read as labels if `read_label` is
+  /// true. Illegal characters are skipped like spaces.
+  pub(crate) fn next_token(&mut self, read_label: bool) -> (Range, TokenKind) {
+    self.parser.read_token(read_label);
+    self.parser.token.clone()
+  }
+
+  /// Continues reading at `offset` of the line.
+  pub(crate) fn seek(&mut self, offset: usize) {
+    self.parser.offset = offset;
+    self.parser.input = &self.line[offset..];
   }
 }
 
@@ -111,8 +369,12 @@ struct LineParser<'a, T: NodeBuilder> {
   label_value: Option<Result<Label, ParseLabelError>>,
   last_token_end: usize,
   node_builder: T,
-  diagnostics: Vec<Diagnostic>,
   expected_symbols_at_eof: Option<SymbolSet>,
+  /// Whether `first_symbols` and `follow_symbols` are kept up to date. They
+  /// are only needed for syntax errors and completion.
+  track_symbols: bool,
+  /// Set if the symbols are needed but not tracked.
+  needs_symbols: bool,
   first_symbols: SymbolSet,
   /// Only contains terminals.
   follow_symbols: SymbolSet,
@@ -155,7 +417,7 @@ macro_rules! extend_symbol {
 
 macro_rules! setup_first {
   ($self:ident : $($elem:tt)*) => {
-    {
+    if $self.track_symbols {
       $self.first_symbols = SymbolSet::new();
       $(extend_symbol!($self.first_symbols, $elem));*
     }
@@ -164,7 +426,7 @@ macro_rules! setup_first {
 
 macro_rules! setup_follow {
   ($self:ident, $old_follow:ident : $($elem:tt)*) => {
-    {
+    if $self.track_symbols {
       $old_follow.set(&mut $self.follow_symbols);
       $(extend_symbol!($self.follow_symbols, $elem));*
     }
@@ -172,7 +434,7 @@ macro_rules! setup_follow {
 }
 
 impl<'a, T: NodeBuilder> LineParser<'a, T> {
-  fn new(input: &'a str, node_builder: T) -> Self {
+  fn new(input: &'a str, node_builder: T, track_symbols: bool) -> Self {
     Self {
       offset: 0,
       input,
@@ -180,21 +442,40 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       label_value: None,
       last_token_end: 0,
       node_builder,
-      diagnostics: vec![],
       expected_symbols_at_eof: None,
+      track_symbols,
+      needs_symbols: false,
       first_symbols: SymbolSet::new(),
       follow_symbols: SymbolSet::new(),
     }
   }
 
-  fn add_error(&mut self, range: Range, message: impl ToString) {
-    self.diagnostics.push(Diagnostic::new_error(range, message));
+  fn backup_first_symbols(&self) -> SymbolSetBackup {
+    if self.track_symbols {
+      self.first_symbols.backup()
+    } else {
+      SymbolSetBackup::none()
+    }
+  }
+
+  fn backup_follow_symbols(&self) -> SymbolSetBackup {
+    if self.track_symbols {
+      self.follow_symbols.backup()
+    } else {
+      SymbolSetBackup::none()
+    }
+  }
+
+  fn add_error(&mut self, range: Range, kind: DiagnosticKind) {
+    self
+      .node_builder
+      .new_diagnostic(Diagnostic::new_error(range, kind));
   }
 
-  fn add_warning(&mut self, range: Range, message: impl ToString) {
+  fn add_warning(&mut self, range: Range, kind: DiagnosticKind) {
     self
-      .diagnostics
-      .push(Diagnostic::new_warning(range, message));
+      .node_builder
+      .new_diagnostic(Diagnostic::new_warning(range, kind));
   }
 
   fn advance(&mut self, count: usize) {
@@ -205,10 +486,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   fn report_label_error(&mut self, err: ParseLabelError, range: Range) {
     match err {
       ParseLabelError::NotALabel => {
-        self.add_error(range, "缺少行号");
+        self.add_error(range, DiagnosticKind::MissingLabel);
       }
       ParseLabelError::OutOfBound => {
-        self.add_error(range, "行号必须在0~9999之间");
+        self.add_error(range, DiagnosticKind::LabelOutOfBound);
       }
     }
   }
@@ -291,12 +572,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
             sigil = true;
           }
 
-          let str = self.input[..i].to_ascii_lowercase();
+          let name = TokenKind::from_name(&self.input.as_bytes()[..i]);
           self.advance(i);
-          if let Ok(kw) = str.parse::<Keyword>() {
-            return self.set_token(start, TokenKind::Keyword(kw));
-          } else if let Ok(f) = str.parse::<SysFuncKind>() {
-            return self.set_token(start, TokenKind::SysFunc(f));
+          if let Some(kind) = name {
+            return self.set_token(start, kind);
           } else if sigil {
             return self.set_token(start, TokenKind::Ident);
           }
@@ -317,10 +596,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
               Some(b'%' | b'$') => {
                 i += 1;
                 if in_seg {
-                  let str = self.input[seg_start..i].to_ascii_lowercase();
-                  if str.parse::<Keyword>().is_ok()
-                    || str.parse::<SysFuncKind>().is_ok()
-                  {
+                  let seg = &self.input.as_bytes()[seg_start..i];
+                  if TokenKind::from_name(seg).is_some() {
                     i = seg_start;
                   }
                 }
@@ -329,10 +606,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
               c => {
                 if in_seg {
                   in_seg = false;
-                  let str = self.input[seg_start..i].to_ascii_lowercase();
-                  if str.parse::<Keyword>().is_ok()
-                    || str.parse::<SysFuncKind>().is_ok()
-                  {
+                  let seg = &self.input.as_bytes()[seg_start..i];
+                  if TokenKind::from_name(seg).is_some() {
                     i = seg_start;
                     break;
                   }
@@ -359,11 +634,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           self.advance(c.len_utf8());
           self.add_error(
             Range::new(start, self.offset),
-            if (c as u32) < 0x10000 {
-              format!("非法字符：U+{:04X}", c as u32)
-            } else {
-              format!("非法字符：U+{:06X}", c as u32)
-            },
+            DiagnosticKind::IllegalChar(c),
           );
           self.read_token(read_label);
           continue;
@@ -410,39 +681,27 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn report_mismatch_token_error(&mut self) {
-    let mut msg = "语法错误。期望是 ".to_owned();
-    let symbols = self.first_symbols.iter().collect::<Vec<_>>();
-    let len = symbols.len();
-    for (i, sym) in symbols.into_iter().enumerate() {
-      if i != 0 {
-        if i == len - 1 {
-          msg += " 或 "
-        } else {
-          msg += "，";
-        }
-      }
-      match sym {
-        Symbol::Term(token) => match token {
-          TokenKind::Ident => msg += "标识符",
-          TokenKind::Label => msg += "行号",
-          TokenKind::Float => msg += "实数",
-          TokenKind::String => msg += "字符串",
-          TokenKind::Punc(p) => write!(&mut msg, "\"{:?}\"", p).unwrap(),
-          TokenKind::Keyword(p) => write!(&mut msg, "{:?}", p).unwrap(),
-          TokenKind::SysFunc(p) => write!(&mut msg, "{:?}", p).unwrap(),
-          TokenKind::Eof => msg += "行尾",
-        },
-        Symbol::Nonterm(n) => match n {
-          Nonterminal::Expr => msg += "表达式",
-          Nonterminal::Stmt => msg += "语句",
-          Nonterminal::Array => msg += "数组",
-        },
-      }
+    if !self.track_symbols {
+      self.needs_symbols = true;
+      return;
     }
-    self.add_error(self.token.0.clone(), msg);
+
+    self.add_error(
+      self.token.0.clone(),
+      DiagnosticKind::UnexpectedToken(self.first_symbols.clone()),
+    );
   }
 
   fn recover(&mut self, read_label: bool) {
+    if !self.track_symbols {
+      // The line will be parsed again, so the rest need not be parsed.
+      self.needs_symbols = true;
+      while self.token.1 != TokenKind::Eof {
+        self.read_token(read_label);
+      }
+      return;
+    }
+
     if self.token.1 == TokenKind::Eof {
       self.set_expected_symbols_at_eof();
     }
@@ -455,14 +714,14 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn set_expected_symbols_at_eof(&mut self) {
-    if self.expected_symbols_at_eof.is_none() {
+    if self.track_symbols && self.expected_symbols_at_eof.is_none() {
       self.expected_symbols_at_eof = Some(self.first_symbols.dup());
     }
   }
 
   fn parse_stmts(&mut self, in_if_branch: bool) -> SmallVec<[StmtId; 1]> {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     if in_if_branch {
       setup_first! { self : (nt Stmt) (punc Colon) (label) }
@@ -477,7 +736,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           if in_if_branch {
             self.add_error(
               self.token.0.clone(),
-              "IF 语句的分支中不能出现多余的冒号",
+              DiagnosticKind::ExtraColonInIfBranch,
             );
           } else {
             stmts.push(self.node_builder.new_stmt(Stmt {
@@ -495,7 +754,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           if in_if_branch {
             break;
           } else {
-            self.add_error(self.token.0.clone(), "ELSE 不能出现在 IF 语句之外");
+            self.add_error(self.token.0.clone(), DiagnosticKind::ElseOutsideIf);
             self.read_token(in_if_branch);
           }
         }
@@ -516,15 +775,15 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
               break;
             } else {
               self
-                .add_error(self.token.0.clone(), "ELSE 不能出现在 IF 语句之外");
+                .add_error(self.token.0.clone(), DiagnosticKind::ElseOutsideIf);
               self.read_token(in_if_branch);
             }
           } else if !stmt_end {
             self.add_error(
               self.node_builder.stmt_node(stmt).range.clone(),
-              "语句结尾必须是行尾或跟上冒号",
+              DiagnosticKind::StmtNotEnded,
             );
-          } else if in_if_branch {
+          } else if in_if_branch && self.track_symbols {
             extend_symbol!(self.first_symbols, (kw Else));
           }
         }
@@ -649,7 +908,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_unary_cmd(&mut self, ctor: fn(ExprId) -> StmtKind) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
 
     let start = self.token.0.start;
     self.read_token(false);
@@ -664,7 +923,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_close_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -711,7 +970,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
         Some(b':') | None => break,
         Some(b',') => self.advance(1),
         _ => {
-          self.add_error(Range::new(self.offset, self.offset + 1), "缺少逗号");
+          self.add_error(
+            Range::new(self.offset, self.offset + 1),
+            DiagnosticKind::MissingComma,
+          );
         }
       }
     }
@@ -728,15 +990,15 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
     let def_range = self.token.0.clone();
     self.read_token(false);
 
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     setup_first! { self : (kw Fn) }
     setup_follow! { self, old_follow : (id) (punc LParen Eq) }
     if self
       .match_token(TokenKind::Keyword(Keyword::Fn), false, false)
       .is_err()
     {
-      self.add_error(def_range.clone(), "DEF 之后缺少 FN 关键字");
+      self.add_error(def_range.clone(), DiagnosticKind::MissingFnAfterDef);
     }
 
     setup_first! { self : (id) }
@@ -745,7 +1007,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
     match self.match_token(TokenKind::Ident, false, false) {
       Ok(range) => name_range = Some(range),
       Err(()) => {
-        self.add_error(def_range.clone(), "DEF 语句缺少函数名称");
+        self.add_error(def_range.clone(), DiagnosticKind::MissingDefFnName);
         name_range = None;
       }
     }
@@ -757,7 +1019,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       .is_err()
     {
       if let Some(name_range) = &name_range {
-        self.add_error(name_range.clone(), "函数名称之后缺少左括号");
+        self.add_error(
+          name_range.clone(),
+          DiagnosticKind::MissingLParenAfterFnName,
+        );
       }
     }
 
@@ -768,7 +1033,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       Ok(range) => param_range = Some(range),
       Err(()) => {
         if let Some(name_range) = &name_range {
-          self.add_error(name_range.clone(), "缺少函数参数变量");
+          self.add_error(name_range.clone(), DiagnosticKind::MissingFnParam);
         }
         param_range = None;
       }
@@ -781,7 +1046,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       .is_err()
     {
       if let Some(param_range) = &param_range {
-        self.add_error(param_range.clone(), "函数参数之后缺少右括号");
+        self.add_error(
+          param_range.clone(),
+          DiagnosticKind::MissingRParenAfterFnParam,
+        );
       }
     }
 
@@ -791,7 +1059,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       .match_token(TokenKind::Punc(Punc::Eq), false, false)
       .is_err()
     {
-      self.add_error(def_range.clone(), "DEF 语句缺少等号");
+      self.add_error(def_range.clone(), DiagnosticKind::MissingDefEq);
     }
 
     setup_first! { self : }
@@ -819,8 +1087,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_field_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     let start = self.token.0.start;
     self.read_token(false);
@@ -856,8 +1124,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_field_spec(&mut self) -> FieldSpec {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
 
     setup_first! { self : }
@@ -892,12 +1160,12 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
         return;
       }
     }
-    self.add_error(Range::new(start, end), "语法错误。期望是AS");
+    self.add_error(Range::new(start, end), DiagnosticKind::MissingAs);
   }
 
   fn parse_for_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let for_range = self.token.0.clone();
     self.read_token(false);
 
@@ -907,7 +1175,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
     match self.match_token(TokenKind::Ident, false, false) {
       Ok(range) => id_range = Some(range),
       Err(()) => {
-        self.add_error(for_range.clone(), "FOR 之后缺少标识符");
+        self.add_error(for_range.clone(), DiagnosticKind::MissingForVar);
         id_range = None;
       }
     }
@@ -919,7 +1187,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       .is_err()
     {
       if let Some(id_range) = &id_range {
-        self.add_error(id_range.clone(), "标识符之后缺少等号");
+        self.add_error(id_range.clone(), DiagnosticKind::MissingEqAfterIdent);
       }
     }
 
@@ -936,7 +1204,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       let from = self.node_builder.expr_node(from);
       if !matches!(&from.kind, ExprKind::Error) {
         let range = from.range.clone();
-        self.add_error(range, "初始化表达式之后缺少 TO");
+        self.add_error(range, DiagnosticKind::MissingTo);
       }
     }
 
@@ -986,8 +1254,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_get_put_stmt(&mut self, is_put: bool) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     let start = self.token.0.start;
     self.read_token(false);
@@ -1009,7 +1277,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       let filenum = self.node_builder.expr_node(filenum);
       if !matches!(&filenum.kind, ExprKind::Error) {
         let range = filenum.range.clone();
-        self.add_error(range, "文件号表达式之后缺少逗号");
+        self.add_error(range, DiagnosticKind::MissingCommaAfterFileNum);
       }
     }
 
@@ -1030,8 +1298,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_if_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1055,7 +1323,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       let cond = self.node_builder.expr_node(cond);
       if !matches!(&cond.kind, ExprKind::Error) {
         let range = cond.range.clone();
-        self.add_error(range, "条件表达式之后缺少 THEN 或 GOTO");
+        self.add_error(range, DiagnosticKind::MissingThen);
       }
       then = None;
     }
@@ -1065,7 +1333,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
     let conseq = self.parse_stmts(true);
     if conseq.is_empty() {
       if let Some((range, kw)) = then {
-        self.add_error(range, format!("{:?} 之后缺少语句", kw))
+        self.add_error(range, DiagnosticKind::MissingStmtAfter(kw))
       }
     }
 
@@ -1078,7 +1346,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       setup_follow! { self, old_follow : }
       let stmts = self.parse_stmts(true);
       if stmts.is_empty() {
-        self.add_error(else_range, "ELSE 之后缺少语句")
+        self.add_error(
+          else_range,
+          DiagnosticKind::MissingStmtAfter(Keyword::Else),
+        )
       }
       alt = Some(stmts);
     }
@@ -1094,8 +1365,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_input_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     let start = self.token.0.start;
     self.read_token(false);
@@ -1111,7 +1382,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           .match_token(TokenKind::Punc(Punc::Semicolon), false, false)
           .is_err()
         {
-          self.add_error(prompt_range.clone(), "INPUT 字符串之后缺少分号");
+          self.add_error(
+            prompt_range.clone(),
+            DiagnosticKind::MissingSemicolonAfterPrompt,
+          );
         }
         source = InputSource::Keyboard(Some(prompt_range));
       }
@@ -1131,7 +1405,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           let filenum = self.node_builder.expr_node(filenum);
           if !matches!(&filenum.kind, ExprKind::Error) {
             let range = filenum.range.clone();
-            self.add_error(range, "文件号表达式之后缺少逗号");
+            self.add_error(range, DiagnosticKind::MissingCommaAfterFileNum);
           }
         }
         source = InputSource::File(filenum);
@@ -1152,8 +1426,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_lvalue_list(&mut self) -> NonEmptyVec<[ExprId; 1]> {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     let mut vars = NonEmptyVec::<[ExprId; 1]>::new();
     setup_first! { self : }
@@ -1170,8 +1444,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_assign_stmt(&mut self, has_let: bool) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     let start = self.token.0.start;
     if has_let {
@@ -1191,7 +1465,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       let var = self.node_builder.expr_node(var);
       if !matches!(&var.kind, ExprKind::Error) {
         let range = var.range.clone();
-        self.add_error(range, "赋值语句缺少等号");
+        self.add_error(range, DiagnosticKind::MissingAssignEq);
       }
     }
 
@@ -1206,8 +1480,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_locate_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1240,8 +1514,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_set_stmt(&mut self, ctor: fn(ExprId, ExprId) -> StmtKind) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1259,10 +1533,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       let range = var.range.clone();
       match &var.kind {
         ExprKind::Ident => {
-          self.add_error(range, "变量之后缺少等号");
+          self.add_error(range, DiagnosticKind::MissingEqAfterVar);
         }
         ExprKind::Index { .. } => {
-          self.add_error(range, "数组之后缺少等号");
+          self.add_error(range, DiagnosticKind::MissingEqAfterArray);
         }
         _ => {}
       }
@@ -1279,7 +1553,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_next_stmt(&mut self) -> StmtId {
-    let old_follow = self.follow_symbols.backup();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1293,7 +1567,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           Ok(range) => var_range = Some(range),
           Err(()) => {
             if let Some(comma_range) = comma_range.take() {
-              self.add_error(comma_range, "逗号之后缺少标识符");
+              self
+                .add_error(comma_range, DiagnosticKind::MissingIdentAfterComma);
             }
             var_range = None;
           }
@@ -1316,8 +1591,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_on_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1388,8 +1663,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_open_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let open_range = self.token.0.clone();
     self.read_token(false);
 
@@ -1422,10 +1697,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           }
         }
       }
-      self.add_error(
-        open_range.clone(),
-        "OPEN 语句缺少文件模式：INPUT，OUTPUT，APPEND 或 RANDOM",
-      );
+      self.add_error(open_range.clone(), DiagnosticKind::MissingFileMode);
       setup_follow! { self, old_follow : (punc Hash) (id) }
       self.recover(false);
       break FileMode::Error;
@@ -1457,7 +1729,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
         .match_token(TokenKind::Punc(Punc::Eq), false, false)
         .is_err()
       {
-        self.add_error(len_range, "LEN 之后缺少等号");
+        self.add_error(len_range, DiagnosticKind::MissingEqAfterLen);
       }
 
       setup_first! { self : }
@@ -1478,8 +1750,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_poke_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1496,7 +1768,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       let addr = self.node_builder.expr_node(addr);
       if !matches!(&addr.kind, ExprKind::Error) {
         let range = addr.range.clone();
-        self.add_error(range, "地址表达式之后缺少逗号");
+        self.add_error(range, DiagnosticKind::MissingCommaAfterAddr);
       }
     }
 
@@ -1511,8 +1783,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_print_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1561,8 +1833,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_swap_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1579,8 +1851,12 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       let left = self.node_builder.expr_node(left);
       let range = left.range.clone();
       match &left.kind {
-        ExprKind::Ident => self.add_error(range, "变量之后缺少逗号"),
-        ExprKind::Index { .. } => self.add_error(range, "数组之后缺少逗号"),
+        ExprKind::Ident => {
+          self.add_error(range, DiagnosticKind::MissingCommaAfterVar)
+        }
+        ExprKind::Index { .. } => {
+          self.add_error(range, DiagnosticKind::MissingCommaAfterArray)
+        }
         _ => {}
       }
     }
@@ -1596,8 +1872,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_write_stmt(&mut self) -> StmtId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
     self.read_token(false);
 
@@ -1619,7 +1895,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           let filenum = self.node_builder.expr_node(filenum);
           if !matches!(&filenum.kind, ExprKind::Error) {
             let range = filenum.range.clone();
-            self.add_error(range, "文件号表达式之后缺少逗号");
+            self.add_error(range, DiagnosticKind::MissingCommaAfterFileNum);
           }
         }
       }
@@ -1701,10 +1977,12 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_expr(&mut self) -> ExprId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
-    extend_symbol!(self.first_symbols, (nt Expr));
+    if self.track_symbols {
+      extend_symbol!(self.first_symbols, (nt Expr));
+    }
     setup_follow! { self, old_follow :
       (punc Eq Gt Lt Plus Minus Times Slash Caret)
       (kw And Or)
@@ -1818,8 +2096,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           .new_expr(Expr::new(kind, Range::new(start, self.last_token_end)))
       }
       TokenKind::Punc(Punc::LParen) => {
-        let _first_symbols = self.first_symbols.backup();
-        let old_follow = self.follow_symbols.backup();
+        let _first_symbols = self.backup_first_symbols();
+        let old_follow = self.backup_follow_symbols();
         let paren_range = self.token.0.clone();
         self.read_token(false);
 
@@ -1832,14 +2110,14 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           .match_token(TokenKind::Punc(Punc::RParen), false, false)
           .is_err()
         {
-          self.add_error(paren_range, "缺少匹配的右括号");
+          self.add_error(paren_range, DiagnosticKind::UnmatchedLParen);
         }
         expr
       }
       TokenKind::Keyword(Keyword::Fn) => {
         let fn_range = self.token.0.clone();
-        let _first_symbols = self.first_symbols.backup();
-        let old_follow = self.follow_symbols.backup();
+        let _first_symbols = self.backup_first_symbols();
+        let old_follow = self.backup_follow_symbols();
         self.read_token(false);
 
         setup_first! { self : (id) }
@@ -1848,7 +2126,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
         match self.match_token(TokenKind::Ident, false, false) {
           Ok(range) => id_range = Some(range),
           Err(()) => {
-            self.add_error(fn_range.clone(), "FN 之后缺少函数名称");
+            self.add_error(
+              fn_range.clone(),
+              DiagnosticKind::MissingFnNameAfterFn,
+            );
             id_range = None;
           }
         }
@@ -1860,7 +2141,10 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           .is_err()
         {
           if let Some(id_range) = &id_range {
-            self.add_error(id_range.clone(), "函数名称之后缺少左括号");
+            self.add_error(
+              id_range.clone(),
+              DiagnosticKind::MissingLParenAfterFnName,
+            );
           }
         }
 
@@ -1877,7 +2161,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
           let arg = self.node_builder.expr_node(arg);
           if !matches!(&arg.kind, ExprKind::Error) {
             let range = arg.range.clone();
-            self.add_error(range, "缺少右括号");
+            self.add_error(range, DiagnosticKind::MissingRParen);
           }
         }
 
@@ -1896,7 +2180,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
         let mut args = NonEmptyVec::<[ExprId; 1]>::new();
         self.parse_paren_args(
           &mut args.0,
-          Some((name_range.clone(), "系统函数调用缺少左括号")),
+          Some((name_range.clone(), DiagnosticKind::MissingSysFuncLParen)),
         );
         let range = Range::new(name_range.start, self.last_token_end);
         let kind = ExprKind::SysFuncCall {
@@ -1919,12 +2203,14 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   }
 
   fn parse_lvalue(&mut self) -> ExprId {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
     let start = self.token.0.start;
 
-    extend_symbol!(self.first_symbols, (id));
-    extend_symbol!(self.first_symbols, (nt Array));
+    if self.track_symbols {
+      extend_symbol!(self.first_symbols, (id));
+      extend_symbol!(self.first_symbols, (nt Array));
+    }
     setup_follow! { self, old_follow : (punc LParen) }
     let id_range;
     match self.match_token(TokenKind::Ident, false, true) {
@@ -1962,12 +2248,12 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   fn parse_paren_args<U>(
     &mut self,
     args: &mut U,
-    missing_lparen: Option<(Range, &str)>,
+    missing_lparen: Option<(Range, DiagnosticKind)>,
   ) where
     U: Extend<ExprId>,
   {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     setup_first! { self : (punc LParen) }
     setup_follow! { self, old_follow : (punc RParen) (t Expr) }
@@ -1979,8 +2265,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
     ) {
       Ok(range) => lparen_range = Some(range),
       Err(()) => {
-        if let Some((range, msg)) = missing_lparen {
-          self.add_error(range, msg);
+        if let Some((range, kind)) = missing_lparen {
+          self.add_error(range, kind);
         }
         lparen_range = None;
       }
@@ -2004,7 +2290,7 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
       .is_err()
     {
       if let Some(lparen_range) = lparen_range {
-        self.add_error(lparen_range, "缺少匹配的右括号");
+        self.add_error(lparen_range, DiagnosticKind::UnmatchedLParen);
       }
     }
   }
@@ -2013,8 +2299,8 @@ impl<'a, T: NodeBuilder> LineParser<'a, T> {
   where
     U: Extend<ExprId>,
   {
-    let _first_symbols = self.first_symbols.backup();
-    let old_follow = self.follow_symbols.backup();
+    let _first_symbols = self.backup_first_symbols();
+    let old_follow = self.backup_follow_symbols();
 
     setup_first! { self : }
     setup_follow! { self, old_follow : (punc Comma) }
@@ -2052,7 +2338,7 @@ fn token_prec(kind: TokenKind) -> Prec {
   }
 }
 
-impl<'a> LineParser<'a, ArenaNodeBuilder> {
+impl<'a, 'b> LineParser<'a, StoreNodeBuilder<'b>> {
   fn into_line(
     self,
     line: &str,
@@ -2063,11 +2349,20 @@ impl<'a> LineParser<'a, ArenaNodeBuilder> {
     ProgramLine {
       source_len: line.len(),
       label,
-      stmt_arena: self.node_builder.stmt_arena,
-      expr_arena: self.node_builder.expr_arena,
+      nodes: NodeSpan {
+        stmt_start: self.node_builder.stmt_start,
+        stmt_len: self.node_builder.nodes.stmts.len()
+          - self.node_builder.stmt_start,
+        expr_start: self.node_builder.expr_start,
+        expr_len: self.node_builder.nodes.exprs.len()
+          - self.node_builder.expr_start,
+        diag_start: self.node_builder.diag_start,
+        diag_len: self.node_builder.nodes.diagnostics.len()
+          - self.node_builder.diag_start,
+      },
       stmts,
       eol,
-      diagnostics: self.diagnostics,
+      tokens: OnceLock::new(),
     }
   }
 }
@@ -2148,10 +2443,8 @@ pub fn read_number(input: &[u8], allow_space: bool) -> (usize, bool) {
   (i, is_nat)
 }
 
-#[cfg(test)]
 struct DummyNodeBuilder;
 
-#[cfg(test)]
 impl NodeBuilder for DummyNodeBuilder {
   fn new_expr(&mut self, _expr: Expr) -> ExprId {
     unimplemented!()
@@ -2168,6 +2461,8 @@ impl NodeBuilder for DummyNodeBuilder {
   fn expr_node(&self, _expr: ExprId) -> &Expr {
     unimplemented!()
   }
+
+  fn new_diagnostic(&mut self, _diag: Diagnostic) {}
 }
 
 #[cfg(test)]
@@ -2177,7 +2472,7 @@ mod lex_tests {
   use pretty_assertions::assert_eq;
 
   fn read_tokens(input: &str) -> Vec<(Range, TokenKind)> {
-    let mut parser = LineParser::new(input, DummyNodeBuilder);
+    let mut parser = LineParser::new(input, DummyNodeBuilder, false);
     let mut tokens = vec![];
     loop {
       parser.read_token(false);
@@ -2367,230 +2662,235 @@ mod parser_tests {
   use super::*;
   use insta::assert_snapshot;
 
+  fn print_line(line: &str) -> String {
+    let mut nodes = NodeStore::new();
+    parse_line(line, &mut nodes).0.to_string(&nodes, line)
+  }
+
   #[test]
   fn assign() {
     let line = r#"10 ab$ = 3"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn two_assign() {
     let line = r#"10 ab$=3: foo %=2+2"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn no_label() {
     let line = r#"ab$=3 :fO3 %=2-3*1  "#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn no_stmts() {
     let line = r#"10"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn blank_line() {
     let line = r#"    "#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn empty_line() {
     let line = r#""#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn colon_line() {
     let line = r#"10 :"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn nullary_cmd() {
     let line = r#"10 ::::Beep::enD:::fLAsh:::inkEy$::"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn real_world_example() {
     let line = r#"17 LOCaTe 3,2:PRinT "A";,3:locaTE 3,18-LeN(StR$(ET)):PRINT ET:DRAW 100,38"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn r#box() {
     let line = r#"10 boX 2*3,A/2,INT(INKEY$),1 : BOX 1,2,3,4,-0"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn unary_cmd() {
     let line =
       r#"10 calL  1340+A*10: CALl T%: play A b $+"DE#" :while not a(i)"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn close() {
     let line = r#"10 close # 2+1:clOSe 2+1"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn rem() {
     let line = r#"10 cls:rem machine: tc808"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn data1() {
     let line = r#"10 daTA   ,," : A,",12,3  : Data A  ,A B  C,  , "#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn data2() {
     let line = r#"10 daTA   1,  2  ,  : data "aA","bB"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn def() {
     let line =
       r#"10   def Fn a b c%(x Y 3  1) = sin(X / 2) : DEF   fN  f (X)=fn F(x)"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn dim() {
     let line = r#"10 DIm  A:dIm  B$(k+1,tan(x,y)) , C, O(3*2)"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn field() {
     let line = r#"10 field # 1*2 , 3*5-1ASA b $  : fiEld 1*2 , 1  A Sx%(3) , 7.5ASA$(A,B)"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn r#for() {
     let line = r#"10 for I%=K*2 to I%*2: FoR i=0 To 1e3 sTep k"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn get_put() {
     let line = r#"10 Get # 7/2 , 2*5 : PuT 3*2,k"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn gosub_goto() {
     let line = r#"10 gosub : goto: gosub 771 : goto 21742: goto"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn r#if1() {
     let line = r#"10 If A>2 then:if not 1 goto print "a":else"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn r#if2() {
     let line = r#"10 IF 1 THEN 10:ELSE S=S+1:NEXT:IF S> =10 GOTO"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn r#if3() {
     let line = r#"10 IF K GOTO ELSE 2:13:7:"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn input() {
     let line = r#"10 inPUT # s, A$, a$(3,i) : InPuT "ENTER:";A,B:INPUT A%"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn locate() {
     let line = r#"10 locAte 1,A+2:locate A+1: locate , 2:"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn lset_rset() {
     let line = r#"10 lset A$=MID$(B$,2):rSEt  a b$(2,k*3+m) =CHr$(x)"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn next() {
     let line = r#"10 next:Next I  : NExT A,B b% , c , i"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn on() {
     let line = r#"10 ON (k+2)*b goto:on x goSub ,:on x+1 goto 10,,30,,,"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn open1() {
     let line = r#"10 opeN A$+".dat" appendA sa+1 : open b$for input as#2"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn open2() {
     let line = r#"10 OPEN file$ randomas3:OPen f$output as 1"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn open3() {
     let line = r#"10 OPEN P$FOR inputas1 len=k*2"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn poke() {
     let line = r#"10 poKE a(i),30+I*2"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn print() {
     let line =
       r#"10 print 10 ; , "k"+2; spc(3+k) tab(i) 3 +2fn f(4) ,:print,:print"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn read() {
     let line = r#"10 reaD a$ : READ b$(i,j),c,d%"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn swap() {
     let line = r#"10 SwaP a$(i),b c"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
   fn write() {
     let line =
       r#"10 write a$(i+j*10),b fn f(x):wriTE #3-a,asc(a)x+2 x*6 , o$,"#;
-    assert_snapshot!(parse_line(line).0.to_string(line));
+    assert_snapshot!(print_line(line));
   }
 
   #[test]
@@ -2605,52 +2905,72 @@ mod parser_tests {
     use super::*;
     use insta::assert_debug_snapshot;
 
+    #[test]
+    fn untracked_symbols() {
+      let text = "10 if 3 > (chr$(( k),2 then 10 else 20\n\
+                  20 print a;b:goto\n30 let a=\n40 for i=1 to 10:next i\n\
+                  50 on x gosub 10,\n60 print chr$(\n";
+      let program = parse(text);
+      let mut start = 0;
+      for line in &program.lines {
+        let source = &text[start..start + line.source_len];
+        start += line.source_len;
+        let mut nodes = NodeStore::new();
+        let (expected, symbols) = parse_line(source, &mut nodes);
+        assert_eq!(
+          line.to_string(&program.nodes, source),
+          expected.to_string(&nodes, source)
+        );
+        assert_eq!(expected_symbols_at_eof(source), symbols);
+      }
+    }
+
     #[test]
     fn missing_rparen_in_expr() {
       let line = r#"10 if 3 > (chr$(( k),2 then 10 else 20"#;
-      assert_snapshot!(parse_line(line).0.to_string(line));
+      assert_snapshot!(print_line(line));
     }
 
     #[test]
     fn expected_symbols_after_if() {
       let line = r#"10 poke a+b,c-1: if  not a then if"#;
-      assert_debug_snapshot!(parse_line(line).1);
+      assert_debug_snapshot!(parse_line(line, &mut NodeStore::new()).1);
     }
 
     #[test]
     fn expected_symbols_after_then() {
       let line = r#"10 poke a+b,c-1: if  not a then"#;
-      assert_debug_snapshot!(parse_line(line).1);
+      assert_debug_snapshot!(parse_line(line, &mut NodeStore::new()).1);
     }
 
     #[test]
     fn expected_symbols_after_stmt_in_if() {
       let line = r#"10 poke a+b,c-1: if  not a then print "a":"#;
-      assert_debug_snapshot!(parse_line(line).1);
+      assert_debug_snapshot!(parse_line(line, &mut NodeStore::new()).1);
     }
 
     #[test]
     fn expected_symbols_after_print() {
       let line = r#"10 print"#;
-      assert_debug_snapshot!(parse_line(line).1);
+      assert_debug_snapshot!(parse_line(line, &mut NodeStore::new()).1);
     }
 
     #[test]
     fn expected_symbols_after_if_cond() {
       let line = r#"10 if a > 1"#;
-      assert_debug_snapshot!(parse_line(line).1);
+      assert_debug_snapshot!(parse_line(line, &mut NodeStore::new()).1);
     }
 
     #[test]
     fn expected_symbols_after_on_cond() {
       let line = r#"10 on a > 1"#;
-      assert_debug_snapshot!(parse_line(line).1);
+      assert_debug_snapshot!(parse_line(line, &mut NodeStore::new()).1);
     }
 
     #[test]
     fn expected_symbols_after_colon() {
       let line = r#"10 poke a+b,c-1: cls:  "#;
-      assert_debug_snapshot!(parse_line(line).1);
+      assert_debug_snapshot!(parse_line(line, &mut NodeStore::new()).1);
     }
   }
 
@@ -2661,25 +2981,143 @@ mod parser_tests {
     fn precedence() {
       let line = r#"10 a(b+1,2)=-70.1++2+fn foo$(k*3-2*(k-3>=2))-5/ab 3 * 2^t  $
 "#;
-      assert_snapshot!(parse_line(line).0.to_string(line));
+      assert_snapshot!(print_line(line));
     }
 
     #[test]
     fn relation() {
       let line = r#"10 A b$=b*3>5 < > (1 2 . 3 e - 5 6 < = not chr$ ( "1" = inkey$ ))  "#;
-      assert_snapshot!(parse_line(line).0.to_string(line));
+      assert_snapshot!(print_line(line));
     }
 
     #[test]
     fn string() {
       let line = r#"10 A b$=""+"ab cd E"#;
-      assert_snapshot!(parse_line(line).0.to_string(line));
+      assert_snapshot!(print_line(line));
     }
 
     #[test]
     fn logical() {
       let line = r#"10 A b % =a and not 4 + 2 or -asc(left$(f$,k))"#;
-      assert_snapshot!(parse_line(line).0.to_string(line));
+      assert_snapshot!(print_line(line));
+    }
+  }
+
+  mod parallel {
+    use super::*;
+    use pretty_assertions::assert_eq;
+
+    const PROG: &str = "10 graph:cls:print \"啊\"::\r
+20 a=inkey$:if a>1 then cont:30:else trace
+30 let x$(2,3)=asc(inkey$)
+
+40 goto 10";
+
+    #[test]
+    fn same_as_sequential() {
+      for chunk_size in 1..PROG.len() + 2 {
+        for threads in 1..4 {
+          let prog = parse_chunked(&[PROG], threads, chunk_size).pop().unwrap();
+          assert_eq!(prog.to_string(PROG), parse(PROG).to_string(PROG));
+        }
+      }
+    }
+
+    #[test]
+    fn batch() {
+      let inputs = [PROG, "", "10 end\n", &PROG[..40]];
+      let progs = parse_chunked(&inputs, 3, 16);
+      assert_eq!(progs.len(), inputs.len());
+      for (prog, input) in progs.iter().zip(&inputs) {
+        assert_eq!(prog.to_string(input), parse(input).to_string(input));
+      }
+    }
+  }
+
+  mod reparse {
+    use super::*;
+    use pretty_assertions::assert_eq;
+
+    const PROG: &str = r#"10 graph:cls:print "a"::
+20 a=inkey$:if a>1 then cont:30:else trace
+30 let x$(2,3)=asc(inkey$)
+40 goto 10"#;
+
+    fn check_edit(start: usize, end: usize, text: &str) -> Reparsed {
+      let mut new_text = PROG.to_owned();
+      new_text.replace_range(start..end, text);
+      let mut prog = parse(PROG);
+      let reparsed = reparse(
+        &mut prog,
+        &new_text,
+        &Edit {
+          range: Range::new(start, end),
+          text,
+        },
+      );
+      let expected = parse(&new_text);
+      assert_eq!(prog.to_string(&new_text), expected.to_string(&new_text));
+      assert_eq!(prog.nodes.stmts.len(), expected.nodes.stmts.len());
+      assert_eq!(prog.nodes.exprs.len(), expected.nodes.exprs.len());
+      assert_eq!(prog.nodes.diagnostics, expected.nodes.diagnostics);
+      assert_eq!(prog.labels, expected.labels);
+      reparsed
+    }
+
+    #[test]
+    fn edit_in_line() {
+      let reparsed = check_edit(29, 30, "b");
+      assert_eq!(reparsed.changed_lines, vec![1]);
+      assert_eq!(reparsed.removed_lines, 1);
+    }
+
+    #[test]
+    fn insert_newline() {
+      let reparsed = check_edit(35, 35, "\n25 ");
+      assert_eq!(reparsed.changed_lines, vec![1, 2]);
+      assert_eq!(reparsed.removed_lines, 1);
+    }
+
+    #[test]
+    fn add_error() {
+      let reparsed = check_edit(3, 3, "(");
+      assert_eq!(reparsed.changed_lines, vec![0]);
+      assert_eq!(reparsed.removed_lines, 1);
+    }
+
+    #[test]
+    fn join_lines() {
+      let reparsed = check_edit(24, 25, "");
+      assert_eq!(reparsed.changed_lines, vec![0]);
+      assert_eq!(reparsed.removed_lines, 2);
+    }
+
+    #[test]
+    fn delete_lines() {
+      let reparsed = check_edit(25, 94, "");
+      assert_eq!(reparsed.changed_lines, vec![1]);
+      assert_eq!(reparsed.removed_lines, 2);
+    }
+
+    #[test]
+    fn append_to_last_line() {
+      let reparsed = check_edit(PROG.len(), PROG.len(), "0:end");
+      assert_eq!(reparsed.changed_lines, vec![3]);
+      assert_eq!(reparsed.removed_lines, 1);
+    }
+
+    #[test]
+    fn append_line() {
+      let reparsed = check_edit(PROG.len(), PROG.len(), "\n50 end\n");
+      assert_eq!(reparsed.changed_lines, vec![3, 4]);
+      assert_eq!(reparsed.removed_lines, 1);
+    }
+
+    #[test]
+    fn replace_all() {
+      let reparsed = check_edit(0, PROG.len(), "");
+      assert_eq!(reparsed.changed_lines, vec![]);
+      assert_eq!(reparsed.removed_lines, 4);
     }
   }
 }
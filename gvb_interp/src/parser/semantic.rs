@@ -0,0 +1,188 @@
+use super::{data_end, Lexer};
+use crate::ast::{Keyword, Punc, TokenKind};
+
+/// The class of a token for highlighting.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+pub enum SemanticTokenKind {
+  Label,
+  Keyword,
+  SysFunc,
+  Ident,
+  Number,
+  String,
+  Punc,
+  /// The text after REM.
+  Comment,
+  /// The raw text of a DATA statement.
+  Data,
+}
+
+/// A token of a line, delta-encoded as in LSP semantic tokens: `delta_start`
+/// is relative to the start of the previous token in the line, or to the
+/// start of the line for the first token. Offsets and lengths are in bytes.
+///
+/// Packed into 8 bytes.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SemanticToken {
+  pub delta_start: u32,
+  pub len: u16,
+  pub kind: SemanticTokenKind,
+}
+
+/// Reads the tokens of a line without parsing it. `line` must not contain
+/// newline.
+///
+/// Numbers are classified as labels at the start of the line and after GOTO,
+/// GOSUB, THEN, ELSE and RESTORE, including the lists of ON ... GOTO.
+pub fn semantic_tokens(line: &str) -> Vec<SemanticToken> {
+  let mut tokens = vec![];
+  let mut lexer = Lexer::new(line);
+  let mut last_start = 0;
+  let mut push = |start: usize, end: usize, kind| {
+    tokens.push(SemanticToken {
+      delta_start: (start - last_start) as u32,
+      len: (end - start).min(u16::MAX as usize) as u16,
+      kind,
+    });
+    last_start = start;
+  };
+
+  let mut read_label = !line.starts_with(' ');
+  loop {
+    let (range, token) = lexer.next_token(read_label);
+    let kind = match token {
+      TokenKind::Eof => break,
+      TokenKind::Ident => SemanticTokenKind::Ident,
+      TokenKind::Label => SemanticTokenKind::Label,
+      TokenKind::Float => SemanticTokenKind::Number,
+      TokenKind::String => SemanticTokenKind::String,
+      TokenKind::Punc(_) => SemanticTokenKind::Punc,
+      TokenKind::Keyword(_) => SemanticTokenKind::Keyword,
+      TokenKind::SysFunc(_) => SemanticTokenKind::SysFunc,
+    };
+    push(range.start, range.end, kind);
+
+    read_label = match token {
+      TokenKind::Keyword(
+        Keyword::Goto
+        | Keyword::Gosub
+        | Keyword::Then
+        | Keyword::Else
+        | Keyword::Restore,
+      ) => true,
+      TokenKind::Punc(Punc::Comma) => read_label,
+      TokenKind::Label => true,
+      TokenKind::Keyword(Keyword::Rem) => {
+        if range.end < line.len() {
+          push(range.end, line.len(), SemanticTokenKind::Comment);
+        }
+        break;
+      }
+      TokenKind::Keyword(Keyword::Data) => {
+        let end = data_end(line.as_bytes(), range.end);
+        if range.end < end {
+          push(range.end, end, SemanticTokenKind::Data);
+        }
+        lexer.seek(end);
+        false
+      }
+      _ => false,
+    };
+  }
+  tokens
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use pretty_assertions::assert_eq;
+  use SemanticTokenKind::*;
+
+  fn tokens(line: &str) -> Vec<(&str, SemanticTokenKind)> {
+    let mut start = 0;
+    semantic_tokens(line)
+      .into_iter()
+      .map(|tok| {
+        start += tok.delta_start as usize;
+        (&line[start..start + tok.len as usize], tok.kind)
+      })
+      .collect()
+  }
+
+  #[test]
+  fn size() {
+    assert_eq!(std::mem::size_of::<SemanticToken>(), 8);
+  }
+
+  #[test]
+  fn labels() {
+    assert_eq!(
+      tokens("10 ON A GOTO 20,30:IF A THEN 40 ELSE 50:X=1,2"),
+      vec![
+        ("10", Label),
+        ("ON", Keyword),
+        ("A", Ident),
+        ("GOTO", Keyword),
+        ("20", Label),
+        (",", Punc),
+        ("30", Label),
+        (":", Punc),
+        ("IF", Keyword),
+        ("A", Ident),
+        ("THEN", Keyword),
+        ("40", Label),
+        ("ELSE", Keyword),
+        ("50", Label),
+        (":", Punc),
+        ("X", Ident),
+        ("=", Punc),
+        ("1", Number),
+        (",", Punc),
+        ("2", Number),
+      ]
+    );
+  }
+
+  #[test]
+  fn raw_text() {
+    assert_eq!(
+      tokens(r#"20 DATA 1,"A:B",C :PRINT LEFT$(A$,1):REM 注释:"#),
+      vec![
+        ("20", Label),
+        ("DATA", Keyword),
+        (r#" 1,"A:B",C "#, Data),
+        (":", Punc),
+        ("PRINT", Keyword),
+        ("LEFT$", SysFunc),
+        ("(", Punc),
+        ("A$", Ident),
+        (",", Punc),
+        ("1", Number),
+        (")", Punc),
+        (":", Punc),
+        ("REM", Keyword),
+        (" 注释:", Comment),
+      ]
+    );
+    assert_eq!(
+      tokens("30 data:rem"),
+      vec![
+        ("30", Label),
+        ("data", Keyword),
+        (":", Punc),
+        ("rem", Keyword),
+      ]
+    );
+  }
+
+  #[test]
+  fn cached_in_line() {
+    let text = "10 PRINT 1\n20 GOTO 10\n";
+    let prog = crate::parser::parse(text);
+    let line = &prog.lines[1];
+    let tokens = line.semantic_tokens(&text[11..]);
+    assert_eq!(tokens, &semantic_tokens("20 GOTO 10")[..]);
+    assert!(std::ptr::eq(tokens, line.semantic_tokens(&text[11..])));
+  }
+}
@@ -19,7 +19,7 @@ pub enum Symbol {
   Term(TokenKind),
 }
 
-#[derive(PartialEq, Eq)]
+#[derive(Clone, PartialEq, Eq)]
 pub struct SymbolSet([u64; 3]);
 
 #[derive(Debug)]
@@ -74,11 +74,21 @@ impl BitOrAssign<SymbolSet> for SymbolSet {
 
 impl Drop for SymbolSetBackup {
   fn drop(&mut self) {
-    unsafe { (*self.ptr).0 = self.org_set.0 };
+    if !self.ptr.is_null() {
+      unsafe { (*self.ptr).0 = self.org_set.0 };
+    }
   }
 }
 
 impl SymbolSetBackup {
+  /// A backup restoring nothing.
+  pub fn none() -> Self {
+    Self {
+      ptr: std::ptr::null_mut(),
+      org_set: SymbolSet::new(),
+    }
+  }
+
   pub fn set(&self, symbols: &mut SymbolSet) {
     symbols.0 = self.org_set.0;
   }
@@ -19,18 +19,20 @@
 //! 0x7a represents a exponent of -6, 0x84 represents a exponent of +4, etc.
 //! 0x00 means the number is zero, and the mantissa doesn't matter.
 
+use crate::parser::read_number;
 use std::convert::TryFrom;
 use std::fmt;
 use std::fmt::Display;
 use std::fmt::Write;
 use std::ops::{Add, Div, Mul, Neg, Sub};
+use std::str::FromStr;
 
 /// Used for store floating point value of a variable.
-#[derive(Debug, Clone, Copy)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub struct Mbf5([u8; 5]);
 
 /// Used for perform floating point calculations.
-#[derive(Debug, Clone, Copy, PartialEq)]
+#[derive(Debug, Clone, Copy, PartialEq, PartialOrd)]
 pub struct Mbf5Accum(f64);
 
 const MANTISSA_BITS: usize = 31;
@@ -41,7 +43,6 @@ const MANTISSA_BITS_DIFF: usize = F64_MANTISSA_BITS - MANTISSA_BITS;
 /// point (i.e. 0.1M), and we want to make the mantissa of MBF conformant to the
 /// rule of IEEE754, so here it is.
 const EXPONENT_BIAS: i32 = 0x81;
-const EXPONENT_BITS: usize = 31;
 
 const F64_MANTISSA_BITS: usize = 52;
 const F64_MANTISSA_MASK: u64 = (1 << F64_MANTISSA_BITS) - 1;
@@ -52,6 +53,9 @@ const F64_EXPONENT_MAX: i32 = (1 << F64_EXPONENT_BITS) - 1;
 
 impl From<&Mbf5> for Mbf5Accum {
   fn from(x: &Mbf5) -> Self {
+    if x.is_zero() {
+      return Self(0.0);
+    }
     let sign = (x.0[1] >> 7) as u64;
     let exp = (x.0[0] as i32 - EXPONENT_BIAS + F64_EXPONENT_BIAS) as u64;
     let mant = (((x.0[1] & 0x7f) as u64) << 24)
@@ -79,45 +83,30 @@ pub enum FloatError {
   Infinite,
 }
 
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ParseRealError {
+  /// The string is not a real number.
+  Malformed,
+  /// The real number is too large.
+  Infinite,
+}
+
 impl TryFrom<Mbf5Accum> for Mbf5 {
   /// Only FloatError::Infinite is possible
   type Error = FloatError;
 
   fn try_from(x: Mbf5Accum) -> Result<Self, FloatError> {
-    let x = x.0.to_bits();
-    let sign = (x >> (F64_MANTISSA_BITS + F64_EXPONENT_BITS)) as u8;
-    let mut exp = f64_exponent(x) + EXPONENT_BIAS;
-    let mut mant = x & F64_MANTISSA_MASK;
-
-    // not infinite or NaN.
-    assert!(exp != F64_EXPONENT_MAX - F64_EXPONENT_BIAS + EXPONENT_BIAS);
-
-    // round mantissa
-    const ROUND_BIT: u64 = 1 << (MANTISSA_BITS_DIFF - 1);
-    const LOWEST_BIT: u64 = 1 << MANTISSA_BITS_DIFF;
-
-    if mant & ROUND_BIT != 0 && mant & LOWEST_BIT != 0 {
-      mant >>= MANTISSA_BITS_DIFF;
-      mant += 1;
-      // handle carry
-      if mant & (1 << EXPONENT_BITS) != 0 {
-        mant >>= 1;
-        exp += 1;
+    let (sign, exp, mant) = match round_mantissa(x.0)? {
+      Some(parts) => parts,
+      None => {
+        let sign =
+          (x.0.to_bits() >> (F64_MANTISSA_BITS + F64_EXPONENT_BITS)) as u8;
+        return Ok(Self([0, sign << 7, 0, 0, 0]));
       }
-    } else {
-      mant >>= MANTISSA_BITS_DIFF;
-    }
-
-    if exp > 0xff {
-      return Err(FloatError::Infinite);
-    }
-
-    if exp <= 0 {
-      return Ok(Self([0, sign << 7, 0, 0, 0]));
-    }
+    };
 
     let exp = exp as u8;
-    let sign = sign << 7;
+    let sign = (sign as u8) << 7;
     let mant1 = (mant >> 24) as u8 & 0x7f | sign;
     let mant2 = (mant >> 16) as u8;
     let mant3 = (mant >> 8) as u8;
@@ -127,6 +116,46 @@ impl TryFrom<Mbf5Accum> for Mbf5 {
   }
 }
 
+/// Rounds the mantissa of `x` to 31 bits, and returns the sign bit, the
+/// exponent in excess-128 form and the mantissa without the hidden bit, or
+/// `None` if `x` is too small to be represented.
+fn round_mantissa(x: f64) -> Result<Option<(u64, i32, u64)>, FloatError> {
+  let x = x.to_bits();
+  let sign = x >> (F64_MANTISSA_BITS + F64_EXPONENT_BITS);
+  let mut exp = f64_exponent(x) + EXPONENT_BIAS;
+  let mut mant = x & F64_MANTISSA_MASK;
+
+  // not infinite or NaN.
+  assert!(exp != F64_EXPONENT_MAX - F64_EXPONENT_BIAS + EXPONENT_BIAS);
+
+  // round mantissa
+  const ROUND_BIT: u64 = 1 << (MANTISSA_BITS_DIFF - 1);
+  const LOWEST_BIT: u64 = 1 << MANTISSA_BITS_DIFF;
+
+  if mant & ROUND_BIT != 0 && mant & LOWEST_BIT != 0 {
+    mant >>= MANTISSA_BITS_DIFF;
+    mant += 1;
+    // handle carry. The mantissa was all ones, and now it's 1.0 with the
+    // hidden bit.
+    if mant & (1 << MANTISSA_BITS) != 0 {
+      mant = 0;
+      exp += 1;
+    }
+  } else {
+    mant >>= MANTISSA_BITS_DIFF;
+  }
+
+  if exp > 0xff {
+    return Err(FloatError::Infinite);
+  }
+
+  if exp <= 0 {
+    return Ok(None);
+  }
+
+  Ok(Some((sign, exp, mant)))
+}
+
 impl TryFrom<f64> for Mbf5Accum {
   type Error = FloatError;
 
@@ -157,49 +186,169 @@ impl TryFrom<f64> for Mbf5Accum {
 
 impl Display for Mbf5 {
   fn fmt(&self, fmt: &mut fmt::Formatter) -> fmt::Result {
+    let mut buf = [0; Mbf5::MAX_DISPLAY_LEN];
+    fmt.write_str(self.format_into(&mut buf))
+  }
+}
+
+/// A `fmt::Write` into a fixed-size buffer on the stack.
+struct StackWriter<const N: usize> {
+  buf: [u8; N],
+  len: usize,
+}
+
+impl<const N: usize> Write for StackWriter<N> {
+  fn write_str(&mut self, s: &str) -> fmt::Result {
+    let end = self.len + s.len();
+    if end > N {
+      return Err(fmt::Error);
+    }
+    self.buf[self.len..end].copy_from_slice(s.as_bytes());
+    self.len = end;
+    Ok(())
+  }
+}
+
+/// Parses a real number of the form `[-+]?\d*(\.\d*)?(E[-+]?\d*)?`, which
+/// may contain spaces. An empty string is parsed as zero.
+impl FromStr for Mbf5 {
+  type Err = ParseRealError;
+
+  fn from_str(s: &str) -> Result<Self, ParseRealError> {
+    let (len, _) = read_number(s.as_bytes(), true);
+    if len != s.trim_end_matches(' ').len() {
+      return Err(ParseRealError::Malformed);
+    }
+
+    let mut digits = String::with_capacity(len + 4);
+    let mut has_digit = false;
+    for c in s.bytes().filter(|&c| c != b' ') {
+      match c {
+        b'e' | b'E' => {
+          if !has_digit {
+            digits.push('0');
+          }
+          digits.push('e');
+          has_digit = false;
+        }
+        b'.' => {
+          if !has_digit {
+            digits.push('0');
+          }
+          digits.push('.');
+          has_digit = true;
+        }
+        _ => {
+          digits.push(c as char);
+          has_digit |= c.is_ascii_digit();
+        }
+      }
+    }
+    if !has_digit {
+      digits.push('0');
+    }
+
+    let value = digits
+      .parse::<f64>()
+      .map_err(|_| ParseRealError::Malformed)?;
+    Mbf5Accum::try_from(value)
+      .and_then(Mbf5::try_from)
+      .map_err(|_| ParseRealError::Infinite)
+  }
+}
+
+impl From<[u8; 5]> for Mbf5 {
+  fn from(bytes: [u8; 5]) -> Self {
+    Self(bytes)
+  }
+}
+
+impl Mbf5 {
+  /// Length of the longest result of `format_into`, e.g. `-1.70141183E+38`.
+  pub const MAX_DISPLAY_LEN: usize = 15;
+
+  /// Formats the number as GVBASIC displays it, into `buf` without heap
+  /// allocation. This is what `Display` prints.
+  pub fn format_into<'a>(
+    &self,
+    buf: &'a mut [u8; Self::MAX_DISPLAY_LEN],
+  ) -> &'a str {
     if self.is_zero() {
-      return write!(fmt, "0");
+      buf[0] = b'0';
+      return std::str::from_utf8(&buf[..1]).unwrap();
     }
 
-    // Why not simply implement Display for Mbf5Accum? Because after rounding
-    // the mantissa of Mbf5Accum, the result may be infinity, so we construct
-    // a Mbf5Accum from Mbf5, to make sure no rounding happens.
+    // Why not simply format Mbf5Accum? Because after rounding the mantissa
+    // of Mbf5Accum, the result may be infinity, so we construct a Mbf5Accum
+    // from Mbf5, to make sure no rounding happens.
     let mut x = Mbf5Accum::from(self).0;
 
+    let mut len = 0;
     if x < 0.0 {
-      write!(fmt, "-")?;
+      buf[0] = b'-';
+      len = 1;
       x = -x;
     }
 
-    let mut result = String::new();
-    if x < 0.01 || x >= 1_000_000_000.0 {
-      write!(&mut result, "{:.8E}", x)?;
-    } else {
-      write!(&mut result, "{:}", x)?;
+    // Integers, the most common numbers printed, are formatted directly. The
+    // result is the same as that of formatting the f64.
+    if x >= 1.0 && x < 1_000_000_000.0 && x.fract() == 0.0 {
+      let mut n = x as u32;
+      let mut digits = 1;
+      while digits < 9 && n >= 10u32.pow(digits as u32) {
+        digits += 1;
+      }
+      for c in buf[len..len + digits].iter_mut().rev() {
+        *c = b'0' + (n % 10) as u8;
+        n /= 10;
+      }
+      return std::str::from_utf8(&buf[..len + digits]).unwrap();
     }
-    let end_of_frac = result.find('E').unwrap_or(result.len());
-    let mut result = result.into_bytes();
 
-    if end_of_frac < result.len() && result[end_of_frac + 1] >= b'0' {
-      result.insert(end_of_frac + 1, b'+');
+    // At most 17 significant digits with a leading "0.0".
+    let mut digits = StackWriter::<24> {
+      buf: [0; 24],
+      len: 0,
+    };
+    if x < 0.01 || x >= 1_000_000_000.0 {
+      write!(&mut digits, "{:.8E}", x).unwrap();
+    } else {
+      write!(&mut digits, "{}", x).unwrap();
     }
-
+    let digits = &digits.buf[..digits.len];
+    let end_of_frac = digits
+      .iter()
+      .position(|&c| c == b'E')
+      .unwrap_or(digits.len());
+
+    // At most 10 characters of the mantissa are kept, and only trailing
+    // zeros of the fraction are removed.
+    let has_point = digits[..end_of_frac].contains(&b'.');
     let mut i = end_of_frac - 1;
-    while result[i] == b'0' || i > 9 {
+    while has_point && digits[i] == b'0' || i > 9 {
       i -= 1;
     }
-
-    if result[i] != b'.' {
+    if !has_point || digits[i] != b'.' {
       i += 1;
     }
+    buf[len..len + i].copy_from_slice(&digits[..i]);
+    len += i;
+
+    if end_of_frac < digits.len() {
+      buf[len] = b'E';
+      len += 1;
+      let exp = &digits[end_of_frac + 1..];
+      if exp[0] != b'-' {
+        buf[len] = b'+';
+        len += 1;
+      }
+      buf[len..len + exp.len()].copy_from_slice(exp);
+      len += exp.len();
+    }
 
-    result.drain(i..end_of_frac);
-
-    write!(fmt, "{}", std::str::from_utf8(&result).unwrap())
+    std::str::from_utf8(&buf[..len]).unwrap()
   }
-}
 
-impl Mbf5 {
   pub fn is_zero(&self) -> bool {
     self.0[0] == 0
   }
@@ -252,6 +401,21 @@ impl Neg for Mbf5Accum {
 }
 
 impl Mbf5Accum {
+  /// Rounds the value to the precision of `Mbf5`, without packing it. The
+  /// result is identical to converting to `Mbf5` and back, but faster.
+  pub fn round(self) -> CalcResult {
+    match round_mantissa(self.0)? {
+      Some((sign, exp, mant)) => {
+        let exp = (exp - EXPONENT_BIAS + F64_EXPONENT_BIAS) as u64;
+        let bits = (sign << (F64_MANTISSA_BITS + F64_EXPONENT_BITS))
+          | (exp << F64_MANTISSA_BITS)
+          | (mant << MANTISSA_BITS_DIFF);
+        Ok(Self(f64::from_bits(bits)))
+      }
+      None => Ok(Self(0.0)),
+    }
+  }
+
   pub fn is_positive(&self) -> bool {
     self.0 > 0.0
   }
@@ -299,6 +463,10 @@ impl Mbf5Accum {
   pub fn sqrt(&self) -> CalcResult {
     Self::try_from(self.0.sqrt())
   }
+
+  pub fn pow(&self, exp: Self) -> CalcResult {
+    Self::try_from(self.0.powf(exp.0))
+  }
 }
 
 fn f64_exponent(x: u64) -> i32 {
@@ -356,6 +524,110 @@ mod tests {
     );
   }
 
+  #[test]
+  fn round_carry() {
+    let x = Mbf5Accum(1.0 - f64::EPSILON);
+    assert_eq!([0x81, 0, 0, 0, 0], Mbf5::try_from(x).unwrap().0);
+    assert_eq!(1.0, x.round().unwrap().0);
+  }
+
+  #[test]
+  fn round_same_as_mbf5() {
+    let mut seed = 1u64;
+    for _ in 0..100000 {
+      seed = seed
+        .wrapping_mul(6364136223846793005)
+        .wrapping_add(1442695040888963407);
+      let bits = seed >> 1;
+      let exp = (bits >> 52) % 300 + 1023 - 150;
+      let x = f64::from_bits(bits & F64_MANTISSA_MASK | exp << 52);
+      let x = match Mbf5Accum::try_from(if seed & 1 != 0 { -x } else { x }) {
+        Ok(x) => x,
+        Err(_) => continue,
+      };
+      let expected = Mbf5::try_from(x).map(|x| Mbf5Accum::from(&x).0.to_bits());
+      assert_eq!(expected, x.round().map(|x| x.0.to_bits()), "{:e}", x.0);
+    }
+  }
+
+  #[test]
+  fn mbf5_zero_to_mbf5_accum() {
+    assert_eq!(0.0, Mbf5Accum::from(&Mbf5([0, 0x12, 0, 0, 0])).0);
+  }
+
+  #[test]
+  fn parse_mbf5() {
+    let parse = |s: &str| s.parse::<Mbf5>().map(|x| x.to_string());
+    assert_eq!(Ok("0".to_owned()), parse(""));
+    assert_eq!(Ok("0".to_owned()), parse("-."));
+    assert_eq!(Ok("12.5".to_owned()), parse(" 1 2 . 5"));
+    assert_eq!(Ok("-2500".to_owned()), parse("-2.5E3"));
+    assert_eq!(Ok("3".to_owned()), parse("3e"));
+    assert_eq!(Ok("0.5".to_owned()), parse(".5 "));
+    assert_eq!(Ok("0".to_owned()), parse("0e99999"));
+    assert_eq!(Err(ParseRealError::Infinite), parse("1e39"));
+    assert_eq!(Err(ParseRealError::Malformed), parse("1x"));
+    assert_eq!(Err(ParseRealError::Malformed), parse("1..2"));
+  }
+
+  /// The original implementation of `Display`, with heap allocation.
+  fn format_reference(x: &Mbf5) -> String {
+    if x.is_zero() {
+      return "0".to_owned();
+    }
+    let mut x = Mbf5Accum::from(x).0;
+    let mut sign = "";
+    if x < 0.0 {
+      sign = "-";
+      x = -x;
+    }
+    let mut result = if x < 0.01 || x >= 1_000_000_000.0 {
+      format!("{:.8E}", x)
+    } else {
+      format!("{}", x)
+    };
+    let end_of_frac = result.find('E').unwrap_or(result.len());
+    if end_of_frac < result.len() && !result[end_of_frac + 1..].starts_with('-')
+    {
+      result.insert(end_of_frac + 1, '+');
+    }
+    let has_point = result[..end_of_frac].contains('.');
+    let mut i = end_of_frac - 1;
+    while has_point && result.as_bytes()[i] == b'0' || i > 9 {
+      i -= 1;
+    }
+    if !has_point || result.as_bytes()[i] != b'.' {
+      i += 1;
+    }
+    result.drain(i..end_of_frac);
+    sign.to_owned() + &result
+  }
+
+  #[test]
+  fn fmt_mbf5_same_as_reference() {
+    let mut seed = 7u64;
+    for _ in 0..100000 {
+      seed = seed
+        .wrapping_mul(6364136223846793005)
+        .wrapping_add(1442695040888963407);
+      let bytes = seed.to_le_bytes();
+      let x = Mbf5([bytes[3], bytes[4], bytes[5], bytes[6], bytes[7]]);
+      let mut buf = [0; Mbf5::MAX_DISPLAY_LEN];
+      assert_eq!(format_reference(&x), x.format_into(&mut buf), "{:?}", x);
+    }
+
+    let integers = (0..100000)
+      .map(|i| i as f64 * 37.0)
+      .chain((999_990_000..1_000_001_000).step_by(7).map(|i| i as f64));
+    for i in integers {
+      for &i in &[i, -i] {
+        let x = Mbf5::try_from(Mbf5Accum::try_from(i).unwrap()).unwrap();
+        let mut buf = [0; Mbf5::MAX_DISPLAY_LEN];
+        assert_eq!(format_reference(&x), x.format_into(&mut buf), "{}", i);
+      }
+    }
+  }
+
   #[test]
   fn fmt_mbf5_zero() {
     assert_eq!("0", &Mbf5([0, 0, 0, 0, 0]).to_string());
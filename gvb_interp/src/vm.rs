@@ -0,0 +1,130 @@
+//! The execution engine of GVBASIC programs.
+//!
+//! A `Program` is first lowered by `compile` into a `Code`, a linear sequence
+//! of `Instr`s with labels and variables already resolved to addresses and
+//! slots, which is then executed by a `Machine`.
+//!
+//! The machine runs for a given number of instructions at a time, and returns
+//! to the caller when it needs keyboard input, so that it can be driven by an
+//! event loop without blocking.
+
+use crate::ast::Range;
+use std::fmt::{self, Debug, Formatter};
+
+pub mod compiler;
+pub mod file;
+pub mod font;
+pub mod instruction;
+pub mod machine;
+pub mod profile;
+pub mod screen;
+pub mod shared;
+pub mod string;
+
+pub use self::compiler::compile;
+pub use self::file::{FileSystem, MemoryFileSystem};
+pub use self::instruction::*;
+pub use self::machine::*;
+pub use self::profile::{NoProfiler, Profile, Profiler};
+pub use self::screen::{DirtyArea, Screen};
+pub use self::string::Str;
+
+/// Everything outside the interpreter: screen, keyboard, memory and files.
+pub trait Device {
+  /// Returns the cursor position as (row, column), both zero-based.
+  fn cursor(&self) -> (u8, u8);
+
+  /// Sets the cursor position, both zero-based.
+  fn set_cursor(&mut self, row: u8, column: u8);
+
+  /// Prints bytes at the cursor, moving the cursor and scrolling the screen
+  /// when needed. A byte followed by another one greater than 0x80 forms a
+  /// GB2312 character.
+  fn print(&mut self, bytes: &[u8]);
+
+  /// Moves the cursor to the beginning of the next row.
+  fn newline(&mut self);
+
+  /// Clears the screen and the text buffer.
+  fn cls(&mut self);
+
+  fn set_screen_mode(&mut self, mode: ScreenMode);
+
+  fn set_print_mode(&mut self, mode: PrintMode);
+
+  /// `mode` is a draw mode, already normalized to 0~5.
+  fn draw_point(&mut self, x: u8, y: u8, mode: u8);
+
+  fn draw_line(&mut self, x1: u8, y1: u8, x2: u8, y2: u8, mode: u8);
+
+  fn draw_box(&mut self, x1: u8, y1: u8, x2: u8, y2: u8, fill: bool, mode: u8);
+
+  fn draw_circle(&mut self, x: u8, y: u8, r: u8, fill: bool, mode: u8);
+
+  fn draw_ellipse(
+    &mut self,
+    x: u8,
+    y: u8,
+    rx: u8,
+    ry: u8,
+    fill: bool,
+    mode: u8,
+  );
+
+  fn beep(&mut self);
+
+  fn peek(&mut self, addr: u16) -> u8;
+
+  fn poke(&mut self, addr: u16, value: u8);
+
+  /// Calls the machine code at `addr`.
+  fn call(&mut self, addr: u16);
+
+  /// The storage of the files of OPEN, which is only accessed when pages of
+  /// the files are loaded or written back.
+  fn files(&mut self) -> &mut dyn FileSystem;
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ScreenMode {
+  Text,
+  Graph,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PrintMode {
+  Normal,
+  Inverse,
+  Flash,
+}
+
+/// Why `Machine::run` returns.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum ExecResult {
+  /// The program ends.
+  End,
+  /// The budget is used up.
+  Pause,
+  /// Waiting for a key, which is given by `Machine::set_key`.
+  InKey,
+  /// Waiting for a line of INPUT, which is given by `Machine::set_input`.
+  /// The caller is responsible for echoing the line.
+  Input,
+  Error(ExecError),
+}
+
+/// An error stopping the execution, located at a statement.
+#[derive(Clone, PartialEq, Eq)]
+pub struct ExecError {
+  /// Index of the line in `Program.lines`.
+  pub line: usize,
+  /// Range of the statement in the line.
+  pub range: Range,
+  pub message: String,
+}
+
+impl Debug for ExecError {
+  fn fmt(&self, f: &mut Formatter) -> fmt::Result {
+    write!(f, "line {} <{:?}>: {}", self.line, self.range, self.message)
+  }
+}
@@ -0,0 +1,1240 @@
+use super::instruction::*;
+use super::machine::{
+  bool_num, compare, int_num, num_binary, num_sys_func, num_unary, to_u8,
+  MAX_STRING_LEN,
+};
+use crate::ast::{
+  BinaryOpKind, Eol, Expr, ExprId, ExprKind, FileMode, InputSource, Label,
+  PrintElement, Program, Range, Stmt, StmtId, StmtKind, SysFuncKind,
+  UnaryOpKind,
+};
+use crate::diagnostic::{Diagnostic, DiagnosticKind, Severity};
+use crate::document::gb2312::UNICODE_TO_GB2312;
+use crate::util::mbf5::{Mbf5, Mbf5Accum, ParseRealError};
+use std::collections::HashMap;
+use std::convert::TryFrom;
+
+/// Longest significant length of variable names, excluding the sigil.
+const MAX_NAME_LEN: usize = 16;
+
+/// Static type of an expression.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Type {
+  Num,
+  Str,
+}
+
+/// Compiles `program` whose source is `text`.
+///
+/// Lines with syntax errors are compiled into a single `SyntaxError`, so that
+/// the program still runs until they are reached, like on the device. Type
+/// errors are returned as diagnostics paired with line indices.
+pub fn compile(
+  program: &Program,
+  text: &str,
+) -> Result<Code, Vec<(usize, Diagnostic)>> {
+  let mut compiler = Compiler {
+    code: Code::default(),
+    text: "",
+    stmts: &[],
+    exprs: &[],
+    line: 0,
+    vars: Default::default(),
+    arrays: Default::default(),
+    funcs: HashMap::new(),
+    string_ids: HashMap::new(),
+    line_starts: Vec::with_capacity(program.lines.len()),
+    label_fixups: vec![],
+    restore_fixups: vec![],
+    pending_whiles: vec![],
+    diagnostics: vec![],
+  };
+
+  let mut offset = 0;
+  for (i, line) in program.lines.iter().enumerate() {
+    let line_text = &text[offset..offset + line.source_len];
+    offset += line.source_len;
+    let line_text = match line.eol {
+      Eol::None => line_text,
+      Eol::Lf => &line_text[..line_text.len() - 1],
+      Eol::CrLf => &line_text[..line_text.len() - 2],
+    };
+
+    compiler.line = i;
+    compiler.text = line_text;
+    compiler.stmts = program.nodes.stmts(&line.nodes);
+    compiler.exprs = program.nodes.exprs(&line.nodes);
+    compiler
+      .line_starts
+      .push((compiler.pc(), compiler.code.data.len() as u32));
+
+    let has_error = program
+      .nodes
+      .diagnostics(&line.nodes)
+      .iter()
+      .any(|d| d.severity == Severity::Error);
+    if has_error {
+      compiler.add_location(Range::new(0, line_text.len()));
+      compiler.emit(Instr::SyntaxError);
+    } else {
+      for &stmt in &line.stmts {
+        compiler.compile_stmt(stmt);
+      }
+    }
+  }
+  compiler.emit(Instr::End);
+  compiler.finish(program)
+}
+
+struct Compiler<'a> {
+  code: Code,
+  /// Text of the current line, without newline.
+  text: &'a str,
+  stmts: &'a [Stmt],
+  exprs: &'a [Expr],
+  line: usize,
+  vars: [HashMap<Vec<u8>, Slot>; 3],
+  arrays: [HashMap<Vec<u8>, Slot>; 3],
+  funcs: HashMap<Vec<u8>, Slot>,
+  string_ids: HashMap<Vec<u8>, u32>,
+  /// The address and the DATA index of the start of each line.
+  line_starts: Vec<(Addr, u32)>,
+  label_fixups: Vec<(Addr, Label)>,
+  restore_fixups: Vec<(Addr, Label)>,
+  /// WHILE instructions waiting for the matching WEND.
+  pending_whiles: Vec<Addr>,
+  diagnostics: Vec<(usize, Diagnostic)>,
+}
+
+impl<'a> Compiler<'a> {
+  fn finish(
+    mut self,
+    program: &Program,
+  ) -> Result<Code, Vec<(usize, Diagnostic)>> {
+    if !self.diagnostics.is_empty() {
+      return Err(self.diagnostics);
+    }
+
+    for &(addr, label) in &self.label_fixups {
+      let target = program
+        .labels
+        .find(label)
+        .map_or(NO_ADDR, |line| self.line_starts[line].0);
+      match &mut self.code.instrs[addr as usize] {
+        Instr::Jump(t) | Instr::GoSub(t) => *t = target,
+        _ => unreachable!(),
+      }
+    }
+    for &(addr, label) in &self.restore_fixups {
+      let index = program
+        .labels
+        .find(label)
+        .map_or(0, |line| self.line_starts[line].1);
+      self.code.instrs[addr as usize] = Instr::Restore(index);
+    }
+
+    for kind in 0..3 {
+      self.code.num_vars[kind] = self.vars[kind].len();
+      self.code.num_arrays[kind] = self.arrays[kind].len();
+      self.code.var_names[kind] = names_by_slot(&mut self.vars[kind]);
+      self.code.array_names[kind] = names_by_slot(&mut self.arrays[kind]);
+    }
+    self.code.num_funcs = self.funcs.len();
+    Ok(self.code)
+  }
+
+  fn pc(&self) -> Addr {
+    self.code.instrs.len() as Addr
+  }
+
+  fn emit(&mut self, instr: Instr) -> Addr {
+    self.code.instrs.push(instr);
+    self.pc() - 1
+  }
+
+  fn patch_jump(&mut self, addr: Addr) {
+    let target = self.pc();
+    match &mut self.code.instrs[addr as usize] {
+      Instr::Jump(t) | Instr::JumpIfZero(t) => *t = target,
+      _ => unreachable!(),
+    }
+  }
+
+  fn add_location(&mut self, range: Range) {
+    let addr = self.pc();
+    self.code.locations.push(Location {
+      addr,
+      line: self.line,
+      range,
+    });
+  }
+
+  fn add_error(&mut self, range: Range, kind: DiagnosticKind) {
+    self
+      .diagnostics
+      .push((self.line, Diagnostic::new_error(range, kind)));
+  }
+
+  fn emit_jump_to_label(&mut self, instr: Instr, label: Option<Label>) {
+    let addr = self.emit(instr);
+    self.label_fixups.push((addr, label.unwrap_or(Label(0))));
+  }
+
+  fn compile_stmt(&mut self, stmt: StmtId) {
+    let stmts = self.stmts;
+    let stmt = &stmts[stmt];
+    self.add_location(stmt.range.clone());
+
+    match &stmt.kind {
+      StmtKind::Auto(_)
+      | StmtKind::Copy(_)
+      | StmtKind::Del(_)
+      | StmtKind::Edit(_)
+      | StmtKind::Files(_)
+      | StmtKind::Kill(_)
+      | StmtKind::List(_)
+      | StmtKind::Load(_)
+      | StmtKind::New(_)
+      | StmtKind::Rem(_)
+      | StmtKind::Rename(_)
+      | StmtKind::Save(_)
+      | StmtKind::Stop(_)
+      | StmtKind::Play(_)
+      | StmtKind::Cont
+      | StmtKind::NoOp => {}
+      StmtKind::Beep => {
+        self.emit(Instr::Beep);
+      }
+      StmtKind::Box(args) => self.compile_graphics(args, Instr::Box),
+      StmtKind::Call(addr) => {
+        self.compile_num_expr(*addr);
+        self.emit(Instr::Call);
+      }
+      StmtKind::Circle(args) => self.compile_graphics(args, Instr::Circle),
+      StmtKind::Clear => {
+        self.emit(Instr::Clear);
+      }
+      StmtKind::Close { filenum } => {
+        self.compile_num_expr(*filenum);
+        self.emit(Instr::Close);
+      }
+      StmtKind::Cls => {
+        self.emit(Instr::Cls);
+      }
+      StmtKind::Data(data) => {
+        for datum in data.iter() {
+          let mut text = &self.text[datum.range.start..datum.range.end];
+          if datum.is_quoted {
+            text = &text[1..];
+            text = text.strip_suffix('"').unwrap_or(text);
+          } else {
+            text = text.trim_start_matches(' ');
+          }
+          let num = if datum.is_quoted {
+            DataNum::Quoted
+          } else {
+            match text.parse::<Mbf5>() {
+              Ok(num) => DataNum::Num(num),
+              Err(ParseRealError::Infinite) => DataNum::Infinite,
+              Err(ParseRealError::Malformed) => DataNum::Malformed,
+            }
+          };
+          let value = self.encode_string(text, &datum.range);
+          let start = self.code.data_text.len() as u32;
+          self.code.data_text.extend_from_slice(&value);
+          self.code.data.push(DataItem {
+            start,
+            end: self.code.data_text.len() as u32,
+            num,
+          });
+        }
+      }
+      StmtKind::Def { name, param, body } => {
+        if let (Some(name), Some(param)) = (name, param) {
+          let func = self.func_slot(name);
+          let param = match self.real_var(param) {
+            Some(slot) => slot,
+            None => return,
+          };
+          self.emit(Instr::DefFn { func, param });
+          let skip = self.emit(Instr::Jump(0));
+          self.compile_num_expr(*body);
+          self.emit(Instr::FnReturn);
+          self.patch_jump(skip);
+        }
+      }
+      StmtKind::Dim(vars) => {
+        let exprs = self.exprs;
+        for &var in vars.iter() {
+          match &exprs[var].kind {
+            ExprKind::Ident => {
+              let (kind, name) = self.var_name(&exprs[var].range);
+              self.var_slot(kind, name);
+            }
+            ExprKind::Index {
+              name: Some(name),
+              indices,
+            } => {
+              for &index in indices.iter() {
+                self.compile_num_expr(index);
+              }
+              let (kind, name) = self.var_name(name);
+              let slot = self.array_slot(kind, name);
+              self.emit(Instr::Dim(kind, slot, indices.len() as u8));
+            }
+            _ => self.emit_syntax_error(),
+          }
+        }
+      }
+      StmtKind::Draw(args) => self.compile_graphics(args, Instr::Draw),
+      StmtKind::Ellipse(args) => self.compile_graphics(args, Instr::Ellipse),
+      StmtKind::End => {
+        self.emit(Instr::End);
+      }
+      StmtKind::Field { filenum, fields } => {
+        self.compile_num_expr(*filenum);
+        for field in fields.iter() {
+          self.compile_num_expr(field.len);
+          match self.compile_lvalue(field.var) {
+            Some(VarKind::Str) => {}
+            Some(_) => {
+              let range = self.exprs[field.var].range.clone();
+              self.add_error(range, DiagnosticKind::ExpectedStrVar);
+            }
+            None => return,
+          }
+        }
+        self.emit(Instr::Field(fields.len() as u16));
+      }
+      StmtKind::Flash => {
+        self.emit(Instr::Flash);
+      }
+      StmtKind::For {
+        var,
+        start,
+        end,
+        step,
+      } => {
+        let var = match var.as_ref().and_then(|var| self.real_var(var)) {
+          Some(var) => var,
+          None => return,
+        };
+        self.compile_num_expr(*start);
+        self.emit(Instr::StoreReal(var));
+        self.compile_num_expr(*end);
+        match step {
+          Some(step) => self.compile_num_expr(*step),
+          None => {
+            self.emit(Instr::PushNum(Mbf5::from([0x81, 0, 0, 0, 0])));
+          }
+        }
+        self.emit(Instr::For(var));
+      }
+      StmtKind::Get { filenum, record } => {
+        self.compile_num_expr(*filenum);
+        self.compile_num_expr(*record);
+        self.emit(Instr::Get);
+      }
+      StmtKind::GoSub(label) => {
+        self.emit_jump_to_label(Instr::GoSub(0), label.as_ref().map(|l| l.1));
+      }
+      StmtKind::GoTo { label, .. } => {
+        self.emit_jump_to_label(Instr::Jump(0), label.as_ref().map(|l| l.1));
+      }
+      StmtKind::Graph => {
+        self.emit(Instr::Graph);
+      }
+      StmtKind::If { cond, conseq, alt } => {
+        self.compile_num_expr(*cond);
+        let to_alt = self.emit(Instr::JumpIfZero(0));
+        for &stmt in conseq.iter() {
+          self.compile_stmt(stmt);
+        }
+        if let Some(alt) = alt {
+          let to_end = self.emit(Instr::Jump(0));
+          self.patch_jump(to_alt);
+          for &stmt in alt.iter() {
+            self.compile_stmt(stmt);
+          }
+          self.patch_jump(to_end);
+        } else {
+          self.patch_jump(to_alt);
+        }
+      }
+      StmtKind::InKey => {
+        self.emit(Instr::WaitKey);
+      }
+      StmtKind::Input {
+        source: InputSource::Keyboard(prompt),
+        vars,
+      } => {
+        if let Some(prompt) = prompt {
+          self.compile_expr_of_string_lit(prompt);
+        }
+        for &var in vars.iter() {
+          self.compile_lvalue(var);
+        }
+        self.emit(Instr::Input {
+          count: vars.len() as u16,
+          has_prompt: prompt.is_some(),
+        });
+      }
+      StmtKind::Input {
+        source: InputSource::File(filenum),
+        vars,
+      } => {
+        self.compile_num_expr(*filenum);
+        for &var in vars.iter() {
+          self.compile_lvalue(var);
+        }
+        self.emit(Instr::InputFile(vars.len() as u16));
+      }
+      StmtKind::Input {
+        source: InputSource::Error,
+        ..
+      } => self.emit_syntax_error(),
+      StmtKind::Inverse => {
+        self.emit(Instr::Inverse);
+      }
+      StmtKind::Let { var, value } => self.compile_assignment(*var, *value),
+      StmtKind::Line(args) => self.compile_graphics(args, Instr::Line),
+      StmtKind::Locate { row, column } => {
+        if let Some(row) = row {
+          self.compile_num_expr(*row);
+        }
+        if let Some(column) = column {
+          self.compile_num_expr(*column);
+        }
+        self.emit(Instr::Locate {
+          row: row.is_some(),
+          column: column.is_some(),
+        });
+      }
+      StmtKind::LSet { var, value } => {
+        self.compile_string_set(*var, *value, Instr::LSet)
+      }
+      StmtKind::RSet { var, value } => {
+        self.compile_string_set(*var, *value, Instr::RSet)
+      }
+      StmtKind::Next { vars } => {
+        if vars.is_empty() {
+          self.emit(Instr::NextAny);
+        }
+        for var in vars.iter() {
+          match var.as_ref().and_then(|var| self.real_var(var)) {
+            Some(var) => {
+              self.emit(Instr::Next(var));
+            }
+            None => return,
+          }
+        }
+      }
+      StmtKind::Normal => {
+        self.emit(Instr::Normal);
+      }
+      StmtKind::NoTrace => {
+        self.emit(Instr::Trace(false));
+      }
+      StmtKind::On {
+        cond,
+        labels,
+        is_sub,
+      } => {
+        self.compile_num_expr(*cond);
+        self.emit(Instr::On {
+          count: labels.len() as u16,
+          is_sub: *is_sub,
+        });
+        for (_, label) in labels.iter() {
+          self.emit_jump_to_label(Instr::Jump(0), *label);
+        }
+      }
+      StmtKind::Open {
+        filename,
+        mode,
+        filenum,
+        len,
+      } => {
+        let mode = match mode {
+          FileMode::Input => OpenMode::Input,
+          FileMode::Output => OpenMode::Output,
+          FileMode::Append => OpenMode::Append,
+          FileMode::Random => OpenMode::Random,
+          FileMode::Error => return self.emit_syntax_error(),
+        };
+        self.compile_str_expr(*filename);
+        self.compile_num_expr(*filenum);
+        if let Some(len) = len {
+          self.compile_num_expr(*len);
+        }
+        self.emit(Instr::Open {
+          mode,
+          has_len: len.is_some(),
+        });
+      }
+      StmtKind::Poke { addr, value } => {
+        self.compile_num_expr(*addr);
+        self.compile_num_expr(*value);
+        self.emit(Instr::Poke);
+      }
+      StmtKind::Pop => {
+        self.emit(Instr::Pop);
+      }
+      StmtKind::Print(elems) => self.compile_print(elems),
+      StmtKind::Put { filenum, record } => {
+        self.compile_num_expr(*filenum);
+        self.compile_num_expr(*record);
+        self.emit(Instr::Put);
+      }
+      StmtKind::Read(vars) => {
+        for &var in vars.iter() {
+          self.compile_lvalue(var);
+          self.emit(Instr::Read);
+        }
+      }
+      StmtKind::Restore(label) => {
+        let addr = self.emit(Instr::Restore(0));
+        if let Some((_, label)) = label {
+          self.restore_fixups.push((addr, *label));
+        }
+      }
+      StmtKind::Return => {
+        self.emit(Instr::Return);
+      }
+      StmtKind::Run => {
+        self.emit(Instr::Run);
+      }
+      StmtKind::Swap { left, right } => {
+        let left_kind = self.compile_lvalue(*left);
+        let right_kind = self.compile_lvalue(*right);
+        if let (Some(l), Some(r)) = (left_kind, right_kind) {
+          if l != r {
+            let range = self.exprs[*right].range.clone();
+            self.add_error(range, DiagnosticKind::SwapTypeMismatch);
+          }
+        }
+        self.emit(Instr::Swap);
+      }
+      StmtKind::System => self.emit_syntax_error(),
+      StmtKind::Text => {
+        self.emit(Instr::Text);
+      }
+      StmtKind::Trace => {
+        self.emit(Instr::Trace(true));
+      }
+      StmtKind::Wend => {
+        self.emit(Instr::Wend);
+        if let Some(addr) = self.pending_whiles.pop() {
+          let exit = self.pc();
+          if let Instr::While { exit: e, .. } =
+            &mut self.code.instrs[addr as usize]
+          {
+            *e = exit;
+          }
+        }
+      }
+      StmtKind::While(cond) => {
+        let start = self.pc();
+        self.compile_num_expr(*cond);
+        let cond_len = self.pc() - start;
+        let addr = self.emit(Instr::While {
+          cond_len: cond_len as u16,
+          exit: NO_ADDR,
+        });
+        self.pending_whiles.push(addr);
+      }
+      StmtKind::Write { filenum, data } => {
+        if let Some(filenum) = filenum {
+          self.compile_num_expr(*filenum);
+          self.emit(Instr::BeginWriteFile);
+        }
+        for (i, elem) in data.iter().enumerate() {
+          let is_last = i == data.len() - 1;
+          // Data not followed by a comma are overwritten by the next one, but
+          // they are still evaluated.
+          let is_written = is_last || elem.comma;
+          match (self.compile_expr(elem.datum), is_written) {
+            (Some(Type::Num), true) => self.emit(Instr::WriteNum),
+            (Some(Type::Str), true) => self.emit(Instr::WriteStr),
+            (Some(Type::Num), false) => self.emit(Instr::DiscardNum),
+            (Some(Type::Str), false) => self.emit(Instr::DiscardStr),
+            (None, _) => continue,
+          };
+          if !is_last && elem.comma {
+            self.emit(Instr::WriteComma);
+          }
+        }
+        if filenum.is_some() {
+          self.emit(Instr::EndWriteFile);
+        }
+      }
+    }
+  }
+
+  fn emit_syntax_error(&mut self) {
+    self.emit(Instr::SyntaxError);
+  }
+
+  fn compile_graphics(&mut self, args: &[ExprId], ctor: fn(u8) -> Instr) {
+    for &arg in args {
+      self.compile_num_expr(arg);
+    }
+    self.emit(ctor(args.len() as u8));
+  }
+
+  fn compile_print(&mut self, elems: &[PrintElement]) {
+    if elems.is_empty() {
+      self.emit(Instr::Newline);
+      return;
+    }
+    for (i, elem) in elems.iter().enumerate() {
+      match elem {
+        PrintElement::Expr(expr) => {
+          match self.compile_expr(*expr) {
+            Some(Type::Num) => self.emit(Instr::PrintNum),
+            Some(Type::Str) => self.emit(Instr::PrintStr),
+            None => continue,
+          };
+          match elems.get(i + 1) {
+            None => {
+              self.emit(Instr::NewlineIfNeeded);
+            }
+            Some(PrintElement::Expr(_)) => {
+              self.emit(Instr::PrintSpace);
+            }
+            Some(_) => {}
+          }
+        }
+        PrintElement::Comma => {
+          self.emit(Instr::NewlineIfNeeded);
+        }
+        PrintElement::Semicolon => {}
+      }
+    }
+  }
+
+  fn compile_assignment(&mut self, var: ExprId, value: ExprId) {
+    let exprs = self.exprs;
+    match &exprs[var].kind {
+      ExprKind::Ident => {
+        let (kind, name) = self.var_name(&exprs[var].range);
+        let slot = self.var_slot(kind, name);
+        self.compile_expr_of_kind(value, kind);
+        self.emit(match kind {
+          VarKind::Real => Instr::StoreReal(slot),
+          VarKind::Int => Instr::StoreInt(slot),
+          VarKind::Str => Instr::StoreStr(slot),
+        });
+      }
+      _ => {
+        if let Some(kind) = self.compile_lvalue(var) {
+          self.compile_expr_of_kind(value, kind);
+          self.emit(Instr::StoreRef);
+        }
+      }
+    }
+  }
+
+  fn compile_string_set(&mut self, var: ExprId, value: ExprId, instr: Instr) {
+    match self.compile_lvalue(var) {
+      Some(VarKind::Str) => {}
+      Some(_) => {
+        let range = self.exprs[var].range.clone();
+        self.add_error(range, DiagnosticKind::ExpectedStrVar);
+      }
+      None => return,
+    }
+    self.compile_str_expr(value);
+    self.emit(instr);
+  }
+
+  /// Pushes a reference to the lvalue.
+  fn compile_lvalue(&mut self, var: ExprId) -> Option<VarKind> {
+    let exprs = self.exprs;
+    match &exprs[var].kind {
+      ExprKind::Ident => {
+        let (kind, name) = self.var_name(&exprs[var].range);
+        let slot = self.var_slot(kind, name);
+        self.emit(Instr::VarRef(kind, slot));
+        Some(kind)
+      }
+      ExprKind::Index {
+        name: Some(name),
+        indices,
+      } => {
+        for &index in indices.iter() {
+          self.compile_num_expr(index);
+        }
+        let (kind, name) = self.var_name(name);
+        let slot = self.array_slot(kind, name);
+        self.emit(Instr::ElemRef(kind, slot, indices.len() as u8));
+        Some(kind)
+      }
+      _ => {
+        self.emit_syntax_error();
+        None
+      }
+    }
+  }
+
+  fn compile_expr_of_kind(&mut self, expr: ExprId, kind: VarKind) {
+    if kind == VarKind::Str {
+      self.compile_str_expr(expr);
+    } else {
+      self.compile_num_expr(expr);
+    }
+  }
+
+  fn compile_num_expr(&mut self, expr: ExprId) {
+    if let Some(Type::Str) = self.compile_expr(expr) {
+      let range = self.exprs[expr].range.clone();
+      self.add_error(range, DiagnosticKind::ExpectedNum);
+    }
+  }
+
+  fn compile_str_expr(&mut self, expr: ExprId) {
+    if let Some(Type::Num) = self.compile_expr(expr) {
+      let range = self.exprs[expr].range.clone();
+      self.add_error(range, DiagnosticKind::ExpectedStr);
+    }
+  }
+
+  /// Returns `None` if the expression is malformed.
+  ///
+  /// Operations on constants are evaluated here, if they don't fail.
+  fn compile_expr(&mut self, expr: ExprId) -> Option<Type> {
+    let start = self.pc();
+    let ty = self.compile_expr_unfolded(expr);
+    self.fold_constants(start);
+    ty
+  }
+
+  fn compile_expr_unfolded(&mut self, expr: ExprId) -> Option<Type> {
+    let exprs = self.exprs;
+    let expr = &exprs[expr];
+    match &expr.kind {
+      ExprKind::Ident => {
+        let (kind, name) = self.var_name(&expr.range);
+        let slot = self.var_slot(kind, name);
+        Some(match kind {
+          VarKind::Real => {
+            self.emit(Instr::LoadReal(slot));
+            Type::Num
+          }
+          VarKind::Int => {
+            self.emit(Instr::LoadInt(slot));
+            Type::Num
+          }
+          VarKind::Str => {
+            self.emit(Instr::LoadStr(slot));
+            Type::Str
+          }
+        })
+      }
+      ExprKind::StringLit => {
+        self.compile_expr_of_string_lit(&expr.range);
+        Some(Type::Str)
+      }
+      ExprKind::NumberLit => {
+        let text = &self.text[expr.range.start..expr.range.end];
+        match text.parse::<Mbf5>() {
+          Ok(num) => {
+            self.emit(Instr::PushNum(num));
+          }
+          Err(ParseRealError::Infinite) => {
+            self.add_error(expr.range.clone(), DiagnosticKind::NumberTooLarge)
+          }
+          Err(ParseRealError::Malformed) => self.emit_syntax_error(),
+        }
+        Some(Type::Num)
+      }
+      ExprKind::SysFuncCall {
+        func: (func_range, kind),
+        args,
+      } => self.compile_sys_func(func_range, *kind, args),
+      ExprKind::UserFuncCall {
+        func: Some(func),
+        arg,
+      } => {
+        self.compile_num_expr(*arg);
+        let func = self.func_slot(func);
+        self.emit(Instr::CallFn(func));
+        Some(Type::Num)
+      }
+      ExprKind::Binary {
+        lhs,
+        op: (op_range, op),
+        rhs,
+      } => {
+        let lhs_type = self.compile_expr(*lhs)?;
+        let rhs_type = self.compile_expr(*rhs)?;
+        if lhs_type != rhs_type {
+          self.add_error(op_range.clone(), DiagnosticKind::OperandTypeMismatch);
+          return Some(Type::Num);
+        }
+        let cmp = match op {
+          BinaryOpKind::Eq => Some(CmpKind::Eq),
+          BinaryOpKind::Ne => Some(CmpKind::Ne),
+          BinaryOpKind::Gt => Some(CmpKind::Gt),
+          BinaryOpKind::Lt => Some(CmpKind::Lt),
+          BinaryOpKind::Ge => Some(CmpKind::Ge),
+          BinaryOpKind::Le => Some(CmpKind::Le),
+          _ => None,
+        };
+        if let Some(cmp) = cmp {
+          self.emit(if lhs_type == Type::Str {
+            Instr::CmpStr(cmp)
+          } else {
+            Instr::CmpNum(cmp)
+          });
+          return Some(Type::Num);
+        }
+        if lhs_type == Type::Str {
+          if *op == BinaryOpKind::Add {
+            self.emit(Instr::Concat);
+          } else {
+            self.add_error(op_range.clone(), DiagnosticKind::StrOperator);
+          }
+          return Some(Type::Str);
+        }
+        self.emit(match op {
+          BinaryOpKind::Add => Instr::Add,
+          BinaryOpKind::Sub => Instr::Sub,
+          BinaryOpKind::Mul => Instr::Mul,
+          BinaryOpKind::Div => Instr::Div,
+          BinaryOpKind::Pow => Instr::Pow,
+          BinaryOpKind::And => Instr::And,
+          BinaryOpKind::Or => Instr::Or,
+          _ => unreachable!(),
+        });
+        Some(Type::Num)
+      }
+      ExprKind::Unary { op: (_, op), arg } => {
+        self.compile_num_expr(*arg);
+        match op {
+          UnaryOpKind::Neg => {
+            self.emit(Instr::Neg);
+          }
+          UnaryOpKind::Not => {
+            self.emit(Instr::Not);
+          }
+          UnaryOpKind::Pos => {}
+        }
+        Some(Type::Num)
+      }
+      ExprKind::Index {
+        name: Some(name),
+        indices,
+      } => {
+        for &index in indices.iter() {
+          self.compile_num_expr(index);
+        }
+        let (kind, name) = self.var_name(name);
+        let slot = self.array_slot(kind, name);
+        self.emit(Instr::LoadElem(kind, slot, indices.len() as u8));
+        Some(if kind == VarKind::Str {
+          Type::Str
+        } else {
+          Type::Num
+        })
+      }
+      ExprKind::Inkey => {
+        self.emit(Instr::Inkey);
+        Some(Type::Str)
+      }
+      ExprKind::UserFuncCall { func: None, .. }
+      | ExprKind::Index { name: None, .. }
+      | ExprKind::Error => {
+        self.emit_syntax_error();
+        None
+      }
+    }
+  }
+
+  fn compile_sys_func(
+    &mut self,
+    func_range: &Range,
+    kind: SysFuncKind,
+    args: &[ExprId],
+  ) -> Option<Type> {
+    use self::Type::*;
+    let (params, optional, ret): (&[Type], usize, Type) = match kind {
+      SysFuncKind::Abs
+      | SysFuncKind::Atn
+      | SysFuncKind::Cos
+      | SysFuncKind::Eof
+      | SysFuncKind::Exp
+      | SysFuncKind::Int
+      | SysFuncKind::Lof
+      | SysFuncKind::Log
+      | SysFuncKind::Peek
+      | SysFuncKind::Pos
+      | SysFuncKind::Rnd
+      | SysFuncKind::Sgn
+      | SysFuncKind::Sin
+      | SysFuncKind::Sqr
+      | SysFuncKind::Tan => (&[Num], 0, Num),
+      SysFuncKind::Asc
+      | SysFuncKind::Cvi
+      | SysFuncKind::Cvs
+      | SysFuncKind::Len
+      | SysFuncKind::Val => (&[Str], 0, Num),
+      SysFuncKind::Chr
+      | SysFuncKind::Mki
+      | SysFuncKind::Mks
+      | SysFuncKind::Str => (&[Num], 0, Str),
+      SysFuncKind::Left | SysFuncKind::Right => (&[Str, Num], 0, Str),
+      SysFuncKind::Mid => (&[Str, Num, Num], 1, Str),
+    };
+
+    if args.len() > params.len() || args.len() < params.len() - optional {
+      self.add_error(func_range.clone(), DiagnosticKind::ArgCountMismatch);
+      return Some(ret);
+    }
+    for (&arg, &ty) in args.iter().zip(params) {
+      if ty == Num {
+        self.compile_num_expr(arg);
+      } else {
+        self.compile_str_expr(arg);
+      }
+    }
+    self.emit(Instr::SysFunc(kind, args.len() as u8));
+    Some(ret)
+  }
+
+  /// Replaces the code of an expression starting at `start` with its value,
+  /// if it's an operation whose operands are all constants.
+  fn fold_constants(&mut self, start: Addr) {
+    let instrs = &self.code.instrs[start as usize..];
+    match *instrs {
+      [Instr::PushNum(x), instr @ (Instr::Neg | Instr::Not)] => {
+        let x = num_unary(instr, Mbf5Accum::from(&x));
+        self.fold_num(start, Ok(x));
+      }
+      [Instr::PushNum(l), Instr::PushNum(r), instr @ (Instr::Add
+      | Instr::Sub
+      | Instr::Mul
+      | Instr::Div
+      | Instr::Pow
+      | Instr::And
+      | Instr::Or
+      | Instr::CmpNum(_))] => {
+        let x = num_binary(instr, Mbf5Accum::from(&l), Mbf5Accum::from(&r));
+        self.fold_num(start, x);
+      }
+      [Instr::PushStr(l), Instr::PushStr(r), Instr::CmpStr(kind)] => {
+        let strings = &self.code.strings;
+        let x = compare(kind, &strings[l as usize], &strings[r as usize]);
+        self.fold_num(start, Ok(bool_num(x)));
+      }
+      [Instr::PushStr(l), Instr::PushStr(r), Instr::Concat] => {
+        let strings = &self.code.strings;
+        let (l, r) = (&strings[l as usize], &strings[r as usize]);
+        if l.len() + r.len() <= MAX_STRING_LEN {
+          let s = [&l[..], &r[..]].concat();
+          self.code.instrs.truncate(start as usize);
+          self.emit_str(s);
+        }
+      }
+      [Instr::PushNum(x), Instr::SysFunc(kind, 1)] => match kind {
+        SysFuncKind::Abs
+        | SysFuncKind::Atn
+        | SysFuncKind::Cos
+        | SysFuncKind::Exp
+        | SysFuncKind::Int
+        | SysFuncKind::Log
+        | SysFuncKind::Sgn
+        | SysFuncKind::Sin
+        | SysFuncKind::Sqr
+        | SysFuncKind::Tan => {
+          let x = num_sys_func(kind, Mbf5Accum::from(&x));
+          self.fold_num(start, x);
+        }
+        SysFuncKind::Chr => {
+          if let Ok(c) = to_u8(Mbf5Accum::from(&x)) {
+            self.code.instrs.truncate(start as usize);
+            self.emit_str(vec![c]);
+          }
+        }
+        _ => {}
+      },
+      [Instr::PushStr(s), Instr::SysFunc(kind, 1)] => {
+        let s = &self.code.strings[s as usize];
+        match kind {
+          SysFuncKind::Len => self.fold_num(start, Ok(int_num(s.len() as i16))),
+          SysFuncKind::Asc => {
+            if let Some(&c) = s.first() {
+              self.fold_num(start, Ok(int_num(c as i16)));
+            }
+          }
+          _ => {}
+        }
+      }
+      _ => {}
+    }
+  }
+
+  /// Replaces the code starting at `start` with a number, if it's evaluated
+  /// without error and representable exactly by `PushNum`. Errors are left
+  /// to be reported at run time.
+  fn fold_num(&mut self, start: Addr, x: Result<Mbf5Accum, String>) {
+    if let Ok(x) = x {
+      if let Ok(num) = Mbf5::try_from(x) {
+        if Mbf5Accum::from(&num) == x {
+          self.code.instrs.truncate(start as usize);
+          self.emit(Instr::PushNum(num));
+        }
+      }
+    }
+  }
+
+  fn compile_expr_of_string_lit(&mut self, range: &Range) {
+    let text = &self.text[range.start + 1..range.end];
+    let text = text.strip_suffix('"').unwrap_or(text);
+    let value = self.encode_string(text, range);
+    self.emit_str(value);
+  }
+
+  /// Pushes a string, sharing the same constant with equal strings.
+  fn emit_str(&mut self, value: Vec<u8>) {
+    let next_id = self.code.strings.len() as u32;
+    let id = match self.string_ids.get(&value) {
+      Some(&id) => id,
+      None => {
+        self.code.strings.push(value.clone());
+        self.string_ids.insert(value, next_id);
+        next_id
+      }
+    };
+    self.emit(Instr::PushStr(id));
+  }
+
+  fn encode_string(&mut self, text: &str, range: &Range) -> Vec<u8> {
+    let mut bytes = Vec::with_capacity(text.len());
+    for c in text.chars() {
+      if c.is_ascii() {
+        bytes.push(c as u8);
+      } else if let Some(&code) = u16::try_from(c as u32)
+        .ok()
+        .and_then(|c| UNICODE_TO_GB2312.get(&c))
+      {
+        bytes.extend_from_slice(&code.to_be_bytes());
+      } else {
+        self.add_error(range.clone(), DiagnosticKind::UnencodableChar(c));
+      }
+    }
+    bytes
+  }
+
+  /// Returns the kind and the normalized name of a variable.
+  fn var_name(&self, range: &Range) -> (VarKind, Vec<u8>) {
+    let text = self.text[range.start..range.end].as_bytes();
+    let (kind, text) = match text.last() {
+      Some(b'$') => (VarKind::Str, &text[..text.len() - 1]),
+      Some(b'%') => (VarKind::Int, &text[..text.len() - 1]),
+      _ => (VarKind::Real, text),
+    };
+    // Only the part before the first space is significant.
+    let text = text.split(|&c| c == b' ').next().unwrap();
+    let name = text[..text.len().min(MAX_NAME_LEN)].to_ascii_uppercase();
+    (kind, name)
+  }
+
+  fn real_var(&mut self, range: &Range) -> Option<Slot> {
+    match self.var_name(range) {
+      (VarKind::Real, name) => Some(self.var_slot(VarKind::Real, name)),
+      _ => {
+        self.add_error(range.clone(), DiagnosticKind::ExpectedRealVar);
+        None
+      }
+    }
+  }
+
+  fn var_slot(&mut self, kind: VarKind, name: Vec<u8>) -> Slot {
+    let vars = &mut self.vars[kind as usize];
+    let next = vars.len() as Slot;
+    let slot = *vars.entry(name).or_insert(next);
+    self.add_var_use(kind, slot, false);
+    slot
+  }
+
+  fn array_slot(&mut self, kind: VarKind, name: Vec<u8>) -> Slot {
+    let arrays = &mut self.arrays[kind as usize];
+    let next = arrays.len() as Slot;
+    let slot = *arrays.entry(name).or_insert(next);
+    self.add_var_use(kind, slot, true);
+    slot
+  }
+
+  fn add_var_use(&mut self, kind: VarKind, slot: Slot, is_array: bool) {
+    let var_use = VarUse {
+      line: self.line,
+      kind,
+      slot,
+      is_array,
+    };
+    let uses = &self.code.var_uses;
+    if !uses
+      .iter()
+      .rev()
+      .take_while(|u| u.line == self.line)
+      .any(|u| *u == var_use)
+    {
+      self.code.var_uses.push(var_use);
+    }
+  }
+
+  fn func_slot(&mut self, range: &Range) -> Slot {
+    let (kind, name) = self.var_name(range);
+    if kind != VarKind::Real {
+      self.add_error(range.clone(), DiagnosticKind::ExpectedRealFn);
+    }
+    let next = self.funcs.len() as Slot;
+    *self.funcs.entry(name).or_insert(next)
+  }
+}
+
+fn names_by_slot(slots: &mut HashMap<Vec<u8>, Slot>) -> Vec<Vec<u8>> {
+  let mut names = vec![vec![]; slots.len()];
+  for (name, slot) in slots.drain() {
+    names[slot as usize] = name;
+  }
+  names
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use crate::parser::parse;
+  use pretty_assertions::assert_eq;
+
+  fn compile_err(text: &str) -> Vec<(usize, String)> {
+    let program = parse(text);
+    compile(&program, text)
+      .unwrap_err()
+      .into_iter()
+      .map(|(line, d)| (line, d.message()))
+      .collect()
+  }
+
+  #[test]
+  fn type_errors() {
+    assert_eq!(
+      compile_err(
+        "10 a=\"x\"\n20 print a$+1:print len(1,2)\n30 for a$=1 to 2
+40 write a$+1 2\n"
+      ),
+      vec![
+        (0, "表达式类型错误，期望是数值类型".to_owned()),
+        (1, "运算符两边的表达式类型不一致".to_owned()),
+        (1, "函数参数个数错误".to_owned()),
+        (2, "变量必须是实数类型".to_owned()),
+        (3, "运算符两边的表达式类型不一致".to_owned()),
+      ]
+    );
+  }
+
+  #[test]
+  fn labels_and_data() {
+    let text =
+      "10 goto 20:restore 30\n20 data 1,\" a\n30 data  b\n10 goto 10\n";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    assert!(matches!(code.instrs[0], Instr::Jump(2)));
+    assert!(matches!(code.instrs[1], Instr::Restore(2)));
+    assert!(matches!(code.instrs[2], Instr::Jump(0)));
+    assert_eq!(
+      code.data,
+      vec![
+        DataItem {
+          start: 0,
+          end: 1,
+          num: DataNum::Num("1".parse().unwrap()),
+        },
+        DataItem {
+          start: 1,
+          end: 3,
+          num: DataNum::Quoted,
+        },
+        DataItem {
+          start: 3,
+          end: 4,
+          num: DataNum::Malformed,
+        },
+      ]
+    );
+    assert_eq!(code.data_text, b"1 ab");
+  }
+
+  #[test]
+  fn variable_names() {
+    let text =
+      "10 ab cd=1:ab=2:abcdefghijklmnopq=3:abcdefghijklmnopr%=4:x$=\"\"\n";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    assert_eq!(code.num_vars, [2, 1, 1]);
+    assert_eq!(
+      code.var_names[VarKind::Real as usize],
+      [b"AB".to_vec(), b"ABCDEFGHIJKLMNOP".to_vec()]
+    );
+  }
+
+  #[test]
+  fn var_uses() {
+    let text = "10 a=1:b$(a)=\"\":a=a+1\n20 print\n30 dim b$(2):c%=a\n";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let var_use = |line, kind, slot, is_array| VarUse {
+      line,
+      kind,
+      slot,
+      is_array,
+    };
+    assert_eq!(
+      code.var_uses_of(0),
+      [
+        var_use(0, VarKind::Real, 0, false),
+        var_use(0, VarKind::Str, 0, true),
+      ]
+    );
+    assert_eq!(code.var_uses_of(1), []);
+    assert_eq!(
+      code.var_uses_of(2),
+      [
+        var_use(2, VarKind::Str, 0, true),
+        var_use(2, VarKind::Int, 0, false),
+        var_use(2, VarKind::Real, 0, false),
+      ]
+    );
+  }
+
+  #[test]
+  fn constant_folding() {
+    let text = "10 a=2^8-1:b$=chr$(65)+\"B\":c=1/0:d=-len(\"abc\")\n";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let num = |n: f64| {
+      Instr::PushNum(Mbf5::try_from(Mbf5Accum::try_from(n).unwrap()).unwrap())
+    };
+    assert_eq!(
+      format!("{:?}", code.instrs),
+      format!(
+        "{:?}",
+        [
+          num(255.0),
+          Instr::StoreReal(0),
+          Instr::PushStr(2),
+          Instr::StoreStr(0),
+          num(1.0),
+          num(0.0),
+          Instr::Div,
+          Instr::StoreReal(1),
+          num(-3.0),
+          Instr::StoreReal(2),
+          Instr::End,
+        ]
+      )
+    );
+    assert_eq!(code.strings[2], b"AB");
+  }
+}
@@ -0,0 +1,560 @@
+//! The files of OPEN, buffered in memory.
+//!
+//! The bytes of an open file are cached in pages, which are read from the host
+//! storage on first access and written back only when the file is closed or
+//! flushed. Reading and writing adjacent records, or a sequential file byte by
+//! byte, costs no round trip to the host.
+
+use super::instruction::OpenMode;
+use std::collections::BTreeMap;
+use std::io;
+use std::rc::Rc;
+
+pub const NUM_FILES: usize = 3;
+pub const MAX_FILE_LEN: usize = 65535;
+const MAX_NAME_LEN: usize = 14;
+const DEFAULT_RECORD_LEN: usize = 32;
+const MAX_RECORD_LEN: usize = 128;
+const PAGE_SIZE: usize = 4096;
+
+type Fallible<T> = Result<T, String>;
+
+/// The storage of files on the host.
+pub trait FileSystem {
+  /// Returns `None` if the file doesn't exist.
+  fn file_len(&mut self, name: &[u8]) -> io::Result<Option<usize>>;
+
+  /// Reads `buf.len()` bytes at `offset`, which are all within the file.
+  fn read_at(
+    &mut self,
+    name: &[u8],
+    offset: usize,
+    buf: &mut [u8],
+  ) -> io::Result<()>;
+
+  /// Writes `data` at `offset`, which are all within the file.
+  fn write_at(
+    &mut self,
+    name: &[u8],
+    offset: usize,
+    data: &[u8],
+  ) -> io::Result<()>;
+
+  /// Truncates the file, or extends it with zeros. The file is created if it
+  /// doesn't exist.
+  fn set_len(&mut self, name: &[u8], len: usize) -> io::Result<()>;
+}
+
+/// Files kept in memory, for hosts without storage.
+#[derive(Debug, Clone, Default)]
+pub struct MemoryFileSystem {
+  files: BTreeMap<Vec<u8>, Vec<u8>>,
+}
+
+impl MemoryFileSystem {
+  pub fn file(&self, name: &[u8]) -> Option<&[u8]> {
+    self.files.get(name).map(|f| &f[..])
+  }
+
+  pub fn insert(&mut self, name: Vec<u8>, data: Vec<u8>) {
+    self.files.insert(name, data);
+  }
+}
+
+impl FileSystem for MemoryFileSystem {
+  fn file_len(&mut self, name: &[u8]) -> io::Result<Option<usize>> {
+    Ok(self.files.get(name).map(|f| f.len()))
+  }
+
+  fn read_at(
+    &mut self,
+    name: &[u8],
+    offset: usize,
+    buf: &mut [u8],
+  ) -> io::Result<()> {
+    let file = self.files.get(name).ok_or(io::ErrorKind::NotFound)?;
+    buf.copy_from_slice(&file[offset..offset + buf.len()]);
+    Ok(())
+  }
+
+  fn write_at(
+    &mut self,
+    name: &[u8],
+    offset: usize,
+    data: &[u8],
+  ) -> io::Result<()> {
+    let file = self.files.get_mut(name).ok_or(io::ErrorKind::NotFound)?;
+    file[offset..offset + data.len()].copy_from_slice(data);
+    Ok(())
+  }
+
+  fn set_len(&mut self, name: &[u8], len: usize) -> io::Result<()> {
+    self.files.entry(name.to_vec()).or_default().resize(len, 0);
+    Ok(())
+  }
+}
+
+/// The three files of OPEN, indexed by file number minus 1.
+///
+/// Cloning shares the pages, which are copied when either clone writes them.
+#[derive(Clone, Default)]
+pub struct Vfs {
+  /// Prepended to the names of files, so that each program has its own files.
+  prefix: Vec<u8>,
+  files: [Option<OpenFile>; NUM_FILES],
+}
+
+#[derive(Clone)]
+struct OpenFile {
+  /// The name on the host, with the prefix.
+  name: Vec<u8>,
+  mode: OpenMode,
+  /// Length of the file on the host, or `None` if it doesn't exist yet.
+  host_len: Option<usize>,
+  len: usize,
+  /// Position of INPUT # and WRITE #.
+  pos: usize,
+  /// Pages loaded so far, indexed by page number.
+  pages: Vec<Option<Page>>,
+  /// The record buffer of GET and PUT, which FIELD variables map into.
+  /// Empty unless the file is opened for RANDOM.
+  record: Vec<u8>,
+}
+
+#[derive(Clone)]
+struct Page {
+  bytes: Rc<[u8; PAGE_SIZE]>,
+  dirty: bool,
+}
+
+impl Vfs {
+  pub fn set_prefix(&mut self, prefix: &[u8]) {
+    self.prefix = prefix.to_vec();
+  }
+
+  /// `len` is the LEN of RANDOM files.
+  pub fn open(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    file: usize,
+    name: &[u8],
+    mode: OpenMode,
+    len: Option<u8>,
+  ) -> Fallible<()> {
+    if self.files[file].is_some() {
+      return Err("文件已打开".to_owned());
+    }
+    let mut name: Vec<u8> =
+      name.iter().copied().filter(|&c| c != 0x1f).collect();
+    name.truncate(MAX_NAME_LEN);
+    if name.is_empty() || name.contains(&b'/') {
+      return Err("非法的文件名".to_owned());
+    }
+    let mut host_name = self.prefix.clone();
+    host_name.extend_from_slice(&name);
+
+    let host_len = host(fs.file_len(&host_name))?;
+    let record = match (mode, len) {
+      (OpenMode::Random, len) => {
+        let len = len.map_or(DEFAULT_RECORD_LEN, |len| len as usize);
+        let len = if len == 0 || len > MAX_RECORD_LEN {
+          DEFAULT_RECORD_LEN
+        } else {
+          len
+        };
+        vec![0; len]
+      }
+      (_, Some(_)) => return Err("语法错误".to_owned()),
+      (_, None) => vec![],
+    };
+    let len = match mode {
+      OpenMode::Input => host_len.ok_or_else(|| "文件不存在".to_owned())?,
+      OpenMode::Output => 0,
+      OpenMode::Append | OpenMode::Random => host_len.unwrap_or(0),
+    };
+    let pos = if mode == OpenMode::Append { len } else { 0 };
+    self.files[file] = Some(OpenFile {
+      name: host_name,
+      mode,
+      host_len,
+      len,
+      pos,
+      pages: vec![],
+      record,
+    });
+    Ok(())
+  }
+
+  pub fn close(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    file: usize,
+  ) -> Fallible<()> {
+    let mut f = self.files[file]
+      .take()
+      .ok_or_else(|| "文件未打开".to_owned())?;
+    f.flush(fs)
+  }
+
+  pub fn close_all(&mut self, fs: &mut dyn FileSystem) -> Fallible<()> {
+    self.flush(fs)?;
+    self.files = Default::default();
+    Ok(())
+  }
+
+  /// Writes back all modified pages.
+  pub fn flush(&mut self, fs: &mut dyn FileSystem) -> Fallible<()> {
+    for f in self.files.iter_mut().flatten() {
+      f.flush(fs)?;
+    }
+    Ok(())
+  }
+
+  /// Returns the length of the record buffer of a RANDOM file.
+  pub fn record_len(&self, file: usize) -> Fallible<usize> {
+    Ok(self.opened(file, &[OpenMode::Random])?.record.len())
+  }
+
+  /// Returns the record buffer of a RANDOM file.
+  pub fn record_mut(&mut self, file: usize) -> Fallible<&mut [u8]> {
+    Ok(&mut self.opened_mut(file, &[OpenMode::Random])?.record)
+  }
+
+  /// Reads the record into the record buffer, and returns the buffer.
+  /// `record` starts from 1.
+  pub fn get(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    file: usize,
+    record: u16,
+  ) -> Fallible<&[u8]> {
+    let f = self.opened_mut(file, &[OpenMode::Random])?;
+    let offset = (record as usize - 1) * f.record.len();
+    if offset + f.record.len() > f.len {
+      return Err("读取超出文件末尾".to_owned());
+    }
+    let mut record = std::mem::take(&mut f.record);
+    let result = f.read(fs, offset, &mut record);
+    f.record = record;
+    result?;
+    Ok(&f.record)
+  }
+
+  /// Writes the record buffer to the record. `record` starts from 1.
+  pub fn put(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    file: usize,
+    record: u16,
+  ) -> Fallible<()> {
+    let f = self.opened_mut(file, &[OpenMode::Random])?;
+    let offset = (record as usize - 1) * f.record.len();
+    if offset > f.len {
+      return Err("写入超出文件末尾".to_owned());
+    }
+    if offset + f.record.len() > MAX_FILE_LEN {
+      return Err("文件过大".to_owned());
+    }
+    let record = std::mem::take(&mut f.record);
+    let result = f.write(fs, offset, &record);
+    f.record = record;
+    result
+  }
+
+  /// Reads the next byte of a file opened for INPUT, or returns `None` at the
+  /// end of the file.
+  pub fn read_byte(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    file: usize,
+  ) -> Fallible<Option<u8>> {
+    let f = self.opened_mut(file, &[OpenMode::Input])?;
+    if f.pos >= f.len {
+      return Ok(None);
+    }
+    let mut b = [0];
+    f.read(fs, f.pos, &mut b)?;
+    f.pos += 1;
+    Ok(Some(b[0]))
+  }
+
+  /// Appends bytes to a file opened for OUTPUT or APPEND.
+  pub fn write(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    file: usize,
+    data: &[u8],
+  ) -> Fallible<()> {
+    let f = self.opened_mut(file, &[OpenMode::Output, OpenMode::Append])?;
+    if f.pos + data.len() > MAX_FILE_LEN {
+      return Err("文件过大".to_owned());
+    }
+    f.write(fs, f.pos, data)?;
+    f.pos += data.len();
+    Ok(())
+  }
+
+  /// Whether a file opened for INPUT is read to the end.
+  pub fn eof(&self, file: usize) -> Fallible<bool> {
+    let f = self.opened(file, &[OpenMode::Input])?;
+    Ok(f.pos >= f.len)
+  }
+
+  /// Returns the length of a RANDOM file.
+  pub fn lof(&self, file: usize) -> Fallible<usize> {
+    Ok(self.opened(file, &[OpenMode::Random])?.len)
+  }
+
+  fn opened(&self, file: usize, modes: &[OpenMode]) -> Fallible<&OpenFile> {
+    let f = self.files[file]
+      .as_ref()
+      .ok_or_else(|| "文件未打开".to_owned())?;
+    if !modes.contains(&f.mode) {
+      return Err("文件打开模式错误".to_owned());
+    }
+    Ok(f)
+  }
+
+  fn opened_mut(
+    &mut self,
+    file: usize,
+    modes: &[OpenMode],
+  ) -> Fallible<&mut OpenFile> {
+    let f = self.files[file]
+      .as_mut()
+      .ok_or_else(|| "文件未打开".to_owned())?;
+    if !modes.contains(&f.mode) {
+      return Err("文件打开模式错误".to_owned());
+    }
+    Ok(f)
+  }
+}
+
+impl OpenFile {
+  /// Returns the page, reading it from the host if it's not loaded yet.
+  fn page(&mut self, fs: &mut dyn FileSystem, i: usize) -> Fallible<&mut Page> {
+    if i >= self.pages.len() {
+      self.pages.resize_with(i + 1, || None);
+    }
+    if self.pages[i].is_none() {
+      let mut bytes = Rc::new([0; PAGE_SIZE]);
+      // Bytes after `len` are discarded, as by OPEN for OUTPUT.
+      let start = i * PAGE_SIZE;
+      let end = self.host_len.unwrap_or(0).min(self.len);
+      if start < end {
+        let n = (end - start).min(PAGE_SIZE);
+        let bytes = Rc::get_mut(&mut bytes).unwrap();
+        host(fs.read_at(&self.name, start, &mut bytes[..n]))?;
+      }
+      self.pages[i] = Some(Page {
+        bytes,
+        dirty: false,
+      });
+    }
+    Ok(self.pages[i].as_mut().unwrap())
+  }
+
+  fn read(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    offset: usize,
+    buf: &mut [u8],
+  ) -> Fallible<()> {
+    let mut done = 0;
+    while done < buf.len() {
+      let pos = offset + done;
+      let start = pos % PAGE_SIZE;
+      let n = (PAGE_SIZE - start).min(buf.len() - done);
+      let page = self.page(fs, pos / PAGE_SIZE)?;
+      buf[done..done + n].copy_from_slice(&page.bytes[start..start + n]);
+      done += n;
+    }
+    Ok(())
+  }
+
+  fn write(
+    &mut self,
+    fs: &mut dyn FileSystem,
+    offset: usize,
+    data: &[u8],
+  ) -> Fallible<()> {
+    let mut done = 0;
+    while done < data.len() {
+      let pos = offset + done;
+      let start = pos % PAGE_SIZE;
+      let n = (PAGE_SIZE - start).min(data.len() - done);
+      let page = self.page(fs, pos / PAGE_SIZE)?;
+      Rc::make_mut(&mut page.bytes)[start..start + n]
+        .copy_from_slice(&data[done..done + n]);
+      page.dirty = true;
+      done += n;
+    }
+    self.len = self.len.max(offset + data.len());
+    Ok(())
+  }
+
+  fn flush(&mut self, fs: &mut dyn FileSystem) -> Fallible<()> {
+    if self.host_len != Some(self.len) {
+      host(fs.set_len(&self.name, self.len))?;
+      self.host_len = Some(self.len);
+    }
+    for (i, page) in self.pages.iter_mut().enumerate() {
+      if let Some(page) = page.as_mut().filter(|p| p.dirty) {
+        let start = i * PAGE_SIZE;
+        let end = self.len.min(start + PAGE_SIZE);
+        if start < end {
+          host(fs.write_at(&self.name, start, &page.bytes[..end - start]))?;
+        }
+        page.dirty = false;
+      }
+    }
+    Ok(())
+  }
+}
+
+fn host<T>(result: io::Result<T>) -> Fallible<T> {
+  result.map_err(|_| "文件读写错误".to_owned())
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use pretty_assertions::assert_eq;
+
+  /// Counts the calls to the host.
+  #[derive(Default)]
+  struct CountingFs {
+    fs: MemoryFileSystem,
+    calls: usize,
+  }
+
+  impl FileSystem for CountingFs {
+    fn file_len(&mut self, name: &[u8]) -> io::Result<Option<usize>> {
+      self.calls += 1;
+      self.fs.file_len(name)
+    }
+
+    fn read_at(
+      &mut self,
+      name: &[u8],
+      offset: usize,
+      buf: &mut [u8],
+    ) -> io::Result<()> {
+      self.calls += 1;
+      self.fs.read_at(name, offset, buf)
+    }
+
+    fn write_at(
+      &mut self,
+      name: &[u8],
+      offset: usize,
+      data: &[u8],
+    ) -> io::Result<()> {
+      self.calls += 1;
+      self.fs.write_at(name, offset, data)
+    }
+
+    fn set_len(&mut self, name: &[u8], len: usize) -> io::Result<()> {
+      self.calls += 1;
+      self.fs.set_len(name, len)
+    }
+  }
+
+  #[test]
+  fn records() {
+    let mut fs = CountingFs::default();
+    let mut vfs = Vfs::default();
+    vfs.set_prefix(b"P.");
+    vfs
+      .open(&mut fs, 0, b"D\x1fB", OpenMode::Random, Some(4))
+      .unwrap();
+    assert_eq!(vfs.record_len(0), Ok(4));
+    for i in 1..=100u16 {
+      vfs
+        .record_mut(0)
+        .unwrap()
+        .copy_from_slice(&(i as u32).to_le_bytes());
+      vfs.put(&mut fs, 0, i).unwrap();
+    }
+    assert_eq!(vfs.put(&mut fs, 0, 102), Err("写入超出文件末尾".to_owned()));
+    assert_eq!(vfs.get(&mut fs, 0, 3).unwrap(), [3, 0, 0, 0]);
+    assert_eq!(vfs.lof(0), Ok(400));
+    assert_eq!(fs.calls, 1);
+    vfs.close(&mut fs, 0).unwrap();
+    assert_eq!(fs.calls, 3);
+    assert_eq!(fs.fs.file(b"P.DB").unwrap()[396..], [100, 0, 0, 0]);
+
+    fs.calls = 0;
+    vfs
+      .open(&mut fs, 2, b"DB", OpenMode::Random, Some(0))
+      .unwrap();
+    assert_eq!(vfs.record_len(2), Ok(32));
+    assert_eq!(vfs.get(&mut fs, 2, 12).unwrap()[..4], [89, 0, 0, 0]);
+    assert_eq!(vfs.get(&mut fs, 2, 13), Err("读取超出文件末尾".to_owned()));
+    vfs.close_all(&mut fs).unwrap();
+    assert_eq!(fs.calls, 2);
+  }
+
+  #[test]
+  fn sequential() {
+    let mut fs = MemoryFileSystem::default();
+    let mut vfs = Vfs::default();
+    assert_eq!(
+      vfs.open(&mut fs, 0, b"A", OpenMode::Input, None),
+      Err("文件不存在".to_owned())
+    );
+    fs.insert(b"A".to_vec(), vec![1; PAGE_SIZE * 2]);
+    vfs.open(&mut fs, 0, b"A", OpenMode::Output, None).unwrap();
+    assert_eq!(
+      vfs.open(&mut fs, 0, b"A", OpenMode::Output, None),
+      Err("文件已打开".to_owned())
+    );
+    vfs.write(&mut fs, 0, b"ab").unwrap();
+    vfs.close(&mut fs, 0).unwrap();
+    assert_eq!(fs.file(b"A"), Some(&b"ab"[..]));
+
+    vfs.open(&mut fs, 1, b"A", OpenMode::Append, None).unwrap();
+    assert_eq!(
+      vfs.read_byte(&mut fs, 1),
+      Err("文件打开模式错误".to_owned())
+    );
+    vfs.write(&mut fs, 1, b"c").unwrap();
+    vfs.flush(&mut fs).unwrap();
+    assert_eq!(fs.file(b"A"), Some(&b"abc"[..]));
+    vfs.close(&mut fs, 1).unwrap();
+    assert_eq!(vfs.close(&mut fs, 1), Err("文件未打开".to_owned()));
+
+    vfs.open(&mut fs, 0, b"A", OpenMode::Input, None).unwrap();
+    let mut bytes = vec![];
+    while let Some(b) = vfs.read_byte(&mut fs, 0).unwrap() {
+      bytes.push(b);
+    }
+    assert_eq!(bytes, b"abc");
+    assert_eq!(vfs.eof(0), Ok(true));
+    assert_eq!(
+      vfs.open(&mut fs, 1, b"A", OpenMode::Input, Some(1)),
+      Err("语法错误".to_owned())
+    );
+    assert_eq!(
+      vfs.open(&mut fs, 1, b"\x1f", OpenMode::Input, None),
+      Err("非法的文件名".to_owned())
+    );
+  }
+
+  #[test]
+  fn clone_shares_pages() {
+    let mut fs = MemoryFileSystem::default();
+    let mut vfs = Vfs::default();
+    vfs.open(&mut fs, 0, b"A", OpenMode::Output, None).unwrap();
+    vfs.write(&mut fs, 0, b"ab").unwrap();
+    let copy = vfs.clone();
+    let page = |vfs: &Vfs| vfs.files[0].as_ref().unwrap().pages[0].clone();
+    assert!(Rc::ptr_eq(
+      &page(&vfs).unwrap().bytes,
+      &page(&copy).unwrap().bytes
+    ));
+    vfs.write(&mut fs, 0, b"c").unwrap();
+    assert_eq!(page(&vfs).unwrap().bytes[..3], *b"abc");
+    assert_eq!(page(&copy).unwrap().bytes[..3], *b"ab\0");
+  }
+}
@@ -0,0 +1,115 @@
+//! The 16-pixel-high fonts of the device, embedded from `data/`.
+//!
+//! The fonts are stored in the same packed format as `Screen`, so glyphs are
+//! sliced out of the embedded data as they are, without decoding anything at
+//! startup.
+
+use crate::document::gb2312;
+
+static ASCII_16: &[u8] =
+  include_bytes!(concat!(env!("CARGO_MANIFEST_DIR"), "/../data/ascii_16.dat"));
+/// Rows 01~09 and 16~87 of GB2312.
+static GB2312_16: &[u8] = include_bytes!(concat!(
+  env!("CARGO_MANIFEST_DIR"),
+  "/../data/gb2312_16.dat"
+));
+/// The built-in icons of NC and TC series, of codes F8A1~FDD9.
+static ICON_16: &[u8] =
+  include_bytes!(concat!(env!("CARGO_MANIFEST_DIR"), "/../data/icon_16.dat"));
+
+pub const GLYPH_HEIGHT: u8 = 16;
+
+/// The rows of GB2312 missing from `GB2312_16`.
+const GB2312_GAP: std::ops::Range<usize> = 9 * 94..15 * 94;
+const ICON_START: usize = 87 * 94;
+
+/// A bitmap of `GLYPH_HEIGHT` rows, each row of `(width + 7) / 8` bytes.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Glyph {
+  pub width: u8,
+  pub bitmap: &'static [u8],
+}
+
+/// Returns the 8x16 glyph of an ASCII character.
+pub fn ascii_glyph(c: u8) -> Option<Glyph> {
+  let i = c as usize * 16;
+  ASCII_16
+    .get(i..i + 16)
+    .map(|bitmap| Glyph { width: 8, bitmap })
+}
+
+/// Returns the 16x16 glyph of a two-byte GB2312 code or an icon, with the
+/// first byte in the high bits.
+pub fn gb2312_glyph(code: u16) -> Option<Glyph> {
+  let index = gb2312::index(code)?;
+  let (font, i) = if index < GB2312_GAP.start {
+    (GB2312_16, index)
+  } else if index < GB2312_GAP.end {
+    return None;
+  } else if index < ICON_START {
+    (GB2312_16, index - GB2312_GAP.len())
+  } else {
+    (ICON_16, index - ICON_START)
+  };
+  font
+    .get(i * 32..i * 32 + 32)
+    .map(|bitmap| Glyph { width: 16, bitmap })
+}
+
+/// Returns the glyph of the character at the start of `bytes`, and the number
+/// of bytes of the character.
+pub fn next_glyph(bytes: &[u8]) -> Option<(Glyph, usize)> {
+  match *bytes {
+    [c, ..] if c < 0x80 => ascii_glyph(c).map(|g| (g, 1)),
+    [b1, b2, ..] => {
+      gb2312_glyph(((b1 as u16) << 8) | b2 as u16).map(|g| (g, 2))
+    }
+    _ => None,
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use crate::vm::Screen;
+  use pretty_assertions::assert_eq;
+
+  #[test]
+  fn lookup() {
+    assert_eq!(ascii_glyph(b'A').unwrap().bitmap[3..6], [0x08, 0x1c, 0x36]);
+    assert_eq!(ascii_glyph(0x80), None);
+
+    // 啊
+    let glyph = gb2312_glyph(0xb0a1).unwrap();
+    assert_eq!(glyph.width, 16);
+    assert_eq!(glyph.bitmap[2..4], [0x77, 0xbe]);
+    // The first symbol of row 01, and the last of row 09.
+    assert_eq!(
+      gb2312_glyph(0xa1a1).unwrap().bitmap.as_ptr(),
+      GB2312_16.as_ptr()
+    );
+    assert!(gb2312_glyph(0xa9fe).is_some());
+    assert_eq!(gb2312_glyph(0xaaa1), None);
+    assert_eq!(
+      gb2312_glyph(0xf8a1).unwrap().bitmap.as_ptr(),
+      ICON_16.as_ptr()
+    );
+    assert!(gb2312_glyph(0xfdd9).is_some());
+    assert_eq!(gb2312_glyph(0xfdda), None);
+
+    assert_eq!(next_glyph(b"A1").unwrap().1, 1);
+    assert_eq!(next_glyph(&[0xb0, 0xa1, 0x41]).unwrap().1, 2);
+    assert_eq!(next_glyph(&[0xb0]), None);
+  }
+
+  #[test]
+  fn draw() {
+    let mut screen = Screen::new();
+    let (glyph, _) = next_glyph(&[0xb0, 0xa1]).unwrap();
+    screen.draw_glyph(4, 2, &glyph, false);
+    assert_eq!(
+      screen.pixels()[3 * crate::vm::screen::BYTES_PER_ROW..][..3],
+      [0x07, 0x7b, 0xe0]
+    );
+  }
+}
@@ -0,0 +1,277 @@
+use crate::ast::{Range, SysFuncKind};
+use crate::util::mbf5::Mbf5;
+
+/// Index of an instruction in `Code.instrs`.
+pub type Addr = u32;
+
+/// The address of jumps whose target label doesn't exist.
+pub const NO_ADDR: Addr = Addr::MAX;
+
+/// Index of a variable, array or user function.
+pub type Slot = u16;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum VarKind {
+  Real,
+  Int,
+  Str,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum OpenMode {
+  Input,
+  Output,
+  Append,
+  Random,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum CmpKind {
+  Eq,
+  Ne,
+  Gt,
+  Lt,
+  Ge,
+  Le,
+}
+
+/// An instruction of the stack machine. Numbers and strings are evaluated on
+/// separate stacks, and lvalues are pushed on a third stack as references.
+///
+/// Instructions are kept within 8 bytes.
+#[derive(Debug, Clone, Copy)]
+pub enum Instr {
+  PushNum(Mbf5),
+  /// Index into `Code.strings`.
+  PushStr(u32),
+  LoadReal(Slot),
+  LoadInt(Slot),
+  LoadStr(Slot),
+  /// Pops the given number of indices and loads the array element.
+  LoadElem(VarKind, Slot, u8),
+  StoreReal(Slot),
+  StoreInt(Slot),
+  StoreStr(Slot),
+  /// Pushes a reference to a variable.
+  VarRef(VarKind, Slot),
+  /// Pops the given number of indices and pushes a reference to the array
+  /// element.
+  ElemRef(VarKind, Slot, u8),
+  /// Pops a reference and a value of its type, and stores the value.
+  StoreRef,
+
+  Neg,
+  Not,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Pow,
+  And,
+  Or,
+  CmpNum(CmpKind),
+  CmpStr(CmpKind),
+  Concat,
+  /// Calls a system function with the given number of arguments.
+  SysFunc(SysFuncKind, u8),
+  /// Pops the argument and calls the user function.
+  CallFn(Slot),
+  /// Returns from a user function, with the result on the number stack.
+  FnReturn,
+  /// Waits for a key and pushes it as a string.
+  Inkey,
+
+  /// Defines a user function with the given parameter. The body starts after
+  /// the next instruction, which jumps over the body.
+  DefFn {
+    func: Slot,
+    param: Slot,
+  },
+  /// Pops the given number of bounds and allocates the array.
+  Dim(VarKind, Slot, u8),
+  Jump(Addr),
+  /// Pops a number and jumps if it's zero.
+  JumpIfZero(Addr),
+  GoSub(Addr),
+  Return,
+  Pop,
+  /// Pops a number `n` and jumps to the target of the `n`-th of the next
+  /// `count` instructions, which are all `Jump`s.
+  On {
+    count: u16,
+    is_sub: bool,
+  },
+  /// Pops the step and the end of a FOR loop of the variable. The loop body
+  /// starts at the next instruction.
+  For(Slot),
+  Next(Slot),
+  /// NEXT without variable.
+  NextAny,
+  /// Pops the condition of a WHILE loop. The condition starts `cond_len`
+  /// instructions before this one, and `exit` is the address after the
+  /// matching WEND.
+  While {
+    cond_len: u16,
+    exit: Addr,
+  },
+  Wend,
+  End,
+  /// Pops a reference and reads a datum into it.
+  Read,
+  /// Resets the DATA pointer to the index into `Code.data`.
+  Restore(u32),
+  /// Pops two references and swaps their values.
+  Swap,
+  /// Pops a reference to a string and a string.
+  LSet,
+  /// Pops a reference to a string and a string.
+  RSet,
+  /// Pops the given number of references, and the prompt if any, and reads
+  /// values from the keyboard into them.
+  Input {
+    count: u16,
+    has_prompt: bool,
+  },
+
+  PrintNum,
+  PrintStr,
+  PrintSpace,
+  Newline,
+  /// Moves to the next row if the cursor is not at the first column.
+  NewlineIfNeeded,
+  WriteNum,
+  WriteStr,
+  WriteComma,
+  /// Pops a number or a string and discards it.
+  DiscardNum,
+  DiscardStr,
+  /// Pops the row and (or) the column.
+  Locate {
+    row: bool,
+    column: bool,
+  },
+  Cls,
+  Graph,
+  Text,
+  Inverse,
+  Normal,
+  Flash,
+  Beep,
+  WaitKey,
+  /// Pops the given number of arguments.
+  Draw(u8),
+  Line(u8),
+  Box(u8),
+  Circle(u8),
+  Ellipse(u8),
+  Poke,
+  Call,
+  Clear,
+  Run,
+  Trace(bool),
+  /// Pops the LEN if any, the file number and the file name, and opens the
+  /// file.
+  Open {
+    mode: OpenMode,
+    has_len: bool,
+  },
+  /// Pops the file number.
+  Close,
+  /// Pops the given number of references and field lengths, and the file
+  /// number, and binds the variables to the record buffer of the file.
+  Field(u16),
+  /// Pops the record number and the file number.
+  Get,
+  Put,
+  /// Pops the given number of references and the file number, and reads
+  /// values from the file into them.
+  InputFile(u16),
+  /// Pops a file number. The following `WriteNum`, `WriteStr` and
+  /// `WriteComma` write to the file until `EndWriteFile`.
+  BeginWriteFile,
+  EndWriteFile,
+  /// The line or the statement is malformed.
+  SyntaxError,
+}
+
+const _: () = assert!(std::mem::size_of::<Instr>() <= 8);
+
+/// A compiled program.
+#[derive(Debug, Clone, Default)]
+pub struct Code {
+  pub instrs: Vec<Instr>,
+  /// String literals, encoded in GB2312.
+  pub strings: Vec<Vec<u8>>,
+  /// Data of all DATA statements, in program order.
+  pub data: Vec<DataItem>,
+  /// Text of all data, without quotes, encoded in GB2312.
+  pub data_text: Vec<u8>,
+  /// Number of variables, arrays and user functions of each kind, indexed by
+  /// `VarKind as usize` except for functions.
+  pub num_vars: [usize; 3],
+  pub num_arrays: [usize; 3],
+  pub num_funcs: usize,
+  /// Normalized names of variables and arrays of each kind, indexed by slot,
+  /// for showing them without looking up names at run time.
+  pub var_names: [Vec<Vec<u8>>; 3],
+  pub array_names: [Vec<Vec<u8>>; 3],
+  /// Statement locations, sorted by address.
+  pub locations: Vec<Location>,
+  /// Variables and arrays used by each line, sorted by line.
+  pub var_uses: Vec<VarUse>,
+}
+
+/// A variable or an array used in a line.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct VarUse {
+  /// Index of the line in `Program.lines`.
+  pub line: usize,
+  pub kind: VarKind,
+  pub slot: Slot,
+  pub is_array: bool,
+}
+
+/// A datum, parsed at compile time so that READ neither walks the DATA
+/// statements nor parses the text again.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct DataItem {
+  /// The range of the text in `Code.data_text`.
+  pub start: u32,
+  pub end: u32,
+  pub num: DataNum,
+}
+
+/// The value of a datum read into a numeric variable.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DataNum {
+  Num(Mbf5),
+  Quoted,
+  Malformed,
+  Infinite,
+}
+
+/// The statement whose code starts at `addr`.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Location {
+  pub addr: Addr,
+  /// Index of the line in `Program.lines`.
+  pub line: usize,
+  /// Range of the statement in the line.
+  pub range: Range,
+}
+
+impl Code {
+  /// Returns the statement containing the instruction at `addr`.
+  pub fn location(&self, addr: Addr) -> Option<&Location> {
+    // Statements that generate no code share the address of the next one.
+    let i = self.locations.partition_point(|loc| loc.addr <= addr);
+    i.checked_sub(1).map(|i| &self.locations[i])
+  }
+
+  /// Returns the variables and arrays used by a line, in order of first use.
+  pub fn var_uses_of(&self, line: usize) -> &[VarUse] {
+    let start = self.var_uses.partition_point(|u| u.line < line);
+    let end = self.var_uses.partition_point(|u| u.line <= line);
+    &self.var_uses[start..end]
+  }
+}
@@ -0,0 +1,2138 @@
+use super::file::{Vfs, NUM_FILES};
+use super::instruction::*;
+use super::profile::{NoProfiler, Profiler};
+use super::string::{Str, StrStack};
+use super::{Device, ExecError, ExecResult, PrintMode, ScreenMode};
+use crate::ast::{Range, SysFuncKind};
+use crate::parser::read_number;
+use crate::util::mbf5::{CalcResult, FloatError, Mbf5, Mbf5Accum};
+use rand::rngs::StdRng;
+use rand::{Rng, SeedableRng};
+use smallvec::SmallVec;
+use std::convert::TryFrom;
+use std::rc::Rc;
+use std::str::FromStr;
+
+pub(super) const MAX_STRING_LEN: usize = 255;
+/// The upper bound of each dimension of arrays used without DIM.
+const DEFAULT_BOUND: usize = 10;
+const MAX_ARRAY_LEN: usize = 65535;
+const MAX_FN_DEPTH: usize = 256;
+
+type Fallible<T> = Result<T, String>;
+
+/// Executes a `Code`.
+///
+/// All state of the execution is kept in the machine, so that the execution
+/// can be resumed after `run` returns.
+#[derive(Clone)]
+pub struct Machine {
+  code: Rc<Code>,
+  pc: Addr,
+  nums: Vec<Mbf5Accum>,
+  strs: StrStack,
+  refs: Vec<Ref>,
+  /// Real variables are kept unpacked, already rounded to the precision of
+  /// `Mbf5`, and only packed when their bytes are needed.
+  reals: Vec<Mbf5Accum>,
+  ints: Vec<i16>,
+  strings: Vec<Str>,
+  /// Arrays are copied on write, when shared with a `Snapshot`.
+  real_arrays: Vec<Option<Rc<Array<Mbf5Accum>>>>,
+  int_arrays: Vec<Option<Rc<Array<i16>>>>,
+  str_arrays: Vec<Option<Rc<Array<Str>>>>,
+  funcs: Vec<Option<Func>>,
+  /// FOR, WHILE and GOSUB share one stack.
+  frames: Vec<Frame>,
+  fn_calls: Vec<FnCall>,
+  data_ptr: usize,
+  rng: StdRng,
+  last_rnd: Mbf5Accum,
+  trace: bool,
+  key: Option<u8>,
+  input_line: Option<Vec<u8>>,
+  /// The INPUT statement being executed.
+  input: Option<InputState>,
+  /// Whether the current instruction is waiting, to be executed again.
+  waiting: bool,
+  files: Vfs,
+  fields: Vec<Field>,
+  /// The file written by WRITE #, or `None` for the screen.
+  write_file: Option<usize>,
+}
+
+/// The state of a `Machine` at some point, taken by `Machine::snapshot`.
+#[derive(Clone)]
+pub struct Snapshot(Machine);
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Ref {
+  Var(VarKind, Slot),
+  /// Offset of the element in the array.
+  Elem(VarKind, Slot, usize),
+}
+
+#[derive(Clone)]
+enum Value {
+  Real(Mbf5Accum),
+  Int(i16),
+  Str(Str),
+}
+
+/// A DIM array, whose elements are stored contiguously in row-major order.
+#[derive(Debug, Clone)]
+pub struct Array<T> {
+  /// Length of each dimension.
+  dims: SmallVec<[usize; 2]>,
+  /// Distance between consecutive indices of each dimension in `data`.
+  strides: SmallVec<[usize; 2]>,
+  data: Vec<T>,
+}
+
+#[derive(Debug, Clone, Copy)]
+struct Func {
+  param: Slot,
+  body: Addr,
+}
+
+#[derive(Debug, Clone, Copy)]
+enum Frame {
+  For {
+    var: Slot,
+    end: Mbf5Accum,
+    step: Mbf5Accum,
+    body: Addr,
+  },
+  GoSub {
+    ret: Addr,
+  },
+  While {
+    start: Addr,
+  },
+}
+
+/// A FIELD variable, bound to `len` bytes at `start` of the record buffer.
+///
+/// The record buffer is the source of truth: GET copies the record into the
+/// bound variables, and LSET and RSET write through to the buffer, so PUT
+/// writes the buffer as it is. Assigning the variable otherwise unbinds it.
+#[derive(Debug, Clone, Copy)]
+struct Field {
+  file: usize,
+  var: Ref,
+  start: usize,
+  len: usize,
+}
+
+#[derive(Clone)]
+struct InputState {
+  prompt: Vec<u8>,
+  /// Values read so far.
+  values: Vec<Value>,
+}
+
+#[derive(Debug, Clone, Copy)]
+struct FnCall {
+  ret: Addr,
+  param: Slot,
+  saved: Mbf5Accum,
+}
+
+impl<T: Clone> Array<T> {
+  fn new(dims: SmallVec<[usize; 2]>, init: T) -> Fallible<Self> {
+    let len = dims
+      .iter()
+      .try_fold(1usize, |len, &dim| len.checked_mul(dim))
+      .filter(|&len| len <= MAX_ARRAY_LEN)
+      .ok_or_else(|| "数组过大".to_owned())?;
+    let mut strides = SmallVec::from_elem(1, dims.len());
+    for i in (1..dims.len()).rev() {
+      strides[i - 1] = strides[i] * dims[i];
+    }
+    Ok(Self {
+      dims,
+      strides,
+      data: vec![init; len],
+    })
+  }
+
+  /// Returns the offset of the element of `indices` in `data`.
+  fn offset(&self, indices: &[Mbf5Accum]) -> Fallible<usize> {
+    if indices.len() != self.dims.len() {
+      for &index in indices {
+        to_index(index)?;
+      }
+      return Err("数组维数不匹配".to_owned());
+    }
+    let mut offset = 0;
+    for ((&index, &dim), &stride) in
+      indices.iter().zip(&self.dims).zip(&self.strides)
+    {
+      let index = to_index(index)?;
+      if index >= dim {
+        return Err("数组下标超出范围".to_owned());
+      }
+      offset += index * stride;
+    }
+    Ok(offset)
+  }
+}
+
+impl<T> Array<T> {
+  /// Returns the length of each dimension, which is the bound plus 1.
+  pub fn dims(&self) -> &[usize] {
+    &self.dims
+  }
+
+  /// Returns the elements in row-major order.
+  pub fn data(&self) -> &[T] {
+    &self.data
+  }
+}
+
+impl Ref {
+  fn kind(&self) -> VarKind {
+    match self {
+      Self::Var(kind, _) | Self::Elem(kind, _, _) => *kind,
+    }
+  }
+}
+
+impl Machine {
+  pub fn new(code: Code) -> Self {
+    let mut machine = Self {
+      code: Rc::new(code),
+      pc: 0,
+      nums: vec![],
+      strs: StrStack::default(),
+      refs: vec![],
+      reals: vec![],
+      ints: vec![],
+      strings: vec![],
+      real_arrays: vec![],
+      int_arrays: vec![],
+      str_arrays: vec![],
+      funcs: vec![],
+      frames: vec![],
+      fn_calls: vec![],
+      data_ptr: 0,
+      // The device always produces the same random numbers after booting.
+      rng: StdRng::seed_from_u64(0),
+      last_rnd: zero(),
+      trace: false,
+      key: None,
+      input_line: None,
+      input: None,
+      waiting: false,
+      files: Vfs::default(),
+      fields: vec![],
+      write_file: None,
+    };
+    machine.clear();
+    machine
+  }
+
+  pub fn code(&self) -> &Code {
+    &self.code
+  }
+
+  /// Whether TRACE is turned on.
+  pub fn is_tracing(&self) -> bool {
+    self.trace
+  }
+
+  /// Runs at most `budget` instructions. The execution can be resumed by
+  /// calling `run` again, unless it ends or fails.
+  pub fn run(&mut self, device: &mut impl Device, budget: usize) -> ExecResult {
+    self.run_profiled(device, budget, &mut NoProfiler)
+  }
+
+  /// Same as `run`, reporting the execution to `profiler`.
+  pub fn run_profiled<P: Profiler>(
+    &mut self,
+    device: &mut impl Device,
+    budget: usize,
+    profiler: &mut P,
+  ) -> ExecResult {
+    let result = self.run_steps(device, budget, profiler);
+    if P::ENABLED {
+      profiler.pause();
+    }
+    result
+  }
+
+  fn run_steps<P: Profiler>(
+    &mut self,
+    device: &mut impl Device,
+    budget: usize,
+    profiler: &mut P,
+  ) -> ExecResult {
+    let mut budget = budget;
+    let mut resumed = std::mem::take(&mut self.waiting);
+    while budget != 0 {
+      budget -= 1;
+      let addr = self.pc;
+      if P::ENABLED {
+        profiler.step(addr, resumed);
+        resumed = false;
+      }
+      match self.step(device, profiler) {
+        Ok(None) => {}
+        Ok(Some(result)) => return result,
+        Err(message) => {
+          self.pc = addr;
+          // The error of the program is more relevant than that of flushing.
+          let _ = self.files.flush(device.files());
+          return ExecResult::Error(self.error(addr, message));
+        }
+      }
+    }
+    ExecResult::Pause
+  }
+
+  /// Copies the whole state of the execution. Arrays, the code and the pages
+  /// of open files are shared with the machine until either is modified, so
+  /// taking snapshots frequently only copies what changes in between.
+  ///
+  /// Files on the host are not part of the snapshot.
+  pub fn snapshot(&self) -> Snapshot {
+    Snapshot(self.clone())
+  }
+
+  /// Returns to the state of `snapshot`, which can be restored again later.
+  pub fn restore(&mut self, snapshot: &Snapshot) {
+    *self = snapshot.0.clone();
+  }
+
+  /// Sets the prefix of the names of files on the host, so that each program
+  /// has its own files.
+  pub fn set_file_prefix(&mut self, prefix: &[u8]) {
+    self.files.set_prefix(prefix);
+  }
+
+  /// Writes back the modified data of open files to the host. Files are
+  /// also written back when they are closed, and when the program ends or
+  /// fails.
+  pub fn flush_files(
+    &mut self,
+    device: &mut impl Device,
+  ) -> Result<(), String> {
+    self.files.flush(device.files())
+  }
+
+  /// Gives the key waited for after `run` returns `ExecResult::InKey`.
+  pub fn set_key(&mut self, key: u8) {
+    self.key = Some(key);
+  }
+
+  /// Gives the line waited for after `run` returns `ExecResult::Input`.
+  pub fn set_input(&mut self, line: Vec<u8>) {
+    self.input_line = Some(line);
+  }
+
+  /// Returns the real variables, indexed by slot. Names of variables and
+  /// arrays are in `Code::var_names` and `Code::array_names`.
+  pub fn real_vars(&self) -> &[Mbf5Accum] {
+    &self.reals
+  }
+
+  pub fn int_vars(&self) -> &[i16] {
+    &self.ints
+  }
+
+  pub fn str_vars(&self) -> &[Str] {
+    &self.strings
+  }
+
+  /// Returns `None` if the array is not defined yet.
+  pub fn real_array(&self, slot: Slot) -> Option<&Array<Mbf5Accum>> {
+    self.real_arrays.get(slot as usize)?.as_deref()
+  }
+
+  pub fn int_array(&self, slot: Slot) -> Option<&Array<i16>> {
+    self.int_arrays.get(slot as usize)?.as_deref()
+  }
+
+  pub fn str_array(&self, slot: Slot) -> Option<&Array<Str>> {
+    self.str_arrays.get(slot as usize)?.as_deref()
+  }
+
+  /// Sets a variable, or the element at `offset` in the data of an array, to
+  /// `value`, which is parsed like the input of INPUT for numbers. Fails if
+  /// there is no such variable, or the array is not allocated.
+  pub fn set_var(
+    &mut self,
+    kind: VarKind,
+    slot: Slot,
+    offset: Option<usize>,
+    value: &[u8],
+  ) -> Result<(), String> {
+    if offset.is_none() && slot as usize >= self.code.num_vars[kind as usize] {
+      return Err("变量未定义".to_owned());
+    }
+    let value = match kind {
+      VarKind::Str => {
+        if value.len() > MAX_STRING_LEN {
+          return Err("字符串过长".to_owned());
+        }
+        Value::Str(Str::from_slice(value))
+      }
+      _ => {
+        let num = parse_num(value)?.ok_or_else(|| "非法的参数值".to_owned())?;
+        num_value(kind, num)?
+      }
+    };
+    let r = match offset {
+      None => Ref::Var(kind, slot),
+      Some(offset) => {
+        let len = match kind {
+          VarKind::Real => self.real_array(slot).map(|a| a.data.len()),
+          VarKind::Int => self.int_array(slot).map(|a| a.data.len()),
+          VarKind::Str => self.str_array(slot).map(|a| a.data.len()),
+        };
+        if offset >= len.ok_or_else(|| "数组未定义".to_owned())? {
+          return Err("数组下标超出范围".to_owned());
+        }
+        Ref::Elem(kind, slot, offset)
+      }
+    };
+    self.store(r, value);
+    Ok(())
+  }
+
+  /// Makes the current instruction wait, to be executed again when resumed.
+  fn wait(&mut self, result: ExecResult) -> Fallible<Option<ExecResult>> {
+    self.pc -= 1;
+    self.waiting = true;
+    Ok(Some(result))
+  }
+
+  fn error(&self, addr: Addr, message: String) -> ExecError {
+    match self.code.location(addr) {
+      Some(loc) => ExecError {
+        line: loc.line,
+        range: loc.range.clone(),
+        message,
+      },
+      None => ExecError {
+        line: 0,
+        range: Range::new(0, 0),
+        message,
+      },
+    }
+  }
+
+  /// Resets variables, arrays, functions, stacks and the DATA pointer. Files
+  /// must be closed before.
+  fn clear(&mut self) {
+    let [num_reals, num_ints, num_strs] = self.code.num_vars;
+    self.reals = vec![zero(); num_reals];
+    self.ints = vec![0; num_ints];
+    self.strings = vec![Str::new(); num_strs];
+    let [num_reals, num_ints, num_strs] = self.code.num_arrays;
+    self.real_arrays = vec![None; num_reals];
+    self.int_arrays = vec![None; num_ints];
+    self.str_arrays = vec![None; num_strs];
+    self.funcs = vec![None; self.code.num_funcs];
+    self.nums.clear();
+    self.strs.clear();
+    self.refs.clear();
+    self.frames.clear();
+    self.fn_calls.clear();
+    self.data_ptr = 0;
+    self.input = None;
+    self.fields.clear();
+    self.write_file = None;
+  }
+
+  /// Executes one instruction. Returns `None` if the execution continues.
+  fn step<P: Profiler>(
+    &mut self,
+    device: &mut impl Device,
+    profiler: &mut P,
+  ) -> Fallible<Option<ExecResult>> {
+    let instr = self.code.instrs[self.pc as usize];
+    self.pc += 1;
+    match instr {
+      Instr::PushNum(num) => self.nums.push(Mbf5Accum::from(&num)),
+      Instr::PushStr(id) => self.strs.push(&self.code.strings[id as usize]),
+      Instr::LoadReal(slot) => self.nums.push(self.reals[slot as usize]),
+      Instr::LoadInt(slot) => self.nums.push(int_num(self.ints[slot as usize])),
+      Instr::LoadStr(slot) => self.strs.push(&self.strings[slot as usize]),
+      Instr::LoadElem(kind, slot, dims) => {
+        let i = self.elem_offset(kind, slot, dims)?;
+        match kind {
+          VarKind::Real => {
+            self.nums.push(array(&self.real_arrays, slot).data[i]);
+          }
+          VarKind::Int => {
+            self
+              .nums
+              .push(int_num(array(&self.int_arrays, slot).data[i]));
+          }
+          VarKind::Str => {
+            self.strs.push(&array(&self.str_arrays, slot).data[i]);
+          }
+        }
+      }
+      Instr::StoreReal(slot) => {
+        let num = self.pop_num();
+        self.reals[slot as usize] = round(num)?;
+      }
+      Instr::StoreInt(slot) => {
+        let num = self.pop_num();
+        self.ints[slot as usize] = to_int(num)?;
+      }
+      Instr::StoreStr(slot) => {
+        if !self.fields.is_empty() {
+          self.unbind(Ref::Var(VarKind::Str, slot));
+        }
+        // Reuses the buffer of the variable.
+        let var = &mut self.strings[slot as usize];
+        var.clear();
+        var.extend_from_slice(self.strs.pop());
+      }
+      Instr::VarRef(kind, slot) => self.refs.push(Ref::Var(kind, slot)),
+      Instr::ElemRef(kind, slot, dims) => {
+        let offset = self.elem_offset(kind, slot, dims)?;
+        self.refs.push(Ref::Elem(kind, slot, offset));
+      }
+      Instr::StoreRef => {
+        let r = self.refs.pop().unwrap();
+        let value = self.pop_value(r.kind())?;
+        self.store(r, value);
+      }
+
+      Instr::Neg | Instr::Not => {
+        let x = self.pop_num();
+        self.nums.push(num_unary(instr, x));
+      }
+      Instr::Add
+      | Instr::Sub
+      | Instr::Mul
+      | Instr::Div
+      | Instr::Pow
+      | Instr::And
+      | Instr::Or
+      | Instr::CmpNum(_) => {
+        let r = self.pop_num();
+        let l = self.pop_num();
+        self.nums.push(num_binary(instr, l, r)?);
+      }
+      Instr::CmpStr(kind) => {
+        let (l, r) = self.strs.pop2();
+        self.nums.push(bool_num(compare(kind, l, r)));
+      }
+      Instr::Concat => {
+        if !self.strs.concat(MAX_STRING_LEN) {
+          return Err("字符串过长".to_owned());
+        }
+      }
+      Instr::SysFunc(kind, arity) => {
+        if P::ENABLED {
+          profiler.sys_func(kind);
+        }
+        self.sys_func(kind, arity, device)?
+      }
+      Instr::CallFn(slot) => {
+        let arg = self.pop_num();
+        let func =
+          self.funcs[slot as usize].ok_or_else(|| "函数未定义".to_owned())?;
+        if self.fn_calls.len() >= MAX_FN_DEPTH {
+          return Err("函数调用层数过多".to_owned());
+        }
+        let param = func.param as usize;
+        let saved = self.reals[param];
+        self.reals[param] = round(arg)?;
+        self.fn_calls.push(FnCall {
+          ret: self.pc,
+          param: func.param,
+          saved,
+        });
+        self.pc = func.body;
+      }
+      Instr::FnReturn => {
+        let call = self.fn_calls.pop().unwrap();
+        self.reals[call.param as usize] = call.saved;
+        self.pc = call.ret;
+      }
+      Instr::Inkey => match self.key.take() {
+        Some(key) => self.strs.push(&[key]),
+        None => return self.wait(ExecResult::InKey),
+      },
+
+      Instr::DefFn { func, param } => {
+        self.funcs[func as usize] = Some(Func {
+          param,
+          body: self.pc + 1,
+        });
+      }
+      Instr::Dim(kind, slot, dims) => {
+        let mut bounds = self.pop_indices(dims)?;
+        for bound in &mut bounds {
+          *bound += 1;
+        }
+        let slot = slot as usize;
+        let defined = match kind {
+          VarKind::Real => {
+            define_array(&mut self.real_arrays[slot], bounds, zero())?
+          }
+          VarKind::Int => define_array(&mut self.int_arrays[slot], bounds, 0)?,
+          VarKind::Str => {
+            define_array(&mut self.str_arrays[slot], bounds, Str::new())?
+          }
+        };
+        if !defined {
+          return Err("重复定义数组".to_owned());
+        }
+      }
+      Instr::Jump(target) => self.jump(target)?,
+      Instr::JumpIfZero(target) => {
+        if self.pop_num().is_zero() {
+          self.jump(target)?;
+        }
+      }
+      Instr::GoSub(target) => {
+        let ret = self.pc;
+        self.jump(target)?;
+        self.frames.push(Frame::GoSub { ret });
+        if P::ENABLED {
+          profiler.gosub(self.gosub_depth());
+        }
+      }
+      Instr::Return => {
+        let i = self
+          .find_frame(|f| matches!(f, Frame::GoSub { .. }))
+          .ok_or_else(|| "RETURN 没有对应的 GOSUB".to_owned())?;
+        if let Frame::GoSub { ret } = self.frames[i] {
+          self.pc = ret;
+        }
+        self.frames.truncate(i);
+      }
+      Instr::Pop => {
+        let i = self
+          .find_frame(|f| matches!(f, Frame::GoSub { .. }))
+          .ok_or_else(|| "POP 没有对应的 GOSUB".to_owned())?;
+        self.frames.truncate(i);
+      }
+      Instr::On { count, is_sub } => {
+        let n = self.pop_u8()? as u32;
+        let next = self.pc + count as u32;
+        if n >= 1 && n <= count as u32 {
+          let target = match self.code.instrs[(self.pc + n - 1) as usize] {
+            Instr::Jump(target) => target,
+            _ => unreachable!(),
+          };
+          self.jump(target)?;
+          if is_sub {
+            self.frames.push(Frame::GoSub { ret: next });
+            if P::ENABLED {
+              profiler.gosub(self.gosub_depth());
+            }
+          }
+        } else {
+          self.pc = next;
+        }
+      }
+      Instr::For(var) => {
+        let step = self.pop_num();
+        let end = self.pop_num();
+        if let Some(i) = self
+          .find_frame(|f| matches!(f, Frame::For { var: v, .. } if *v == var))
+        {
+          self.frames.truncate(i);
+        }
+        self.frames.push(Frame::For {
+          var,
+          end,
+          step,
+          body: self.pc,
+        });
+      }
+      Instr::Next(var) => {
+        let i = self
+          .find_frame(|f| matches!(f, Frame::For { var: v, .. } if *v == var))
+          .ok_or_else(|| "NEXT 没有对应的 FOR".to_owned())?;
+        self.next(i)?;
+      }
+      Instr::NextAny => {
+        let i = self
+          .find_frame(|f| matches!(f, Frame::For { .. }))
+          .ok_or_else(|| "NEXT 没有对应的 FOR".to_owned())?;
+        self.next(i)?;
+      }
+      Instr::While { cond_len, exit } => {
+        let start = self.pc - 1 - cond_len as Addr;
+        let is_top = matches!(
+          self.frames.last(),
+          Some(Frame::While { start: s }) if *s == start
+        );
+        if !self.pop_num().is_zero() {
+          if !is_top {
+            self.frames.push(Frame::While { start });
+          }
+        } else {
+          if is_top {
+            self.frames.pop();
+          }
+          if exit == NO_ADDR {
+            return Err("WHILE 没有对应的 WEND".to_owned());
+          }
+          self.pc = exit;
+        }
+      }
+      Instr::Wend => {
+        let i = self
+          .find_frame(|f| matches!(f, Frame::While { .. }))
+          .ok_or_else(|| "WEND 没有对应的 WHILE".to_owned())?;
+        self.frames.truncate(i + 1);
+        if let Frame::While { start } = self.frames[i] {
+          self.pc = start;
+        }
+      }
+      Instr::End => {
+        self.files.flush(device.files())?;
+        return self.wait(ExecResult::End);
+      }
+      Instr::Read => {
+        let r = self.refs.pop().unwrap();
+        let datum = *self
+          .code
+          .data
+          .get(self.data_ptr)
+          .ok_or_else(|| "DATA 已读完".to_owned())?;
+        self.data_ptr += 1;
+        let value = match (r.kind(), datum.num) {
+          (VarKind::Str, _) => Value::Str(Str::from_slice(
+            &self.code.data_text[datum.start as usize..datum.end as usize],
+          )),
+          (kind, DataNum::Num(num)) => num_value(kind, Mbf5Accum::from(&num))?,
+          (_, DataNum::Quoted) => return Err("类型不匹配".to_owned()),
+          (_, DataNum::Malformed) => return Err("语法错误".to_owned()),
+          (_, DataNum::Infinite) => return Err("数值溢出".to_owned()),
+        };
+        self.store(r, value);
+      }
+      Instr::Restore(index) => self.data_ptr = index as usize,
+      Instr::Swap => {
+        let r2 = self.refs.pop().unwrap();
+        let r1 = self.refs.pop().unwrap();
+        let v1 = self.load(r1);
+        let v2 = self.load(r2);
+        self.store(r1, v2);
+        self.store(r2, v1);
+      }
+      Instr::LSet | Instr::RSet => {
+        let r = self.refs.pop().unwrap();
+        let mut old = match self.load(r) {
+          Value::Str(s) => s,
+          _ => unreachable!(),
+        };
+        let new = self.strs.pop();
+        let len = new.len().min(old.len());
+        if let Instr::LSet = instr {
+          old[..len].copy_from_slice(&new[..len]);
+        } else {
+          let pad = old.len() - len;
+          old[..pad].fill(b' ');
+          old[pad..].copy_from_slice(&new[..len]);
+        }
+        if let Some(f) = self.fields.iter().find(|f| f.var == r) {
+          let record = self.files.record_mut(f.file)?;
+          record[f.start..f.start + f.len].copy_from_slice(&old);
+        }
+        self.assign(r, Value::Str(old));
+      }
+      Instr::Input { count, has_prompt } => {
+        return self.input(count as usize, has_prompt, device)
+      }
+
+      Instr::PrintNum => {
+        let x = to_mbf5(self.pop_num())?;
+        let mut buf = [0; Mbf5::MAX_DISPLAY_LEN];
+        device.print(x.format_into(&mut buf).as_bytes());
+      }
+      Instr::WriteNum => {
+        let x = to_mbf5(self.pop_num())?;
+        let mut buf = [0; Mbf5::MAX_DISPLAY_LEN];
+        let text = x.format_into(&mut buf).as_bytes();
+        write_out(&mut self.files, self.write_file, device, text)?;
+      }
+      Instr::PrintStr => device.print(until_nul(self.strs.pop())),
+      Instr::PrintSpace => device.print(b" "),
+      Instr::Newline => device.newline(),
+      Instr::NewlineIfNeeded => {
+        if device.cursor().1 != 0 {
+          device.newline();
+        }
+      }
+      Instr::WriteStr => {
+        let s = self.strs.pop();
+        let text = until_nul(s);
+        let (files, file) = (&mut self.files, self.write_file);
+        write_out(files, file, device, b"\"")?;
+        write_out(files, file, device, text)?;
+        // Strings with NUL are not closed.
+        if text.len() == s.len() {
+          write_out(files, file, device, b"\"")?;
+        }
+      }
+      Instr::WriteComma => {
+        write_out(&mut self.files, self.write_file, device, b",")?;
+      }
+      Instr::DiscardNum => {
+        self.pop_num();
+      }
+      Instr::DiscardStr => {
+        self.strs.pop();
+      }
+      Instr::Locate { row, column } => {
+        let (mut cur_row, mut cur_column) = device.cursor();
+        if column {
+          let c = self.pop_u8()?;
+          if c < 1 || c > 20 {
+            return Err("非法的参数值".to_owned());
+          }
+          cur_column = c - 1;
+        }
+        if row {
+          let r = self.pop_u8()?;
+          if r < 1 || r > 5 {
+            return Err("非法的参数值".to_owned());
+          }
+          cur_row = r - 1;
+        }
+        device.set_cursor(cur_row, cur_column);
+      }
+      Instr::Cls => device.cls(),
+      Instr::Graph => {
+        device.set_screen_mode(ScreenMode::Graph);
+        device.cls();
+      }
+      Instr::Text => {
+        device.set_screen_mode(ScreenMode::Text);
+        device.cls();
+      }
+      Instr::Inverse => device.set_print_mode(PrintMode::Inverse),
+      Instr::Normal => device.set_print_mode(PrintMode::Normal),
+      Instr::Flash => device.set_print_mode(PrintMode::Flash),
+      Instr::Beep => device.beep(),
+      Instr::WaitKey => {
+        if self.key.take().is_none() {
+          return self.wait(ExecResult::InKey);
+        }
+      }
+      Instr::Draw(n) => {
+        let [x, y, mode] = self.pop_graph_args::<3>(n, 2, 3)?;
+        device.draw_point(x, y, draw_mode(mode));
+      }
+      Instr::Line(n) => {
+        let [x1, y1, x2, y2, mode] = self.pop_graph_args::<5>(n, 4, 5)?;
+        device.draw_line(x1, y1, x2, y2, draw_mode(mode));
+      }
+      Instr::Box(n) => {
+        let [x1, y1, x2, y2, fill, mode] = self.pop_graph_args::<6>(n, 4, 6)?;
+        device.draw_box(x1, y1, x2, y2, fill & 1 != 0, draw_mode(mode));
+      }
+      Instr::Circle(n) => {
+        let [x, y, r, fill, mode] = self.pop_graph_args::<5>(n, 3, 5)?;
+        device.draw_circle(x, y, r, fill & 1 != 0, draw_mode(mode));
+      }
+      Instr::Ellipse(n) => {
+        let [x, y, rx, ry, fill, mode] = self.pop_graph_args::<6>(n, 4, 6)?;
+        device.draw_ellipse(x, y, rx, ry, fill & 1 != 0, draw_mode(mode));
+      }
+      Instr::Poke => {
+        let value = self.pop_u8()?;
+        let addr = self.pop_addr()?;
+        device.poke(addr, value);
+      }
+      Instr::Call => {
+        let addr = self.pop_addr()?;
+        device.call(addr);
+      }
+      Instr::Clear => {
+        self.files.close_all(device.files())?;
+        self.clear();
+      }
+      Instr::Run => {
+        device.set_screen_mode(ScreenMode::Text);
+        device.cls();
+        self.files.close_all(device.files())?;
+        self.clear();
+        self.pc = 0;
+      }
+      Instr::Trace(on) => self.trace = on,
+      Instr::Open { mode, has_len } => {
+        let len = if has_len { Some(self.pop_u8()?) } else { None };
+        let file = self.pop_file()?;
+        let name = self.strs.pop();
+        self.files.open(device.files(), file, name, mode, len)?;
+      }
+      Instr::Close => {
+        let file = self.pop_file()?;
+        self.files.close(device.files(), file)?;
+        self.fields.retain(|f| f.file != file);
+      }
+      Instr::Field(count) => self.field(count as usize)?,
+      Instr::Get => {
+        let record = self.pop_record()?;
+        let file = self.pop_file()?;
+        let bytes = self.files.get(device.files(), file, record)?;
+        for f in self.fields.iter().filter(|f| f.file == file) {
+          let value = Str::from_slice(&bytes[f.start..f.start + f.len]);
+          match f.var {
+            Ref::Var(_, slot) => self.strings[slot as usize] = value,
+            Ref::Elem(_, slot, i) => {
+              array_mut(&mut self.str_arrays, slot).data[i] = value
+            }
+          }
+        }
+      }
+      Instr::Put => {
+        let record = self.pop_record()?;
+        let file = self.pop_file()?;
+        self.files.put(device.files(), file, record)?;
+      }
+      Instr::InputFile(count) => {
+        let refs = self.refs.split_off(self.refs.len() - count as usize);
+        let file = self.pop_file()?;
+        for r in refs {
+          let value = self.input_file_field(device, file, r.kind())?;
+          self.store(r, value);
+        }
+      }
+      Instr::BeginWriteFile => {
+        let file = self.pop_file()?;
+        // Checks the mode before any datum is written.
+        self.files.write(device.files(), file, &[])?;
+        self.write_file = Some(file);
+      }
+      Instr::EndWriteFile => {
+        let file = self.write_file.take().unwrap();
+        self.files.write(device.files(), file, &[0xff])?;
+      }
+      Instr::SyntaxError => return Err("语法错误".to_owned()),
+    }
+    Ok(None)
+  }
+
+  fn jump(&mut self, target: Addr) -> Fallible<()> {
+    if target == NO_ADDR {
+      return Err("行号不存在".to_owned());
+    }
+    self.pc = target;
+    Ok(())
+  }
+
+  fn gosub_depth(&self) -> usize {
+    let frames = self.frames.iter();
+    frames.filter(|f| matches!(f, Frame::GoSub { .. })).count()
+  }
+
+  fn find_frame(&self, pred: impl Fn(&Frame) -> bool) -> Option<usize> {
+    self.frames.iter().rposition(pred)
+  }
+
+  /// Continues the FOR loop of the frame at `i`.
+  fn next(&mut self, i: usize) -> Fallible<()> {
+    self.frames.truncate(i + 1);
+    let (var, end, step, body) = match self.frames[i] {
+      Frame::For {
+        var,
+        end,
+        step,
+        body,
+      } => (var, end, step, body),
+      _ => unreachable!(),
+    };
+    let value = round(calc(self.reals[var as usize] + step)?)?;
+    self.reals[var as usize] = value;
+    let done = if step.is_positive() {
+      value > end
+    } else if step.is_negative() {
+      value < end
+    } else {
+      value == end
+    };
+    if done {
+      self.frames.truncate(i);
+    } else {
+      self.pc = body;
+    }
+    Ok(())
+  }
+
+  /// Executes INPUT, which is executed again for every line of input.
+  fn input(
+    &mut self,
+    count: usize,
+    has_prompt: bool,
+    device: &mut impl Device,
+  ) -> Fallible<Option<ExecResult>> {
+    let mut state = match self.input.take() {
+      Some(state) => state,
+      None => {
+        let prompt = if has_prompt {
+          let mut prompt = self.strs.pop().to_vec();
+          prompt.retain(|&c| c != 0x1f);
+          prompt
+        } else {
+          b"?".to_vec()
+        };
+        device.print(&prompt);
+        self.input = Some(InputState {
+          prompt,
+          values: Vec::with_capacity(count),
+        });
+        return self.wait(ExecResult::Input);
+      }
+    };
+    let line = match self.input_line.take() {
+      Some(line) => line,
+      None => {
+        self.input = Some(state);
+        return self.wait(ExecResult::Input);
+      }
+    };
+
+    let first_ref = self.refs.len() - count;
+    let mut input = &line[..];
+    while state.values.len() < count {
+      let kind = self.refs[first_ref + state.values.len()].kind();
+      match input_field(input, kind)? {
+        Some((value, rest)) => {
+          state.values.push(value);
+          match rest {
+            Some(rest) => input = rest,
+            None => break,
+          }
+        }
+        None => {
+          device.print(b"?REENTER");
+          device.newline();
+          device.print(&state.prompt);
+          state.values.clear();
+          self.input = Some(state);
+          return self.wait(ExecResult::Input);
+        }
+      }
+    }
+    if state.values.len() < count {
+      device.print(b"?");
+      self.input = Some(state);
+      return self.wait(ExecResult::Input);
+    }
+
+    let refs = self.refs.split_off(first_ref);
+    for (r, value) in refs.into_iter().zip(state.values) {
+      self.store(r, value);
+    }
+    Ok(None)
+  }
+
+  fn sys_func(
+    &mut self,
+    kind: SysFuncKind,
+    arity: u8,
+    device: &mut impl Device,
+  ) -> Fallible<()> {
+    match kind {
+      SysFuncKind::Abs
+      | SysFuncKind::Atn
+      | SysFuncKind::Cos
+      | SysFuncKind::Exp
+      | SysFuncKind::Int
+      | SysFuncKind::Log
+      | SysFuncKind::Sgn
+      | SysFuncKind::Sin
+      | SysFuncKind::Sqr
+      | SysFuncKind::Tan => {
+        let x = self.pop_num();
+        self.nums.push(num_sys_func(kind, x)?);
+      }
+      SysFuncKind::Asc => {
+        let s = self.strs.pop();
+        let c = *s.first().ok_or_else(|| "非法的参数值".to_owned())?;
+        self.nums.push(int_num(c as i16));
+      }
+      SysFuncKind::Chr => {
+        let c = self.pop_u8()?;
+        self.strs.push(&[c]);
+      }
+      SysFuncKind::Cvi => {
+        let s = self.strs.pop();
+        let bytes =
+          <[u8; 2]>::try_from(s).map_err(|_| "语法错误".to_owned())?;
+        self.nums.push(int_num(i16::from_le_bytes(bytes)));
+      }
+      SysFuncKind::Cvs => {
+        let s = self.strs.pop();
+        let bytes =
+          <[u8; 5]>::try_from(s).map_err(|_| "语法错误".to_owned())?;
+        self.nums.push(Mbf5Accum::from(&Mbf5::from(bytes)));
+      }
+      SysFuncKind::Eof => {
+        let file = self.pop_file()?;
+        let eof = self.files.eof(file)?;
+        self.nums.push(bool_num(eof));
+      }
+      SysFuncKind::Lof => {
+        let file = self.pop_file()?;
+        let len = self.files.lof(file)?;
+        self.nums.push(calc(Mbf5Accum::try_from(len as f64))?);
+      }
+      SysFuncKind::Left | SysFuncKind::Right => {
+        let len = self.pop_u8()? as usize;
+        if len == 0 {
+          return Err("非法的参数值".to_owned());
+        }
+        let s_len = self.strs.last().len();
+        let len = len.min(s_len);
+        if let SysFuncKind::Left = kind {
+          self.strs.keep(0..len);
+        } else {
+          self.strs.keep(s_len - len..s_len);
+        }
+      }
+      SysFuncKind::Len => {
+        let len = self.strs.pop().len();
+        self.nums.push(int_num(len as i16));
+      }
+      SysFuncKind::Mid => {
+        let len = if arity == 3 {
+          self.pop_u8()? as usize
+        } else {
+          MAX_STRING_LEN
+        };
+        let pos = self.pop_u8()? as usize;
+        if pos == 0 {
+          return Err("非法的参数值".to_owned());
+        }
+        let s_len = self.strs.last().len();
+        let start = (pos - 1).min(s_len);
+        let end = (start + len).min(s_len);
+        self.strs.keep(start..end);
+      }
+      SysFuncKind::Mki => {
+        let x = to_int(self.pop_num())?;
+        self.strs.push(&x.to_le_bytes());
+      }
+      SysFuncKind::Mks => {
+        let x = to_mbf5(self.pop_num())?;
+        self.strs.push(x.as_array());
+      }
+      SysFuncKind::Peek => {
+        let addr = self.pop_addr()?;
+        let value = device.peek(addr);
+        self.nums.push(int_num(value as i16));
+      }
+      SysFuncKind::Pos => {
+        self.pop_num();
+        self.nums.push(int_num(device.cursor().1 as i16));
+      }
+      SysFuncKind::Rnd => {
+        let x = self.pop_num();
+        if x.is_negative() {
+          let seed: f64 = x.into();
+          self.rng = StdRng::seed_from_u64(seed.to_bits());
+        }
+        if !x.is_zero() {
+          let r: f64 = self.rng.gen();
+          self.last_rnd = calc(Mbf5Accum::try_from(r))?;
+        }
+        self.nums.push(self.last_rnd);
+      }
+      SysFuncKind::Str => {
+        let x = to_mbf5(self.pop_num())?;
+        let mut buf = [0; Mbf5::MAX_DISPLAY_LEN];
+        self.strs.push(x.format_into(&mut buf).as_bytes());
+      }
+      SysFuncKind::Val => {
+        let s = self.strs.pop();
+        let s = &s[s.iter().take_while(|&&c| c == b' ').count()..];
+        let (len, _) = read_number(s, true);
+        let num = parse_num(&s[..len])?.unwrap_or_else(zero);
+        self.nums.push(num);
+      }
+    }
+    Ok(())
+  }
+
+  fn pop_num(&mut self) -> Mbf5Accum {
+    self.nums.pop().unwrap()
+  }
+
+  /// Pops a file number in 1~3, and returns it minus 1.
+  fn pop_file(&mut self) -> Fallible<usize> {
+    let n = self.pop_u8()? as usize;
+    if n < 1 || n > NUM_FILES {
+      return Err("非法的参数值".to_owned());
+    }
+    Ok(n - 1)
+  }
+
+  /// Pops a record number in -32768~32767 except 0. Negative numbers are
+  /// converted to their two's complement.
+  fn pop_record(&mut self) -> Fallible<u16> {
+    let x: f64 = self.pop_num().into();
+    let x = x.trunc();
+    if x >= -32768.0 && x <= 32767.0 && x != 0.0 {
+      Ok(x as i16 as u16)
+    } else {
+      Err("非法的参数值".to_owned())
+    }
+  }
+
+  /// Pops a number in 0~255.
+  fn pop_u8(&mut self) -> Fallible<u8> {
+    to_u8(self.pop_num())
+  }
+
+  /// Pops an address in -65535~65535. Negative addresses are converted to
+  /// their two's complement.
+  fn pop_addr(&mut self) -> Fallible<u16> {
+    let x: f64 = self.pop_num().into();
+    let x = x.trunc();
+    if x >= -65535.0 && x <= 65535.0 {
+      Ok(x as i32 as u16)
+    } else {
+      Err("非法的参数值".to_owned())
+    }
+  }
+
+  /// Pops `n` arguments, where `min <= n <= N`. Omitted arguments are 0.
+  fn pop_graph_args<const N: usize>(
+    &mut self,
+    n: u8,
+    min: usize,
+    max: usize,
+  ) -> Fallible<[u8; N]> {
+    let n = n as usize;
+    if n < min || n > max {
+      return Err("语法错误".to_owned());
+    }
+    let mut args = [0; N];
+    for i in (0..n).rev() {
+      args[i] = self.pop_u8()?;
+    }
+    // Both fill mode and draw mode default to 1 when omitted.
+    for arg in &mut args[n..] {
+      *arg = 1;
+    }
+    Ok(args)
+  }
+
+  fn pop_indices(&mut self, dims: u8) -> Fallible<SmallVec<[usize; 2]>> {
+    let mut indices = SmallVec::with_capacity(dims as usize);
+    for _ in 0..dims {
+      indices.push(to_index(self.pop_num())?);
+    }
+    indices.reverse();
+    Ok(indices)
+  }
+
+  /// Pops the indices and returns the offset of the element, allocating the
+  /// array if it's not defined.
+  fn elem_offset(
+    &mut self,
+    kind: VarKind,
+    slot: Slot,
+    dims: u8,
+  ) -> Fallible<usize> {
+    // The indices are read in place, without popping them one by one.
+    let start = self.nums.len() - dims as usize;
+    let indices = &self.nums[start..];
+    let slot = slot as usize;
+    let offset = match kind {
+      VarKind::Real => {
+        elem_offset(&mut self.real_arrays[slot], indices, zero())
+      }
+      VarKind::Int => elem_offset(&mut self.int_arrays[slot], indices, 0),
+      VarKind::Str => {
+        elem_offset(&mut self.str_arrays[slot], indices, Str::new())
+      }
+    };
+    self.nums.truncate(start);
+    offset
+  }
+
+  fn pop_value(&mut self, kind: VarKind) -> Fallible<Value> {
+    match kind {
+      VarKind::Str => Ok(Value::Str(Str::from_slice(self.strs.pop()))),
+      kind => {
+        let num = self.pop_num();
+        num_value(kind, num)
+      }
+    }
+  }
+
+  fn load(&self, r: Ref) -> Value {
+    match r {
+      Ref::Var(VarKind::Real, slot) => Value::Real(self.reals[slot as usize]),
+      Ref::Var(VarKind::Int, slot) => Value::Int(self.ints[slot as usize]),
+      Ref::Var(VarKind::Str, slot) => {
+        Value::Str(self.strings[slot as usize].clone())
+      }
+      Ref::Elem(VarKind::Real, slot, i) => {
+        Value::Real(array(&self.real_arrays, slot).data[i])
+      }
+      Ref::Elem(VarKind::Int, slot, i) => {
+        Value::Int(array(&self.int_arrays, slot).data[i])
+      }
+      Ref::Elem(VarKind::Str, slot, i) => {
+        Value::Str(array(&self.str_arrays, slot).data[i].clone())
+      }
+    }
+  }
+
+  /// Executes FIELD.
+  fn field(&mut self, count: usize) -> Fallible<()> {
+    let refs = self.refs.split_off(self.refs.len() - count);
+    let mut lens = vec![0; count];
+    for len in lens.iter_mut().rev() {
+      *len = self.pop_u8()? as usize;
+    }
+    let file = self.pop_file()?;
+    if lens.iter().sum::<usize>() > self.files.record_len(file)? {
+      return Err("FIELD 长度超过记录长度".to_owned());
+    }
+    let record = self.files.record_mut(file)?;
+    let mut start = 0;
+    for (&var, &len) in refs.iter().zip(&lens) {
+      record[start..start + len].fill(0);
+      self.fields.retain(|f| f.var != var);
+      self.fields.push(Field {
+        file,
+        var,
+        start,
+        len,
+      });
+      start += len;
+    }
+    for (&var, &len) in refs.iter().zip(&lens) {
+      self.assign(var, Value::Str(SmallVec::from_elem(0, len)));
+    }
+    Ok(())
+  }
+
+  /// Reads a datum written by WRITE # from the file.
+  fn input_file_field(
+    &mut self,
+    device: &mut impl Device,
+    file: usize,
+    kind: VarKind,
+  ) -> Fallible<Value> {
+    let fs = device.files();
+    let mut datum = SmallVec::<[u8; 32]>::new();
+    let mut c = self.files.read_byte(fs, file)?;
+    let quoted = kind == VarKind::Str && c == Some(b'"');
+    if quoted {
+      loop {
+        match self.files.read_byte(fs, file)? {
+          Some(b'"') => break,
+          Some(c) => datum.push(c),
+          None => return Err("文件读写错误".to_owned()),
+        }
+      }
+      c = self.files.read_byte(fs, file)?;
+    }
+    // The end of the file counts as 0xFF.
+    while !matches!(c, Some(b',' | 0xff) | None) {
+      if quoted {
+        return Err("文件读写错误".to_owned());
+      }
+      datum.push(c.unwrap());
+      c = self.files.read_byte(fs, file)?;
+    }
+    if kind == VarKind::Str {
+      if datum.len() > MAX_STRING_LEN {
+        return Err("字符串过长".to_owned());
+      }
+      return Ok(Value::Str(Str::from_slice(&datum)));
+    }
+    let num = if read_number(&datum, false).0 == datum.len() {
+      parse_num(&datum)?
+    } else {
+      None
+    };
+    num_value(kind, num.ok_or_else(|| "类型不匹配".to_owned())?)
+  }
+
+  /// Breaks the FIELD binding of a variable, which is assigned.
+  fn unbind(&mut self, var: Ref) {
+    self.fields.retain(|f| f.var != var);
+  }
+
+  fn store(&mut self, r: Ref, value: Value) {
+    if r.kind() == VarKind::Str && !self.fields.is_empty() {
+      self.unbind(r);
+    }
+    self.assign(r, value);
+  }
+
+  /// Stores the value without touching FIELD bindings.
+  fn assign(&mut self, r: Ref, value: Value) {
+    match (r, value) {
+      (Ref::Var(_, slot), Value::Real(x)) => self.reals[slot as usize] = x,
+      (Ref::Var(_, slot), Value::Int(x)) => self.ints[slot as usize] = x,
+      (Ref::Var(_, slot), Value::Str(s)) => self.strings[slot as usize] = s,
+      (Ref::Elem(_, slot, i), Value::Real(x)) => {
+        array_mut(&mut self.real_arrays, slot).data[i] = x
+      }
+      (Ref::Elem(_, slot, i), Value::Int(x)) => {
+        array_mut(&mut self.int_arrays, slot).data[i] = x
+      }
+      (Ref::Elem(_, slot, i), Value::Str(s)) => {
+        array_mut(&mut self.str_arrays, slot).data[i] = s
+      }
+    }
+  }
+}
+
+fn array<T>(arrays: &[Option<Rc<Array<T>>>], slot: Slot) -> &Array<T> {
+  arrays[slot as usize].as_ref().unwrap()
+}
+
+/// Copies the array first if it's shared with a snapshot.
+fn array_mut<T: Clone>(
+  arrays: &mut [Option<Rc<Array<T>>>],
+  slot: Slot,
+) -> &mut Array<T> {
+  Rc::make_mut(arrays[slot as usize].as_mut().unwrap())
+}
+
+/// Returns false if the array is already defined.
+fn define_array<T: Clone>(
+  array: &mut Option<Rc<Array<T>>>,
+  dims: SmallVec<[usize; 2]>,
+  init: T,
+) -> Fallible<bool> {
+  if array.is_some() {
+    return Ok(false);
+  }
+  *array = Some(Rc::new(Array::new(dims, init)?));
+  Ok(true)
+}
+
+fn elem_offset<T: Clone>(
+  array: &mut Option<Rc<Array<T>>>,
+  indices: &[Mbf5Accum],
+  init: T,
+) -> Fallible<usize> {
+  if array.is_none() {
+    let dims = SmallVec::from_elem(DEFAULT_BOUND + 1, indices.len());
+    *array = Some(Rc::new(Array::new(dims, init)?));
+  }
+  array.as_ref().unwrap().offset(indices)
+}
+
+/// Reads a field of the input of INPUT. Returns `None` if the field is not a
+/// valid number, otherwise returns the value and the rest of the input after
+/// the comma, or `None` if the input is exhausted.
+#[allow(clippy::type_complexity)]
+fn input_field(
+  input: &[u8],
+  kind: VarKind,
+) -> Fallible<Option<(Value, Option<&[u8]>)>> {
+  let input = &input[input.iter().take_while(|&&c| c == b' ').count()..];
+  let (value, rest) = if kind == VarKind::Str {
+    if let Some(b'"') = input.first() {
+      let input = &input[1..];
+      let len = input.iter().position(|&c| c == b'"').unwrap_or(input.len());
+      let rest = &input[(len + 1).min(input.len())..];
+      let rest = rest
+        .iter()
+        .position(|&c| c == b',' || c == b':')
+        .map_or(&[][..], |i| &rest[i..]);
+      (Value::Str(Str::from_slice(&input[..len])), rest)
+    } else {
+      let len = input
+        .iter()
+        .position(|&c| c == b',' || c == b':')
+        .unwrap_or(input.len());
+      (Value::Str(Str::from_slice(&input[..len])), &input[len..])
+    }
+  } else {
+    let (len, _) = read_number(input, true);
+    let rest = &input[len..];
+    if !matches!(rest.first(), None | Some(b',' | b':')) {
+      return Ok(None);
+    }
+    let num = match parse_num(&input[..len])? {
+      Some(num) => num,
+      None => return Ok(None),
+    };
+    (num_value(kind, num)?, rest)
+  };
+
+  match rest.first() {
+    Some(b',') => Ok(Some((value, Some(&rest[1..])))),
+    _ => Ok(Some((value, None))),
+  }
+}
+
+/// Parses a real number. Returns `None` if it's malformed.
+fn parse_num(s: &[u8]) -> Fallible<Option<Mbf5Accum>> {
+  let s = match std::str::from_utf8(s) {
+    Ok(s) => s,
+    Err(_) => return Ok(None),
+  };
+  match Mbf5::from_str(s) {
+    Ok(num) => Ok(Some(Mbf5Accum::from(&num))),
+    Err(crate::util::mbf5::ParseRealError::Malformed) => Ok(None),
+    Err(crate::util::mbf5::ParseRealError::Infinite) => {
+      Err("数值溢出".to_owned())
+    }
+  }
+}
+
+fn num_value(kind: VarKind, num: Mbf5Accum) -> Fallible<Value> {
+  match kind {
+    VarKind::Real => Ok(Value::Real(round(num)?)),
+    VarKind::Int => Ok(Value::Int(to_int(num)?)),
+    VarKind::Str => unreachable!(),
+  }
+}
+
+// The operations below have no side effects, and are also used for constant
+// folding.
+
+/// Evaluates `Neg` or `Not`.
+pub(super) fn num_unary(instr: Instr, x: Mbf5Accum) -> Mbf5Accum {
+  match instr {
+    Instr::Neg => -x,
+    Instr::Not => bool_num(x.is_zero()),
+    _ => unreachable!(),
+  }
+}
+
+/// Evaluates an arithmetic, logical or comparison instruction of numbers.
+pub(super) fn num_binary(
+  instr: Instr,
+  l: Mbf5Accum,
+  r: Mbf5Accum,
+) -> Fallible<Mbf5Accum> {
+  match instr {
+    Instr::Add => calc(l + r),
+    Instr::Sub => calc(l - r),
+    Instr::Mul => calc(l * r),
+    Instr::Div => {
+      if r.is_zero() {
+        return Err("除以零".to_owned());
+      }
+      calc(l / r)
+    }
+    Instr::Pow => {
+      if l.is_negative() && !r.truncate().eq(&r) {
+        return Err("非法的参数值".to_owned());
+      }
+      calc(l.pow(r))
+    }
+    Instr::And => Ok(bool_num(!l.is_zero() && !r.is_zero())),
+    Instr::Or => Ok(bool_num(!l.is_zero() || !r.is_zero())),
+    Instr::CmpNum(kind) => Ok(bool_num(compare(kind, &l, &r))),
+    _ => unreachable!(),
+  }
+}
+
+/// Evaluates a system function from a number to a number, other than RND,
+/// PEEK, POS, EOF and LOF.
+pub(super) fn num_sys_func(
+  kind: SysFuncKind,
+  x: Mbf5Accum,
+) -> Fallible<Mbf5Accum> {
+  match kind {
+    SysFuncKind::Abs => Ok(x.abs()),
+    SysFuncKind::Atn => Ok(x.atan()),
+    SysFuncKind::Cos => Ok(x.cos()),
+    SysFuncKind::Exp => calc(x.exp()),
+    SysFuncKind::Int => Ok(x.truncate()),
+    SysFuncKind::Log => {
+      if x.is_positive() {
+        calc(x.ln())
+      } else {
+        Err("非法的参数值".to_owned())
+      }
+    }
+    SysFuncKind::Sgn => Ok(if x.is_positive() {
+      int_num(1)
+    } else if x.is_negative() {
+      int_num(-1)
+    } else {
+      zero()
+    }),
+    SysFuncKind::Sin => Ok(x.sin()),
+    SysFuncKind::Sqr => {
+      if x.is_negative() {
+        Err("非法的参数值".to_owned())
+      } else {
+        calc(x.sqrt())
+      }
+    }
+    SysFuncKind::Tan => calc(x.tan()),
+    _ => unreachable!(),
+  }
+}
+
+pub(super) fn to_u8(x: Mbf5Accum) -> Fallible<u8> {
+  let x: f64 = x.into();
+  let x = x.trunc();
+  if x >= 0.0 && x <= 255.0 {
+    Ok(x as u8)
+  } else {
+    Err("非法的参数值".to_owned())
+  }
+}
+
+fn calc(result: CalcResult) -> Fallible<Mbf5Accum> {
+  result.map_err(|err| match err {
+    FloatError::Infinite => "数值溢出".to_owned(),
+    FloatError::Nan => "非法的参数值".to_owned(),
+  })
+}
+
+fn round(x: Mbf5Accum) -> Fallible<Mbf5Accum> {
+  x.round().map_err(|_| "数值溢出".to_owned())
+}
+
+fn to_mbf5(x: Mbf5Accum) -> Fallible<Mbf5> {
+  Mbf5::try_from(x).map_err(|_| "数值溢出".to_owned())
+}
+
+fn to_int(x: Mbf5Accum) -> Fallible<i16> {
+  let x: f64 = x.into();
+  let x = x.trunc();
+  if x >= -32768.0 && x <= 32767.0 {
+    Ok(x as i16)
+  } else {
+    Err("数值溢出".to_owned())
+  }
+}
+
+fn to_index(x: Mbf5Accum) -> Fallible<usize> {
+  let x: f64 = x.into();
+  let x = x.trunc();
+  if x < 0.0 || x > 32767.0 {
+    return Err("数组下标超出范围".to_owned());
+  }
+  Ok(x as usize)
+}
+
+pub(super) fn int_num(x: i16) -> Mbf5Accum {
+  Mbf5Accum::try_from(x as f64).unwrap()
+}
+
+pub(super) fn bool_num(b: bool) -> Mbf5Accum {
+  int_num(b as i16)
+}
+
+fn zero() -> Mbf5Accum {
+  int_num(0)
+}
+
+pub(super) fn compare<T: PartialOrd + ?Sized>(
+  kind: CmpKind,
+  l: &T,
+  r: &T,
+) -> bool {
+  match kind {
+    CmpKind::Eq => l == r,
+    CmpKind::Ne => l != r,
+    CmpKind::Gt => l > r,
+    CmpKind::Lt => l < r,
+    CmpKind::Ge => l >= r,
+    CmpKind::Le => l <= r,
+  }
+}
+
+/// Takes bit0~bit2 of the draw mode, and changes 6 to 1.
+fn draw_mode(mode: u8) -> u8 {
+  match mode & 7 {
+    6 => 1,
+    mode => mode,
+  }
+}
+
+/// Writes the output of WRITE to the screen, or to `file` of WRITE #.
+fn write_out(
+  files: &mut Vfs,
+  file: Option<usize>,
+  device: &mut impl Device,
+  bytes: &[u8],
+) -> Fallible<()> {
+  match file {
+    Some(file) => files.write(device.files(), file, bytes),
+    None => {
+      device.print(bytes);
+      Ok(())
+    }
+  }
+}
+
+/// Strings are terminated by NUL when printed.
+fn until_nul(s: &[u8]) -> &[u8] {
+  let len = s.iter().position(|&c| c == 0).unwrap_or(s.len());
+  &s[..len]
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use crate::parser::parse;
+  use crate::vm::{compile, FileSystem, MemoryFileSystem, Profile};
+  use pretty_assertions::assert_eq;
+  use std::collections::VecDeque;
+
+  #[derive(Default)]
+  struct TestDevice {
+    output: String,
+    column: u8,
+    memory: Vec<(u16, u8)>,
+    files: MemoryFileSystem,
+  }
+
+  impl Device for TestDevice {
+    fn cursor(&self) -> (u8, u8) {
+      (0, self.column)
+    }
+
+    fn set_cursor(&mut self, row: u8, column: u8) {
+      self.output += &format!("<{},{}>", row, column);
+      self.column = column;
+    }
+
+    fn print(&mut self, bytes: &[u8]) {
+      self.output += &String::from_utf8_lossy(bytes);
+      self.column = ((self.column as usize + bytes.len()) % 20) as u8;
+    }
+
+    fn newline(&mut self) {
+      self.output.push('\n');
+      self.column = 0;
+    }
+
+    fn cls(&mut self) {
+      self.output += "<cls>";
+      self.column = 0;
+    }
+
+    fn set_screen_mode(&mut self, mode: ScreenMode) {
+      self.output += &format!("<{:?}>", mode);
+    }
+
+    fn set_print_mode(&mut self, mode: PrintMode) {
+      self.output += &format!("<{:?}>", mode);
+    }
+
+    fn draw_point(&mut self, x: u8, y: u8, mode: u8) {
+      self.output += &format!("<draw {} {} {}>", x, y, mode);
+    }
+
+    fn draw_line(&mut self, x1: u8, y1: u8, x2: u8, y2: u8, mode: u8) {
+      self.output += &format!("<line {} {} {} {} {}>", x1, y1, x2, y2, mode);
+    }
+
+    fn draw_box(
+      &mut self,
+      x1: u8,
+      y1: u8,
+      x2: u8,
+      y2: u8,
+      fill: bool,
+      mode: u8,
+    ) {
+      self.output +=
+        &format!("<box {} {} {} {} {} {}>", x1, y1, x2, y2, fill, mode);
+    }
+
+    fn draw_circle(&mut self, x: u8, y: u8, r: u8, fill: bool, mode: u8) {
+      self.output += &format!("<circle {} {} {} {} {}>", x, y, r, fill, mode);
+    }
+
+    fn draw_ellipse(
+      &mut self,
+      x: u8,
+      y: u8,
+      rx: u8,
+      ry: u8,
+      fill: bool,
+      mode: u8,
+    ) {
+      self.output +=
+        &format!("<ellipse {} {} {} {} {} {}>", x, y, rx, ry, fill, mode);
+    }
+
+    fn beep(&mut self) {
+      self.output += "<beep>";
+    }
+
+    fn peek(&mut self, addr: u16) -> u8 {
+      addr as u8
+    }
+
+    fn poke(&mut self, addr: u16, value: u8) {
+      self.memory.push((addr, value));
+    }
+
+    fn call(&mut self, addr: u16) {
+      self.output += &format!("<call {}>", addr);
+    }
+
+    fn files(&mut self) -> &mut dyn FileSystem {
+      &mut self.files
+    }
+  }
+
+  fn run_with_input(
+    text: &str,
+    input: &[&'static str],
+  ) -> (String, Result<(), ExecError>) {
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let mut device = TestDevice::default();
+    let mut input = input.iter().copied().collect::<VecDeque<_>>();
+    let mut machine = Machine::new(code);
+    loop {
+      match machine.run(&mut device, 3) {
+        ExecResult::End => return (device.output, Ok(())),
+        ExecResult::Error(err) => return (device.output, Err(err)),
+        ExecResult::Pause => {}
+        ExecResult::InKey => machine.set_key(b'K'),
+        ExecResult::Input => {
+          let line = input.pop_front().unwrap();
+          device.output += line;
+          device.newline();
+          machine.set_input(line.as_bytes().to_vec());
+        }
+      }
+    }
+  }
+
+  fn run(text: &str) -> String {
+    let (output, result) = run_with_input(text, &[]);
+    result.unwrap();
+    output
+  }
+
+  fn run_err(text: &str) -> ExecError {
+    run_with_input(text, &[]).1.unwrap_err()
+  }
+
+  #[test]
+  fn print() {
+    assert_eq!(
+      run("10 print 1;-2.5,\"ab\" 3:print:print \"x\";\n"),
+      "1-2.5\nab 3\n\nx"
+    );
+  }
+
+  #[test]
+  fn arithmetic() {
+    assert_eq!(
+      run("10 a=3:b%=-7.8:print a*2+b%/2^2;not a;a>2 and b%<0;a or 0\n"),
+      "4.25011\n"
+    );
+  }
+
+  #[test]
+  fn strings() {
+    let text = r#"10 a$="hello":b$=mid$(a$,2,3)+left$(a$,1)+right$(a$,2)
+20 print b$;len(b$);asc(a$);chr$(65);str$(-1.5);val(" 1 2e1x")
+30 print a$<"help";cvi$(mki$(-2));cvs$(mks$(1.25))
+"#;
+    assert_eq!(run(text), "ellhlo6104A-1.5120\n1-21.25\n");
+  }
+
+  #[test]
+  fn goto_gosub() {
+    let text = "10 gosub 100:goto 30
+20 print \"no\"
+30 on 2 gosub 200,100:print \"end\":end
+100 print \"sub\";:return
+200 print \"x\"
+";
+    assert_eq!(run(text), "subsubend\n");
+  }
+
+  #[test]
+  fn for_next() {
+    let text = "10 for i=1 to 3:for j=i to 1 step -1:print j;:next j,i
+20 for i=1 to 0:print \"once\";:next:print i
+30 for k=2 to 2 step 0:print k;:next
+";
+    assert_eq!(run(text), "121321once2\n2");
+  }
+
+  #[test]
+  fn while_wend() {
+    let text = "10 i=0:while i<3:i=i+1:print i;:wend:print
+20 while 0:print \"no\":wend:print \"done\"
+";
+    assert_eq!(run(text), "123\ndone\n");
+  }
+
+  #[test]
+  fn arrays() {
+    let text = "10 dim a(2,3),b$(1):a(2,3)=5:b$(1)=\"x\":c%(10)=7
+20 print a(2,3)+c%(10);b$(1);a(0,0)
+30 swap a(2,3),a(1,1):print a(1,1)
+";
+    assert_eq!(run(text), "12x0\n5\n");
+  }
+
+  #[test]
+  fn data_read() {
+    let text = "10 read a,b$,c$:print a;b$;c$
+20 data  1.5, \"x,y\" ,abc
+30 restore 20:read d:print d
+";
+    assert_eq!(run(text), "1.5x,yabc\n1.5\n");
+    assert_eq!(run_err("10 read a\n20 data \"1\"\n").message, "类型不匹配");
+    assert_eq!(run_err("10 read a\n20 data 1x\n").message, "语法错误");
+    assert_eq!(run_err("10 read a\n20 data 1e99\n").message, "数值溢出");
+  }
+
+  #[test]
+  fn def_fn() {
+    let text = "10 x=5:def fn f(x)=x*x+1:print fn f(3);x\n";
+    assert_eq!(run(text), "105\n");
+  }
+
+  #[test]
+  fn if_else() {
+    let text = "10 a=1:if a then print \"t\" else print \"f\"
+20 if a=2 then print \"t\" else print \"f\"
+30 if 0 then print \"no\"
+";
+    assert_eq!(run(text), "t\nf\n");
+  }
+
+  #[test]
+  fn input() {
+    let (output, result) = run_with_input(
+      "10 input \"n\";a,b$:input c:print a;b$;c\n",
+      &["x", "1,abc:def", "2"],
+    );
+    result.unwrap();
+    assert_eq!(output, "nx\n?REENTER\nn1,abc:def\n?2\n1abc2\n");
+  }
+
+  #[test]
+  fn write() {
+    assert_eq!(run("10 write \"a\" 1, 2 \"b\"+chr$(0)+\"c\",\n"), "1,\"b");
+    // Data overwritten by the next one are still evaluated.
+    assert_eq!(run_err("10 write 1/a 2\n").message, "除以零");
+  }
+
+  #[test]
+  fn files() {
+    let text = r#"10 open "db" for random as 1 len=8:field #1,3 as a$,5 as b$(1)
+20 for i=1 to 3:lset a$=str$(i):rset b$(1)=chr$(64+i):put #1,i:next
+30 b$(1)="x":get #1,2:print a$;b$(1);len(b$(1));lof(1):close 1
+40 open "s" for output as 2:write #2,"a,b",1.5,:close 2
+50 open "s" for append as 3:write #3,-2:close #3
+60 open "s" for input as 1:input #1,a$,b,c%:print a$;b;c%;eof(1)
+70 open "db" for random as 2 len=8:get #2,3:field 2,8 as a$:lset a$="y":put 2,4
+80 print lof(2);:write #2,1
+"#;
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let mut device = TestDevice::default();
+    let mut machine = Machine::new(code);
+    machine.set_file_prefix(b"T-");
+    match machine.run(&mut device, 1000) {
+      ExecResult::Error(err) => {
+        assert_eq!((err.line, err.message), (7, "文件打开模式错误".to_owned()))
+      }
+      result => panic!("{:?}", result),
+    }
+    assert_eq!(device.output, "2x124\na,b1.5-21\n32");
+    // Files are written back when the program fails.
+    let db = device.files.file(b"T-db").unwrap();
+    assert_eq!(db.len(), 32);
+    assert_eq!(db[8..16], *b"2\0\0    B");
+    assert_eq!(db[24..], *b"y\0\0\0\0\0\0\0");
+    assert_eq!(
+      device.files.file(b"T-s"),
+      Some(&b"\"a,b\",1.5\xff-2\xff"[..])
+    );
+  }
+
+  #[test]
+  fn write_input_round_trip() {
+    let text = r#"10 open "f" for output as 1:a$="x,y":b=-1.5:write #1,a$,b:close 1
+20 open "f" for input as 1:input #1,c$,d:print c$;d
+"#;
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let mut device = TestDevice::default();
+    let mut machine = Machine::new(code);
+    assert_eq!(machine.run(&mut device, 1000), ExecResult::End);
+    assert_eq!(device.output, "x,y-1.5\n");
+    assert_eq!(device.files.file(b"f"), Some(&b"\"x,y\",-1.5\xff"[..]));
+  }
+
+  #[test]
+  fn profile() {
+    thread_local! {
+      static NOW: std::cell::Cell<u64> = std::cell::Cell::new(0);
+    }
+    /// Each reading of the clock takes 10 nanoseconds.
+    fn clock() -> u64 {
+      NOW.with(|now| {
+        now.set(now.get() + 10);
+        now.get()
+      })
+    }
+
+    let text = "10 for i=1 to 3:gosub 100:next
+20 inkey$:print abs(-i);abs(i)
+30 end
+100 gosub 200:return
+200 return
+";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let mut device = TestDevice::default();
+    let mut profile = Profile::new(&code, clock);
+    let mut machine = Machine::new(code);
+    let result = machine.run_profiled(&mut device, 1000, &mut profile);
+    assert_eq!(result, ExecResult::InKey);
+    machine.set_key(b'K');
+    let result = machine.run_profiled(&mut device, 1000, &mut profile);
+    assert_eq!(result, ExecResult::End);
+
+    assert_eq!(profile.stmt_hits(), [1, 3, 3, 1, 1, 1, 3, 3, 3]);
+    // Line 10 is entered again after each return from line 100.
+    assert_eq!(profile.line_hits(), [4, 1, 1, 6, 3]);
+    // The time waiting for the key is not counted.
+    assert_eq!(profile.line_nanos(), [70, 30, 10, 60, 30]);
+    assert_eq!(profile.hot_lines(3), [0, 3, 4]);
+    assert_eq!(profile.sys_func_calls(SysFuncKind::Abs), 2);
+    assert_eq!(profile.gosub_depths(), [0, 3, 3]);
+  }
+
+  #[test]
+  fn snapshot() {
+    let text = "10 dim a(100):a(1)=1:b$=\"x\"
+20 a(1)=a(1)+1:b$=b$+\"y\":c(0)=c(0)+1:print a(1);b$;c(0)
+";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let mut device = TestDevice::default();
+    let mut machine = Machine::new(code);
+    while machine.code.location(machine.pc).unwrap().line == 0 {
+      assert_eq!(machine.run(&mut device, 1), ExecResult::Pause);
+    }
+    let snapshot = machine.snapshot();
+    assert!(Rc::ptr_eq(
+      snapshot.0.real_arrays[0].as_ref().unwrap(),
+      machine.real_arrays[0].as_ref().unwrap()
+    ));
+    assert_eq!(machine.run(&mut device, 100), ExecResult::End);
+    machine.restore(&snapshot);
+    assert_eq!(machine.run(&mut device, 100), ExecResult::End);
+    assert_eq!(device.output, "2xy1\n2xy1\n");
+    assert_eq!(snapshot.0.real_array(0).unwrap().data()[1], int_num(1));
+  }
+
+  #[test]
+  fn graphics() {
+    let text = "10 graph:draw 1,2:line 1,2,3,4,14:box 1,2,3,4,1,0
+20 circle 1,2,3:ellipse 1,2,3,4,0,2:locate 2,3:locate ,4
+";
+    assert_eq!(
+      run(text),
+      "<Graph><cls><draw 1 2 1><line 1 2 3 4 1><box 1 2 3 4 true 0>\
+<circle 1 2 3 true 1><ellipse 1 2 3 4 false 2><1,2><0,3>"
+    );
+  }
+
+  #[test]
+  fn errors() {
+    let err = run_err("10 print 1\n20 print 1/0\n");
+    assert_eq!(err.line, 1);
+    assert_eq!(err.message, "除以零");
+    assert_eq!(run_err("10 goto 30\n").message, "行号不存在");
+    assert_eq!(run_err("10 return\n").message, "RETURN 没有对应的 GOSUB");
+    assert_eq!(run_err("10 next\n").message, "NEXT 没有对应的 FOR");
+    assert_eq!(run_err("10 read a\n").message, "DATA 已读完");
+    assert_eq!(run_err("10 a%=40000\n").message, "数值溢出");
+    assert_eq!(run_err("10 dim a(1):dim a(2)\n").message, "重复定义数组");
+    assert_eq!(run_err("10 a(11)=1\n").message, "数组下标超出范围");
+    assert_eq!(run_err("10 print fn f(1)\n").message, "函数未定义");
+    assert_eq!(run_err("10 print 1:print )\n").message, "语法错误");
+  }
+
+  #[test]
+  fn inkey() {
+    assert_eq!(run("10 a$=inkey$:inkey$:print a$+inkey$\n"), "KK\n");
+  }
+
+  #[test]
+  fn budget() {
+    let text = "10 for i=1 to 3:print i;:next:end\n";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let mut device = TestDevice::default();
+    let mut machine = Machine::new(code);
+    let mut pauses = 0;
+    while machine.run(&mut device, 1) == ExecResult::Pause {
+      pauses += 1;
+    }
+    assert_eq!(pauses, 14);
+    assert_eq!(device.output, "123");
+    assert_eq!(machine.run(&mut device, 1), ExecResult::End);
+  }
+
+  #[test]
+  fn peek_poke() {
+    let program = parse("10 poke -1,peek(258)+1:call 100\n");
+    let code = compile(&program, "10 poke -1,peek(258)+1:call 100\n").unwrap();
+    let mut device = TestDevice::default();
+    assert_eq!(Machine::new(code).run(&mut device, 100), ExecResult::End);
+    assert_eq!(device.memory, vec![(65535, 3)]);
+    assert_eq!(device.output, "<call 100>");
+  }
+
+  #[test]
+  fn variables() {
+    let text = "10 dim a%(2,3):a%(1,2)=7:b$=\"x\":c=1.5\n";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let mut device = TestDevice::default();
+    let mut machine = Machine::new(code);
+    assert_eq!(machine.run(&mut device, 100), ExecResult::End);
+
+    let array = machine.int_array(0).unwrap();
+    assert_eq!(array.dims(), [3, 4]);
+    assert_eq!(array.data()[6], 7);
+    assert_eq!(machine.str_vars(), [Str::from_slice(b"x")]);
+    let c: f64 = machine.real_vars()[0].into();
+    assert_eq!(c, 1.5);
+
+    machine.set_var(VarKind::Int, 0, Some(11), b"-3").unwrap();
+    assert_eq!(machine.int_array(0).unwrap().data()[11], -3);
+    machine.set_var(VarKind::Real, 0, None, b"2").unwrap();
+    let c: f64 = machine.real_vars()[0].into();
+    assert_eq!(c, 2.0);
+    assert_eq!(
+      machine.set_var(VarKind::Int, 0, Some(12), b"1"),
+      Err("数组下标超出范围".to_owned())
+    );
+    assert_eq!(
+      machine.set_var(VarKind::Real, 0, None, b"1e39"),
+      Err("数值溢出".to_owned())
+    );
+    assert_eq!(
+      machine.set_var(VarKind::Int, 0, None, b"1"),
+      Err("变量未定义".to_owned())
+    );
+    assert_eq!(
+      machine.set_var(VarKind::Str, 1, Some(0), b""),
+      Err("数组未定义".to_owned())
+    );
+    assert!(machine.real_array(1).is_none());
+  }
+}
@@ -0,0 +1,181 @@
+//! Opt-in instrumentation of `Machine::run_profiled`.
+//!
+//! The hooks of `Profiler` are only called if `Profiler::ENABLED`, which is
+//! a constant, so that `Machine::run` is compiled without any of them.
+
+use super::instruction::{Addr, Code};
+use crate::ast::SysFuncKind;
+
+const NUM_SYS_FUNCS: usize = SysFuncKind::Val as usize + 1;
+const NO_STMT: u32 = u32::MAX;
+
+pub trait Profiler {
+  const ENABLED: bool = true;
+
+  /// Called before the instruction at `addr` is executed. `resumed` is true
+  /// if the instruction is executed again after waiting for input.
+  fn step(&mut self, addr: Addr, resumed: bool);
+
+  /// Called when `Machine::run_profiled` returns.
+  fn pause(&mut self);
+
+  fn sys_func(&mut self, kind: SysFuncKind);
+
+  /// Called by GOSUB and ON GOSUB, with the number of GOSUBs not returned
+  /// yet, including this one.
+  fn gosub(&mut self, depth: usize);
+}
+
+/// The profiler of `Machine::run`, which does nothing.
+pub struct NoProfiler;
+
+impl Profiler for NoProfiler {
+  const ENABLED: bool = false;
+
+  fn step(&mut self, _addr: Addr, _resumed: bool) {}
+
+  fn pause(&mut self) {}
+
+  fn sys_func(&mut self, _kind: SysFuncKind) {}
+
+  fn gosub(&mut self, _depth: usize) {}
+}
+
+/// Hit counts and time of statements and lines, in flat tables.
+///
+/// Statements are indexed as in `Code.locations`, and lines as in
+/// `Program.lines`. A statement is hit when the execution reaches its first
+/// instruction, and the time until the next statement is hit, excluding the
+/// time outside `Machine::run_profiled`, is counted to it. A line is hit when
+/// the execution enters it from another line, so a loop within a single line
+/// hits it once.
+pub struct Profile {
+  /// Returns the current time in nanoseconds.
+  clock: fn() -> u64,
+  /// The statement starting at each address, or `NO_STMT`.
+  stmt_at: Vec<u32>,
+  stmt_lines: Vec<u32>,
+  stmt_hits: Vec<u64>,
+  stmt_nanos: Vec<u64>,
+  line_hits: Vec<u64>,
+  line_nanos: Vec<u64>,
+  sys_func_calls: [u64; NUM_SYS_FUNCS],
+  gosub_depths: Vec<u64>,
+  current: u32,
+  /// The time `current` is entered or resumed, or `None` if paused.
+  since: Option<u64>,
+}
+
+impl Profile {
+  pub fn new(code: &Code, clock: fn() -> u64) -> Self {
+    let mut stmt_at = vec![NO_STMT; code.instrs.len()];
+    // Statements that generate no code share the address of the next one,
+    // which is the last one of them, as in `Code::location`.
+    for (i, loc) in code.locations.iter().enumerate() {
+      if let Some(s) = stmt_at.get_mut(loc.addr as usize) {
+        *s = i as u32;
+      }
+    }
+    let num_lines = code.locations.last().map_or(0, |loc| loc.line + 1);
+    Self {
+      clock,
+      stmt_at,
+      stmt_lines: code.locations.iter().map(|loc| loc.line as u32).collect(),
+      stmt_hits: vec![0; code.locations.len()],
+      stmt_nanos: vec![0; code.locations.len()],
+      line_hits: vec![0; num_lines],
+      line_nanos: vec![0; num_lines],
+      sys_func_calls: [0; NUM_SYS_FUNCS],
+      gosub_depths: vec![],
+      current: NO_STMT,
+      since: None,
+    }
+  }
+
+  pub fn stmt_hits(&self) -> &[u64] {
+    &self.stmt_hits
+  }
+
+  pub fn stmt_nanos(&self) -> &[u64] {
+    &self.stmt_nanos
+  }
+
+  /// Lines after the last statement are not included.
+  pub fn line_hits(&self) -> &[u64] {
+    &self.line_hits
+  }
+
+  pub fn line_nanos(&self) -> &[u64] {
+    &self.line_nanos
+  }
+
+  pub fn sys_func_calls(&self, kind: SysFuncKind) -> u64 {
+    self.sys_func_calls[kind as usize]
+  }
+
+  /// Returns the number of GOSUBs executed at each depth, starting from 1 at
+  /// index 1.
+  pub fn gosub_depths(&self) -> &[u64] {
+    &self.gosub_depths
+  }
+
+  /// Returns the indices of at most `n` lines that take the most time, most
+  /// first, which are usually the loops worth optimizing.
+  pub fn hot_lines(&self, n: usize) -> Vec<usize> {
+    let mut lines: Vec<usize> = (0..self.line_hits.len())
+      .filter(|&i| self.line_hits[i] != 0)
+      .collect();
+    lines.sort_by_key(|&i| {
+      std::cmp::Reverse((self.line_nanos[i], self.line_hits[i]))
+    });
+    lines.truncate(n);
+    lines
+  }
+
+  /// Counts the time since `since` to the current statement.
+  fn count_time(&mut self, now: u64) {
+    if let (Some(since), Some(&line)) =
+      (self.since, self.stmt_lines.get(self.current as usize))
+    {
+      let nanos = now.saturating_sub(since);
+      self.stmt_nanos[self.current as usize] += nanos;
+      self.line_nanos[line as usize] += nanos;
+    }
+  }
+}
+
+impl Profiler for Profile {
+  fn step(&mut self, addr: Addr, resumed: bool) {
+    let stmt = self.stmt_at[addr as usize];
+    if stmt != NO_STMT && !resumed {
+      let now = (self.clock)();
+      self.count_time(now);
+      let line = self.stmt_lines[stmt as usize];
+      if self.stmt_lines.get(self.current as usize) != Some(&line) {
+        self.line_hits[line as usize] += 1;
+      }
+      self.current = stmt;
+      self.since = Some(now);
+      self.stmt_hits[stmt as usize] += 1;
+    } else if self.since.is_none() {
+      self.since = Some((self.clock)());
+    }
+  }
+
+  fn pause(&mut self) {
+    let now = (self.clock)();
+    self.count_time(now);
+    self.since = None;
+  }
+
+  fn sys_func(&mut self, kind: SysFuncKind) {
+    self.sys_func_calls[kind as usize] += 1;
+  }
+
+  fn gosub(&mut self, depth: usize) {
+    if depth >= self.gosub_depths.len() {
+      self.gosub_depths.resize(depth + 1, 0);
+    }
+    self.gosub_depths[depth] += 1;
+  }
+}
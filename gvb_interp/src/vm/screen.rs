@@ -0,0 +1,464 @@
+//! The 160x80 LCD, as a 1-bit packed framebuffer for `Device`
+//! implementations.
+//!
+//! Drawing marks the changed area as dirty. The dirty areas are coalesced into
+//! one bounding box until `Screen::take_dirty` is called, normally once per
+//! frame, so that only the changed rows need to be sent to the renderer.
+
+use super::font::Glyph;
+
+pub const SCREEN_WIDTH: usize = 160;
+pub const SCREEN_HEIGHT: usize = 80;
+pub const BYTES_PER_ROW: usize = SCREEN_WIDTH / 8;
+
+/// A rectangle of pixels, `right` and `bottom` exclusive.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct DirtyArea {
+  pub left: u8,
+  pub top: u8,
+  pub right: u8,
+  pub bottom: u8,
+}
+
+/// Pixels are stored row by row, 8 pixels in a byte, with the leftmost pixel
+/// in the most significant bit.
+#[derive(Clone)]
+pub struct Screen {
+  pixels: [u8; BYTES_PER_ROW * SCREEN_HEIGHT],
+  dirty: Option<DirtyArea>,
+}
+
+impl Default for Screen {
+  fn default() -> Self {
+    Self::new()
+  }
+}
+
+impl Screen {
+  pub fn new() -> Self {
+    Self {
+      pixels: [0; BYTES_PER_ROW * SCREEN_HEIGHT],
+      dirty: None,
+    }
+  }
+
+  pub fn pixels(&self) -> &[u8] {
+    &self.pixels
+  }
+
+  pub fn pixel(&self, x: u8, y: u8) -> bool {
+    let (x, y) = (x as usize, y as usize);
+    x < SCREEN_WIDTH
+      && y < SCREEN_HEIGHT
+      && self.pixels[y * BYTES_PER_ROW + x / 8] & (0x80 >> (x & 7)) != 0
+  }
+
+  /// Returns the area changed since the last call, and clears it.
+  pub fn take_dirty(&mut self) -> Option<DirtyArea> {
+    self.dirty.take()
+  }
+
+  /// The packed rows covered by `area`.
+  pub fn rows(&self, area: &DirtyArea) -> &[u8] {
+    &self.pixels
+      [area.top as usize * BYTES_PER_ROW..area.bottom as usize * BYTES_PER_ROW]
+  }
+
+  pub fn clear(&mut self) {
+    self.pixels = [0; BYTES_PER_ROW * SCREEN_HEIGHT];
+    self.mark_all();
+  }
+
+  /// Scrolls the screen up by `rows` pixels, clearing the rows at the bottom.
+  pub fn scroll_up(&mut self, rows: usize) {
+    let rows = rows.min(SCREEN_HEIGHT);
+    self.pixels.copy_within(rows * BYTES_PER_ROW.., 0);
+    let len = self.pixels.len();
+    self.pixels[len - rows * BYTES_PER_ROW..].fill(0);
+    self.mark_all();
+  }
+
+  /// `mode` is a draw mode normalized to 0~5: 0 erases, 2 inverts, and the
+  /// others draw.
+  pub fn draw_point(&mut self, x: u8, y: u8, mode: u8) {
+    self.span(y as i32, x as i32, x as i32, mode);
+  }
+
+  pub fn draw_line(&mut self, x1: u8, y1: u8, x2: u8, y2: u8, mode: u8) {
+    let (x1, y1, x2, y2) = (x1 as i32, y1 as i32, x2 as i32, y2 as i32);
+    if y1 == y2 {
+      self.span(y1, x1.min(x2), x1.max(x2), mode);
+      return;
+    }
+    if x1 == x2 {
+      self.column(x1, y1.min(y2), y1.max(y2), mode);
+      return;
+    }
+
+    let (dx, dy) = ((x2 - x1).abs(), -(y2 - y1).abs());
+    let (sx, sy) = ((x2 - x1).signum(), (y2 - y1).signum());
+    let (mut x, mut y, mut err) = (x1, y1, dx + dy);
+    loop {
+      self.span(y, x, x, mode);
+      if x == x2 && y == y2 {
+        break;
+      }
+      let e2 = 2 * err;
+      if e2 >= dy {
+        err += dy;
+        x += sx;
+      }
+      if e2 <= dx {
+        err += dx;
+        y += sy;
+      }
+    }
+  }
+
+  pub fn draw_box(
+    &mut self,
+    x1: u8,
+    y1: u8,
+    x2: u8,
+    y2: u8,
+    fill: bool,
+    mode: u8,
+  ) {
+    let (left, right) = (x1.min(x2) as i32, x1.max(x2) as i32);
+    let (top, bottom) = (y1.min(y2) as i32, y1.max(y2) as i32);
+    if fill || bottom - top < 2 {
+      for y in top..=bottom {
+        self.span(y, left, right, mode);
+      }
+      return;
+    }
+
+    self.span(top, left, right, mode);
+    self.span(bottom, left, right, mode);
+    self.column(left, top + 1, bottom - 1, mode);
+    if right != left {
+      self.column(right, top + 1, bottom - 1, mode);
+    }
+  }
+
+  pub fn draw_circle(&mut self, x: u8, y: u8, r: u8, fill: bool, mode: u8) {
+    self.draw_ellipse(x, y, r, r, fill, mode);
+  }
+
+  /// Ellipses are drawn row by row, so that no pixel is drawn twice, which
+  /// matters to the inverting mode.
+  pub fn draw_ellipse(
+    &mut self,
+    x: u8,
+    y: u8,
+    rx: u8,
+    ry: u8,
+    fill: bool,
+    mode: u8,
+  ) {
+    let (cx, cy) = (x as i32, y as i32);
+    let half = |dy: i32| -> i32 {
+      if dy > ry as i32 {
+        return -1;
+      }
+      // Measured from the centers of the pixels, which flattens the ends.
+      let t = dy as f64 / (ry as f64 + 0.5);
+      ((rx as f64 + 0.5) * (1.0 - t * t).sqrt()) as i32
+    };
+
+    let mut outer = half(0);
+    for dy in 0..=ry as i32 {
+      let inner = half(dy + 1);
+      let rows = if dy == 0 { 1 } else { 2 };
+      for &y in [cy - dy, cy + dy][..rows].iter() {
+        if fill {
+          self.span(y, cx - outer, cx + outer, mode);
+          continue;
+        }
+        // The pixels not covered by the next row, toward the center.
+        let from = (inner + 1).min(outer);
+        if from == 0 {
+          self.span(y, cx - outer, cx + outer, mode);
+        } else {
+          self.span(y, cx - outer, cx - from, mode);
+          self.span(y, cx + from, cx + outer, mode);
+        }
+      }
+      outer = inner;
+    }
+  }
+
+  /// Copies a bitmap to the screen, replacing the pixels under it. `bitmap`
+  /// is packed like the screen, with `(width + 7) / 8` bytes per row. Used
+  /// for drawing characters.
+  pub fn blit(
+    &mut self,
+    x: u8,
+    y: u8,
+    width: u8,
+    bitmap: &[u8],
+    inverse: bool,
+  ) {
+    let row_bytes = (width as usize + 7) / 8;
+    if row_bytes == 0
+      || x as usize >= SCREEN_WIDTH
+      || y as usize >= SCREEN_HEIGHT
+    {
+      return;
+    }
+    let (x, y) = (x as usize, y as usize);
+    let shift = x & 7;
+    let mut rows = 0;
+    for (dy, src) in bitmap.chunks(row_bytes).enumerate() {
+      if y + dy >= SCREEN_HEIGHT {
+        break;
+      }
+      rows = dy + 1;
+      let row = &mut self.pixels[(y + dy) * BYTES_PER_ROW..][..BYTES_PER_ROW];
+      let mut remaining = width as usize;
+      for (i, &b) in src.iter().enumerate() {
+        let n = remaining.min(8);
+        remaining -= n;
+        let mask = (0xff00u16 >> n) as u8;
+        let b = if inverse { !b } else { b } & mask;
+        let col = x / 8 + i;
+        // A byte of the bitmap covers at most 2 bytes of the screen.
+        let (mask16, b16) =
+          (((mask as u16) << 8) >> shift, ((b as u16) << 8) >> shift);
+        for (k, (m, v)) in [
+          ((mask16 >> 8) as u8, (b16 >> 8) as u8),
+          (mask16 as u8, b16 as u8),
+        ]
+        .iter()
+        .enumerate()
+        {
+          if *m != 0 && col + k < BYTES_PER_ROW {
+            row[col + k] = (row[col + k] & !m) | v;
+          }
+        }
+      }
+    }
+    if rows != 0 {
+      self.mark(
+        x as i32,
+        y as i32,
+        x as i32 + width as i32 - 1,
+        (y + rows - 1) as i32,
+      );
+    }
+  }
+
+  pub fn draw_glyph(&mut self, x: u8, y: u8, glyph: &Glyph, inverse: bool) {
+    self.blit(x, y, glyph.width, glyph.bitmap, inverse);
+  }
+
+  /// Draws pixels `left..=right` of row `y`, a byte at a time, clipped to the
+  /// screen.
+  fn span(&mut self, y: i32, left: i32, right: i32, mode: u8) {
+    let left = left.max(0);
+    let right = right.min(SCREEN_WIDTH as i32 - 1);
+    if y < 0 || y >= SCREEN_HEIGHT as i32 || left > right {
+      return;
+    }
+    self.mark(left, y, right, y);
+
+    let row = y as usize * BYTES_PER_ROW;
+    let (left, right) = (left as usize, right as usize);
+    let (first, last) = (row + left / 8, row + right / 8);
+    let left_mask = 0xffu8 >> (left & 7);
+    let right_mask = 0xffu8 << (7 - (right & 7));
+    if first == last {
+      apply(&mut self.pixels[first], left_mask & right_mask, mode);
+      return;
+    }
+    apply(&mut self.pixels[first], left_mask, mode);
+    let middle = &mut self.pixels[first + 1..last];
+    match mode {
+      0 => middle.fill(0),
+      2 => middle.iter_mut().for_each(|b| *b = !*b),
+      _ => middle.fill(0xff),
+    }
+    apply(&mut self.pixels[last], right_mask, mode);
+  }
+
+  /// Draws pixels `top..=bottom` of column `x`, clipped to the screen.
+  fn column(&mut self, x: i32, top: i32, bottom: i32, mode: u8) {
+    let top = top.max(0);
+    let bottom = bottom.min(SCREEN_HEIGHT as i32 - 1);
+    if x < 0 || x >= SCREEN_WIDTH as i32 || top > bottom {
+      return;
+    }
+    self.mark(x, top, x, bottom);
+    let mask = 0x80 >> (x & 7);
+    for y in top..=bottom {
+      let i = y as usize * BYTES_PER_ROW + x as usize / 8;
+      apply(&mut self.pixels[i], mask, mode);
+    }
+  }
+
+  /// Adds the pixels `left..=right`, `top..=bottom`, clipped to the screen, to
+  /// the dirty area. Nothing is added if no pixel is left after clipping.
+  fn mark(&mut self, left: i32, top: i32, right: i32, bottom: i32) {
+    let (left, top) = (left.max(0), top.max(0));
+    let right = (right + 1).min(SCREEN_WIDTH as i32);
+    let bottom = (bottom + 1).min(SCREEN_HEIGHT as i32);
+    if left >= right || top >= bottom {
+      return;
+    }
+    let area = DirtyArea {
+      left: left as u8,
+      top: top as u8,
+      right: right as u8,
+      bottom: bottom as u8,
+    };
+    self.dirty = Some(match self.dirty {
+      None => area,
+      Some(dirty) => DirtyArea {
+        left: dirty.left.min(area.left),
+        top: dirty.top.min(area.top),
+        right: dirty.right.max(area.right),
+        bottom: dirty.bottom.max(area.bottom),
+      },
+    });
+  }
+
+  fn mark_all(&mut self) {
+    self.dirty = Some(DirtyArea {
+      left: 0,
+      top: 0,
+      right: SCREEN_WIDTH as u8,
+      bottom: SCREEN_HEIGHT as u8,
+    });
+  }
+}
+
+fn apply(b: &mut u8, mask: u8, mode: u8) {
+  match mode {
+    0 => *b &= !mask,
+    2 => *b ^= mask,
+    _ => *b |= mask,
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use pretty_assertions::assert_eq;
+
+  /// Renders the pixels of `width` x `height` at the top left corner.
+  fn render(screen: &Screen, width: u8, height: u8) -> String {
+    let mut s = String::new();
+    for y in 0..height {
+      for x in 0..width {
+        s.push(if screen.pixel(x, y) { '#' } else { '.' });
+      }
+      s.push('\n');
+    }
+    s
+  }
+
+  #[test]
+  fn spans() {
+    let mut screen = Screen::new();
+    screen.draw_line(3, 0, 20, 0, 1);
+    assert_eq!(&screen.pixels()[..3], &[0x1f, 0xff, 0xf8]);
+    screen.draw_line(5, 0, 6, 0, 2);
+    assert_eq!(screen.pixels()[0], 0x19);
+    screen.draw_line(150, 1, 255, 1, 1);
+    assert_eq!(screen.pixels()[2 * BYTES_PER_ROW - 2..][..2], [0x03, 0xff]);
+    assert_eq!(screen.pixels()[2 * BYTES_PER_ROW], 0);
+  }
+
+  #[test]
+  fn shapes() {
+    let mut screen = Screen::new();
+    screen.draw_box(0, 0, 4, 3, false, 2);
+    screen.draw_circle(9, 3, 3, false, 2);
+    screen.draw_line(0, 5, 4, 7, 1);
+    assert_eq!(
+      render(&screen, 13, 8),
+      "\
+#####...###..
+#...#..#...#.
+#...#.#.....#
+#####.#.....#
+......#.....#
+#......#...#.
+.##.....###..
+...##........
+"
+    );
+
+    let mut screen = Screen::new();
+    screen.draw_ellipse(4, 2, 4, 2, true, 1);
+    assert_eq!(
+      render(&screen, 10, 5),
+      "\
+..#####...
+#########.
+#########.
+#########.
+..#####...
+"
+    );
+  }
+
+  #[test]
+  fn blit() {
+    let mut screen = Screen::new();
+    screen.draw_box(0, 0, 15, 1, true, 1);
+    screen.blit(3, 0, 6, &[0b1011_0000, 0b0100_1000], false);
+    assert_eq!(
+      render(&screen, 12, 2),
+      "\
+####.##..###
+###.#..#.###
+"
+    );
+    screen.blit(156, 0, 8, &[0xff], true);
+    assert_eq!(screen.pixels()[BYTES_PER_ROW - 1], 0);
+
+    // Bitmaps entirely off the screen change nothing.
+    screen.take_dirty();
+    screen.blit(160, 0, 8, &[0xff], false);
+    screen.blit(0, 80, 8, &[0xff], false);
+    assert_eq!(screen.take_dirty(), None);
+  }
+
+  #[test]
+  fn dirty_area() {
+    let mut screen = Screen::new();
+    assert_eq!(screen.take_dirty(), None);
+    screen.draw_box(10, 20, 30, 25, false, 1);
+    screen.draw_point(40, 22, 1);
+    screen.draw_circle(0, 0, 5, true, 1);
+    let area = screen.take_dirty().unwrap();
+    assert_eq!(
+      area,
+      DirtyArea {
+        left: 0,
+        top: 0,
+        right: 41,
+        bottom: 26,
+      }
+    );
+    assert_eq!(screen.rows(&area).len(), 26 * BYTES_PER_ROW);
+    assert_eq!(screen.take_dirty(), None);
+
+    screen.draw_point(200, 10, 1);
+    assert_eq!(screen.take_dirty(), None);
+  }
+
+  #[test]
+  fn scroll() {
+    let mut screen = Screen::new();
+    screen.draw_point(0, 10, 1);
+    screen.draw_point(0, 79, 1);
+    screen.take_dirty();
+    screen.scroll_up(10);
+    assert!(screen.pixel(0, 0));
+    assert!(screen.pixel(0, 69));
+    assert!(!screen.pixel(0, 79));
+    assert_eq!(screen.take_dirty().unwrap().bottom, 80);
+  }
+}
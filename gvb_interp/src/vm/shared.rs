@@ -0,0 +1,217 @@
+//! The state polled by the UI, in memory shared with the simulator worker.
+//!
+//! The buffer is an array of little-endian 32-bit words. Built for WASM with
+//! shared memory, it lives in the `SharedArrayBuffer` of the module, at
+//! `as_ptr()`, so the UI views it directly instead of receiving a copy of
+//! every update through `postMessage`.
+//!
+//! - 0, `SEQ`: odd while the worker is writing.
+//! - 1, `DIRTY`: the area changed since the UI last swapped 0 in, as bytes
+//!   left, top, right and bottom.
+//! - 2, `CARET`: bytes row, column and visible.
+//! - 3~5, `NUM_VARS`: the number of real, integer and string variables.
+//! - 8~407, `PIXELS`: as `Screen::pixels`.
+//! - 408~, `VARS`: real variables as `f64`, integer variables as `i32`, then
+//!   string variables in `STR_WORDS` words each, the length first.
+//!
+//! The UI reads `SEQ` with `Atomics.load`, copies what it needs, and retries
+//! if `SEQ` was odd or has changed since.
+
+use super::machine::Machine;
+use super::screen::{DirtyArea, Screen, BYTES_PER_ROW, SCREEN_HEIGHT};
+use super::Code;
+use std::sync::atomic::{fence, AtomicU32, Ordering};
+
+pub const SEQ: usize = 0;
+pub const DIRTY: usize = 1;
+pub const CARET: usize = 2;
+pub const NUM_VARS: usize = 3;
+pub const PIXELS: usize = 8;
+pub const VARS: usize = PIXELS + BYTES_PER_ROW * SCREEN_HEIGHT / 4;
+pub const STR_WORDS: usize = 64;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Caret {
+  pub row: u8,
+  pub column: u8,
+  pub visible: bool,
+}
+
+pub struct SharedState {
+  words: Box<[AtomicU32]>,
+  /// Start of real, integer and string variables.
+  vars: [usize; 3],
+}
+
+impl SharedState {
+  pub fn new(code: &Code) -> Self {
+    let [reals, ints, strs] = code.num_vars;
+    let vars = [VARS, VARS + reals * 2, VARS + reals * 2 + ints];
+    let len = vars[2] + strs * STR_WORDS;
+    let words: Box<[AtomicU32]> = (0..len).map(|_| AtomicU32::new(0)).collect();
+    for (i, &n) in code.num_vars.iter().enumerate() {
+      words[NUM_VARS + i].store(n as u32, Ordering::Relaxed);
+    }
+    Self { words, vars }
+  }
+
+  pub fn as_ptr(&self) -> *const u32 {
+    self.words.as_ptr() as *const u32
+  }
+
+  pub fn len_in_words(&self) -> usize {
+    self.words.len()
+  }
+
+  /// Writes the changed rows of the screen, the caret and the variables of
+  /// `machine`, which runs the `Code` the state is created for.
+  pub fn publish(&self, screen: &mut Screen, caret: Caret, machine: &Machine) {
+    let dirty = screen.take_dirty();
+    let seq = self.words[SEQ].load(Ordering::Relaxed);
+    self.words[SEQ].store(seq.wrapping_add(1), Ordering::Relaxed);
+    fence(Ordering::Release);
+
+    if let Some(area) = &dirty {
+      let start = area.top as usize * BYTES_PER_ROW / 4;
+      self.store_bytes(PIXELS + start, screen.rows(area));
+    }
+    let caret = caret.row as u32
+      | (caret.column as u32) << 8
+      | (caret.visible as u32) << 16;
+    self.words[CARET].store(caret, Ordering::Relaxed);
+    for (i, &x) in machine.real_vars().iter().enumerate() {
+      let x: f64 = x.into();
+      let bits = x.to_bits();
+      let word = self.vars[0] + i * 2;
+      self.words[word].store(bits as u32, Ordering::Relaxed);
+      self.words[word + 1].store((bits >> 32) as u32, Ordering::Relaxed);
+    }
+    for (i, &x) in machine.int_vars().iter().enumerate() {
+      self.words[self.vars[1] + i].store(x as i32 as u32, Ordering::Relaxed);
+    }
+    let mut buf = [0; STR_WORDS * 4];
+    for (i, s) in machine.str_vars().iter().enumerate() {
+      buf[0] = s.len() as u8;
+      buf[1..=s.len()].copy_from_slice(s);
+      let len = (s.len() + 4) / 4 * 4;
+      self.store_bytes(self.vars[2] + i * STR_WORDS, &buf[..len]);
+    }
+
+    self.words[SEQ].store(seq.wrapping_add(2), Ordering::Release);
+    if let Some(area) = dirty {
+      let _ = self.words[DIRTY].fetch_update(
+        Ordering::Release,
+        Ordering::Relaxed,
+        |old| Some(encode_area(union(decode_area(old), area))),
+      );
+    }
+  }
+
+  /// `bytes` is a multiple of 4 bytes long.
+  fn store_bytes(&self, word: usize, bytes: &[u8]) {
+    for (i, chunk) in bytes.chunks_exact(4).enumerate() {
+      let value = u32::from_le_bytes([chunk[0], chunk[1], chunk[2], chunk[3]]);
+      self.words[word + i].store(value, Ordering::Relaxed);
+    }
+  }
+}
+
+fn encode_area(area: DirtyArea) -> u32 {
+  u32::from_le_bytes([area.left, area.top, area.right, area.bottom])
+}
+
+/// 0 is no area.
+fn decode_area(word: u32) -> Option<DirtyArea> {
+  let [left, top, right, bottom] = word.to_le_bytes();
+  if right > left && bottom > top {
+    Some(DirtyArea {
+      left,
+      top,
+      right,
+      bottom,
+    })
+  } else {
+    None
+  }
+}
+
+fn union(a: Option<DirtyArea>, b: DirtyArea) -> DirtyArea {
+  match a {
+    Some(a) => DirtyArea {
+      left: a.left.min(b.left),
+      top: a.top.min(b.top),
+      right: a.right.max(b.right),
+      bottom: a.bottom.max(b.bottom),
+    },
+    None => b,
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use crate::parser::parse;
+  use crate::vm::{compile, VarKind};
+  use pretty_assertions::assert_eq;
+
+  #[test]
+  fn publish() {
+    let text = "10 a=1.5:b%=-2:c$=\"hello\"\n";
+    let program = parse(text);
+    let code = compile(&program, text).unwrap();
+    let state = SharedState::new(&code);
+    assert_eq!(state.len_in_words(), VARS + 2 + 1 + STR_WORDS);
+    let mut machine = Machine::new(code);
+    let mut screen = Screen::new();
+    let caret = Caret {
+      row: 2,
+      column: 3,
+      visible: true,
+    };
+    state.publish(&mut screen, caret, &machine);
+
+    let word = |i: usize| state.words[i].load(Ordering::SeqCst);
+    assert_eq!(word(SEQ), 2);
+    assert_eq!(word(DIRTY), 0);
+    assert_eq!(word(CARET), 0x10302);
+    assert_eq!([word(3), word(4), word(5)], [1, 1, 1]);
+
+    machine.set_var(VarKind::Real, 0, None, b"1.5").unwrap();
+    machine.set_var(VarKind::Int, 0, None, b"-2").unwrap();
+    machine.set_var(VarKind::Str, 0, None, b"hello").unwrap();
+    screen.draw_point(9, 1, 1);
+    screen.draw_point(100, 3, 1);
+    state.publish(&mut screen, caret, &machine);
+    assert_eq!(word(SEQ), 4);
+    assert_eq!(decode_area(word(DIRTY)), screen_area(9, 1, 101, 4));
+    assert_eq!(word(PIXELS + 5), 0x4000);
+    assert_eq!(
+      f64::from_bits(word(VARS) as u64 | (word(VARS + 1) as u64) << 32),
+      1.5
+    );
+    assert_eq!(word(VARS + 2) as i32, -2);
+    assert_eq!(word(VARS + 3).to_le_bytes(), *b"\x05hel");
+    assert_eq!(word(VARS + 4).to_le_bytes()[..2], *b"lo");
+
+    // The UI takes the area, and later changes accumulate again.
+    state.words[DIRTY].swap(0, Ordering::SeqCst);
+    screen.draw_point(0, 0, 1);
+    state.publish(&mut screen, caret, &machine);
+    state.publish(&mut screen, caret, &machine);
+    assert_eq!(decode_area(word(DIRTY)), screen_area(0, 0, 1, 1));
+  }
+
+  fn screen_area(
+    left: u8,
+    top: u8,
+    right: u8,
+    bottom: u8,
+  ) -> Option<DirtyArea> {
+    Some(DirtyArea {
+      left,
+      top,
+      right,
+      bottom,
+    })
+  }
+}
@@ -0,0 +1,123 @@
+use smallvec::SmallVec;
+use std::ops::Range;
+
+/// A string stored in a variable or an array. Strings up to 16 bytes are
+/// kept inline, so most variables never allocate.
+pub type Str = SmallVec<[u8; 16]>;
+
+/// The stack of temporary strings of string expressions.
+///
+/// The strings are stored back to back in one buffer, so that pushing and
+/// popping them doesn't allocate once the buffer is large enough, and
+/// concatenating the top two strings moves no bytes. The stack is emptied
+/// by the end of every statement, and its size is bounded by the depth of
+/// expressions, since no string is longer than 255 bytes.
+#[derive(Debug, Clone, Default)]
+pub(super) struct StrStack {
+  /// May contain the bytes of popped strings after the last string.
+  bytes: Vec<u8>,
+  ends: Vec<usize>,
+}
+
+impl StrStack {
+  pub fn clear(&mut self) {
+    self.bytes.clear();
+    self.ends.clear();
+  }
+
+  pub fn push(&mut self, s: &[u8]) {
+    self.bytes.truncate(self.end());
+    self.bytes.extend_from_slice(s);
+    self.ends.push(self.bytes.len());
+  }
+
+  /// Pops the last string. The returned slice is valid until the next push.
+  pub fn pop(&mut self) -> &[u8] {
+    let end = self.ends.pop().unwrap();
+    &self.bytes[self.end()..end]
+  }
+
+  /// Pops the last two strings, returned in the order they were pushed.
+  pub fn pop2(&mut self) -> (&[u8], &[u8]) {
+    let end = self.ends.pop().unwrap();
+    let mid = self.ends.pop().unwrap();
+    let start = self.end();
+    (&self.bytes[start..mid], &self.bytes[mid..end])
+  }
+
+  /// Returns the last string.
+  pub fn last(&self) -> &[u8] {
+    &self.bytes[self.start()..self.end()]
+  }
+
+  /// Joins the last two strings, if the result is not longer than `max_len`.
+  pub fn concat(&mut self, max_len: usize) -> bool {
+    let end = self.ends.pop().unwrap();
+    if end - self.start() > max_len {
+      self.ends.push(end);
+      return false;
+    }
+    *self.ends.last_mut().unwrap() = end;
+    true
+  }
+
+  /// Replaces the last string with its substring in `range`.
+  pub fn keep(&mut self, range: Range<usize>) {
+    let start = self.start();
+    let len = range.len();
+    self
+      .bytes
+      .copy_within(start + range.start..start + range.end, start);
+    *self.ends.last_mut().unwrap() = start + len;
+  }
+
+  fn start(&self) -> usize {
+    match self.ends.len() {
+      0 | 1 => 0,
+      n => self.ends[n - 2],
+    }
+  }
+
+  fn end(&self) -> usize {
+    self.ends.last().copied().unwrap_or(0)
+  }
+}
+
+#[cfg(test)]
+mod tests {
+  use super::*;
+  use pretty_assertions::assert_eq;
+
+  #[test]
+  fn str_size() {
+    assert_eq!(std::mem::size_of::<Str>(), std::mem::size_of::<Vec<u8>>());
+  }
+
+  #[test]
+  fn push_pop() {
+    let mut strs = StrStack::default();
+    strs.push(b"abc");
+    strs.push(b"de");
+    assert_eq!(strs.pop(), b"de");
+    strs.push(b"fgh");
+    assert_eq!(strs.pop2(), (&b"abc"[..], &b"fgh"[..]));
+    strs.push(b"");
+    assert_eq!(strs.pop(), b"");
+  }
+
+  #[test]
+  fn concat_and_keep() {
+    let mut strs = StrStack::default();
+    strs.push(b"x");
+    strs.push(b"abc");
+    strs.push(b"de");
+    assert!(strs.concat(5));
+    assert_eq!(strs.last(), b"abcde");
+    strs.push(b"f");
+    assert!(!strs.concat(5));
+    assert_eq!(strs.pop(), b"f");
+    strs.keep(1..4);
+    assert_eq!(strs.pop(), b"bcd");
+    assert_eq!(strs.pop(), b"x");
+  }
+}